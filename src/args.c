@@ -8,9 +8,10 @@
 #include <unistd.h>
 
 #include "./smog-meter.h"
+#include "./util.h"
 
 static const char doc[] = "A dirty page counter";
-static const char args_doc[] = "PID [VMA_NAME]";
+static const char args_doc[] = "PID [VMA_NAME]\n--replay=FILE [VMA_NAME]\n--daemon=SOCKET";
 
 static struct argp_option options[] = {
     { "monitor-interval", 'M', "INTERVAL", 0,
@@ -21,6 +22,40 @@ static struct argp_option options[] = {
       "track the softdirty bits for all pages", 0},
     { "track-accessed", 'T', 0, 0,
       "track the access bits for all pages (expensive)", 0},
+    { "track-numa", 'N', 0, 0,
+      "break down pages by the NUMA node they reside on", 0},
+    { "skip-unpopulated", 'u', 0, 0,
+      "skip VMAs without resident pages according to smaps", 0},
+    { "track-page-cache", 'P', 0, 0,
+      "track resident and dirty page cache pages of the file mapped by PID self", 0},
+    { "granularity", 'g', "SIZES", 0,
+      "also count accessed and dirty blocks of these comma-separated sizes, e.g. 64K,2M", 0 },
+    { "windows", 'W', "MILLIS", 0,
+      "also count the pages accessed and dirtied within windows of these comma-separated lengths,"
+      " multiples of the monitor interval, e.g. 1000,10000", 0 },
+    { "rolling", 'L', "MILLIS", 0,
+      "keep rolling statistics of the dirty rate and working set of every VMA over this horizon,"
+      " a multiple of the monitor interval, and summarize them at the end", 0 },
+    { "track-process", 'O', 0, 0,
+      "report the faults and CPU time of the process per frame, to quantify the cost of tracking", 0 },
+    { "track-schedstat", 'X', 0, 0,
+      "also report the scheduler statistics of the process per frame, implies -O", 0 },
+    { "trigger", 'B', "TERMS", 0,
+      "write the trace only around bursts started by these comma-separated conditions: rate=PAGES"
+      " and vma-rate=PAGES dirtied per second by the process or any VMA, growth=SIZE committed since"
+      " the previous frame; a burst takes frames=N (50) at interval=MILLIS (a tenth of the monitor"
+      " interval), after the ring=N (10) frames kept before it. requires -t.", 0 },
+    { "reclaim", 'A', "TERMS", 0,
+      "act on the pages of the filtered VMAs that stay neither accessed nor dirtied for after=FRAMES"
+      " (3) frames: cold to advise MADV_COLD (default), pageout for MADV_PAGEOUT, or node=N to move"
+      " them; at most limit=SIZE (64M) per second. dry-run, implied when replaying, only counts"
+      " them. requires -T or -D and -f.", 0 },
+    { "track-stacks", 'H', 0, 0,
+      "report the committed and dirty pages of the stack of every thread, found by its stack"
+      " pointer, and name the stacks of threads other than the main one [stack:TID]", 0 },
+    { "cpu-budget", 'b', "PERCENT", 0,
+      "stay within this share of a core by lengthening the interval, and dropping accessed tracking"
+      " if that is not enough", 0 },
     { "min-vma-reserved", 'r', "PAGES", 0,
       "the minimum reserved pages of a VMA to be reported", 1 },
     { "min-vma-committed", 'c', "PAGES", 0,
@@ -29,13 +64,40 @@ static struct argp_option options[] = {
       "the minimum dirty pages of a VMA to be reported", 1 },
     { "min-vma-dirty", 'd', "PAGES", 0,
       "the minimum dirty pages of a VMA to be reported", 1 },
+    { "filter", 'f', "TERMS", 0,
+      "only monitor the VMAs selected by these comma-separated terms: pathname globs, !globs to"
+      " exclude, perms=MASK, anon, file, addr=START-END and min=SIZE. VMA_NAME is an additional"
+      " glob.", 1 },
     { "tracefile", 't', "FILE", 0,
       "an output file for detailed page trace data", 2 },
+    { "checkpoint", 'C', "FILE", 0,
+      "checkpoint the state of the process to FILE, and resume from it on a restart against the"
+      " same process", 2 },
+    { "checkpoint-frames", 'K', "FRAMES", 0,
+      "the frames between checkpoints, 10 by default", 2 },
+    { "record", 'R', "FILE", 0,
+      "record all procfs traffic of the session to FILE", 2 },
+    { "replay", 'p', "FILE", 0,
+      "replay a recorded session from FILE at full speed instead of monitoring a PID", 2 },
     { "verbose", 'v', 0, 0,
       "show additional output, pass multiple times for even more output", 3 },
+    { "heatmap-width", 'w', "COLUMNS", 0,
+      "the number of buckets each VMA is rendered into with -vv", 3 },
+    { "daemon", 'S', "SOCKET", 0,
+      "run as a daemon, accepting requests on the unix domain SOCKET", 4 },
     { 0 }
 };
 
+// append terms to the VMA filter
+static int add_filter(struct arguments *arguments, const char *terms) {
+    char *filter = arguments->filter ? makestr("%s,%s", arguments->filter, terms) : strdup(terms);
+    if (!filter)
+        return 1;
+    free(arguments->filter);
+    arguments->filter = filter;
+    return 0;
+}
+
 static error_t parse_opt(int key, char *arg, struct argp_state *state) {
     struct arguments *arguments = (struct arguments*)state->input;
 
@@ -60,6 +122,80 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
         case 'D':
             arguments->track_softdirty = 1;
             break;
+        case 'N':
+            arguments->track_numa = 1;
+            break;
+        case 'u':
+            arguments->skip_unpopulated = 1;
+            break;
+        case 'P':
+            arguments->track_page_cache = 1;
+            break;
+        case 'H':
+            arguments->track_stacks = 1;
+            break;
+        case 'O':
+            arguments->track_process = 1;
+            break;
+        case 'X':
+            arguments->track_process = 1;
+            arguments->track_schedstat = 1;
+            break;
+        case 'g':
+            for (char *size = strtok(arg, ","); size; size = strtok(NULL, ",")) {
+                size_t bytes;
+                if (parse_size(size, &bytes) != 0 || !bytes || bytes % g_system_pagesize)
+                    argp_failure(state, 1, 0, "invalid granularity: %s", size);
+
+                size_t *granularities = realloc(arguments->granularities,
+                        (arguments->num_granularities + 1) * sizeof(*granularities));
+                if (!granularities)
+                    argp_failure(state, 1, errno, "unable to allocate memory");
+                granularities[arguments->num_granularities++] = bytes / g_system_pagesize;
+                arguments->granularities = granularities;
+            }
+            break;
+        case 'W':
+            for (char *millis = strtok(arg, ","); millis; millis = strtok(NULL, ",")) {
+                char *end;
+                errno = 0;
+                size_t length = strtoull(millis, &end, 0);
+                if (errno != 0 || end == millis || *end || !length)
+                    argp_failure(state, 1, errno, "invalid window length: %s", millis);
+
+                size_t *windows = realloc(arguments->windows,
+                        (arguments->num_windows + 1) * sizeof(*windows));
+                if (!windows)
+                    argp_failure(state, 1, errno, "unable to allocate memory");
+                windows[arguments->num_windows++] = length;
+                arguments->windows = windows;
+            }
+            break;
+        case 'L':
+            errno = 0;
+            char *rolling_end;
+            arguments->rolling = strtoull(arg, &rolling_end, 0);
+            if (errno != 0 || rolling_end == arg || *rolling_end || !arguments->rolling)
+                argp_failure(state, 1, errno, "invalid rolling horizon: %s", arg);
+            break;
+        case 'b':
+            errno = 0;
+            char *end;
+            arguments->cpu_budget = strtod(arg, &end);
+            if (errno != 0 || end == arg || *end || arguments->cpu_budget <= 0
+                    || arguments->cpu_budget > 100)
+                argp_failure(state, 1, errno, "invalid CPU budget: %s", arg);
+            break;
+        case 'B':
+            if (trigger_parse(&arguments->trigger, arg) != 0)
+                argp_failure(state, 1, 0, "invalid trigger: %s", arg);
+            if (!trigger_enabled(&arguments->trigger))
+                argp_failure(state, 1, 0, "a trigger needs a rate, vma-rate or growth condition.");
+            break;
+        case 'A':
+            if (reclaim_parse(&arguments->reclaim, arg) != 0)
+                argp_failure(state, 1, 0, "invalid reclaim action: %s", arg);
+            break;
         case 'r':
             errno = 0;
             arguments->min_vma_reserved = strtoll(arg, NULL, 0);
@@ -84,6 +220,10 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
             if (errno != 0)
                 argp_failure(state, 1, errno, "invalid number: %s", arg);
             break;
+        case 'f':
+            if (add_filter(arguments, arg) != 0)
+                argp_failure(state, 1, errno, "unable to allocate memory");
+            break;
         case 't':
             // avoid leaking memory if -t passed multiple times
             free(arguments->tracefile);
@@ -91,17 +231,55 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
             if (!arguments->tracefile)
                 argp_failure(state, 1, errno, "unable to allocate memory");
             break;
+        case 'C':
+            free(arguments->checkpoint);
+            arguments->checkpoint = strdup(arg);
+            if (!arguments->checkpoint)
+                argp_failure(state, 1, errno, "unable to allocate memory");
+            break;
+        case 'K':
+            errno = 0;
+            char *checkpoint_end;
+            arguments->checkpoint_frames = strtoull(arg, &checkpoint_end, 0);
+            if (errno != 0 || checkpoint_end == arg || *checkpoint_end || !arguments->checkpoint_frames)
+                argp_failure(state, 1, errno, "invalid number of frames: %s", arg);
+            break;
+        case 'R':
+            free(arguments->record);
+            arguments->record = strdup(arg);
+            if (!arguments->record)
+                argp_failure(state, 1, errno, "unable to allocate memory");
+            break;
+        case 'p':
+            free(arguments->replay);
+            arguments->replay = strdup(arg);
+            if (!arguments->replay)
+                argp_failure(state, 1, errno, "unable to allocate memory");
+            break;
         case 'v':
             arguments->verbose += 1;
             break;
+        case 'w':
+            errno = 0;
+            arguments->heatmap_width = strtoll(arg, NULL, 0);
+            if (errno != 0 || !arguments->heatmap_width)
+                argp_failure(state, 1, errno, "invalid width: %s", arg);
+            break;
+        case 'S':
+            free(arguments->daemon);
+            arguments->daemon = strdup(arg);
+            if (!arguments->daemon)
+                argp_failure(state, 1, errno, "unable to allocate memory");
+            break;
 
         case ARGP_KEY_ARG:
-            if (state->arg_num >= 2)
+            // a replay takes the PID from the recording
+            if (state->arg_num >= (arguments->replay ? 1 : 2))
                 argp_usage(state);
-            if (state->arg_num >= 1) {
+            if (state->arg_num >= 1 || arguments->replay) {
                 free(arguments->vma);
                 arguments->vma = strdup(arg);
-                if (!arguments->vma)
+                if (!arguments->vma || add_filter(arguments, arg) != 0)
                     argp_failure(state, 1, errno, "unable to allocate memory");
             } else {
                 if (!strcmp(arg, "self")) {
@@ -117,12 +295,68 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
             break;
 
         case ARGP_KEY_END:
+            for (size_t w = 0; w < arguments->num_windows; ++w) {
+                if (!arguments->delay || arguments->windows[w] % arguments->delay)
+                    argp_failure(state, 1, 0, "window length %zu ms is not a multiple of the interval.",
+                                 arguments->windows[w]);
+            }
+
+            if (arguments->rolling && (!arguments->delay || arguments->rolling % arguments->delay))
+                argp_failure(state, 1, 0, "rolling horizon %zu ms is not a multiple of the interval.",
+                             arguments->rolling);
+
+            if (trigger_enabled(&arguments->trigger)) {
+                if (!arguments->tracefile)
+                    argp_failure(state, 1, 0, "a trigger requires a tracefile.");
+                if (arguments->cpu_budget)
+                    argp_failure(state, 1, 0, "a trigger cannot be combined with a CPU budget.");
+                if (!arguments->trigger.interval)
+                    arguments->trigger.interval = arguments->delay >= 10 ? arguments->delay / 10 : 1;
+            }
+
+            if (reclaim_enabled(&arguments->reclaim)) {
+                if (!arguments->track_accessed && !arguments->track_softdirty)
+                    argp_failure(state, 1, 0, "reclaim requires accessed or softdirty tracking.");
+                if (!arguments->filter)
+                    argp_failure(state, 1, 0, "reclaim requires a VMA filter.");
+                if (arguments->replay)
+                    arguments->reclaim.dry_run = 1;
+            }
+
+            if (!arguments->checkpoint_frames)
+                arguments->checkpoint_frames = 10;
+
+            if (arguments->daemon) {
+                if (state->arg_num > 0)
+                    argp_failure(state, 1, 0, "daemon mode takes its targets from the socket.");
+                break;
+            }
+
+            if (arguments->replay) {
+                if (arguments->record)
+                    argp_failure(state, 1, 0, "cannot record a replay.");
+                if (arguments->track_numa)
+                    argp_failure(state, 1, 0, "NUMA tracking is not available when replaying.");
+                if (arguments->track_page_cache)
+                    argp_failure(state, 1, 0, "page cache tracking is not available when replaying.");
+                if (arguments->cpu_budget)
+                    argp_failure(state, 1, 0, "a CPU budget does not apply when replaying.");
+                if (arguments->checkpoint)
+                    argp_failure(state, 1, 0, "checkpoints are not available when replaying.");
+                if (arguments->track_stacks)
+                    argp_failure(state, 1, 0, "stack tracking is not available when replaying.");
+                break;
+            }
+
             if (state->arg_num < 1)
                 argp_usage(state);
 
             if (arguments->self_map && !arguments->vma)
                 argp_failure(state, 1, 0, "PID of self requires a VMA_NAME parameter to be set.");
 
+            if (arguments->track_page_cache && !arguments->self_map)
+                argp_failure(state, 1, 0, "page cache tracking requires a PID of self.");
+
             break;
 
         default:
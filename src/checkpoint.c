@@ -0,0 +1,524 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#include "./checkpoint.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "./rolling.h"
+#include "./util.h"
+
+// the bit planes of a VMA, as in target.c
+#define NUM_PLANES 3
+
+static int read_start_time(pid_t pid, uint64_t *start_time) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "%s: ", path);
+        perror("fopen");
+        return 1;
+    }
+
+    char line[1024];
+    int ok = fgets(line, sizeof(line), f) != NULL;
+    fclose(f);
+
+    // the command name may contain spaces and parentheses, so the fields
+    // are counted from the last closing one
+    unsigned long long start;
+    char *fields = ok ? strrchr(line, ')') : NULL;
+    if (!fields || sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u"
+                          " %*d %*d %*d %*d %*d %*d %llu", &start) != 1) {
+        fprintf(stderr, "%s: malformed stat\n", path);
+        return 1;
+    }
+
+    *start_time = start;
+    return 0;
+}
+
+struct buffer {
+    char *data;
+    size_t len;
+    size_t capacity;
+};
+
+// append data, or zeros if it is NULL, at the next offset aligned to 8 bytes
+static int put(struct buffer *b, const void *data, size_t len, uint64_t *offset) {
+    size_t at = (b->len + 7) & ~(size_t)7;
+    if (at + len > b->capacity) {
+        size_t capacity = b->capacity ? b->capacity : 1 << 16;
+        while (capacity < at + len)
+            capacity *= 2;
+        char *new_data = realloc(b->data, capacity);
+        if (!new_data) {
+            perror("realloc");
+            return 2;
+        }
+        b->data = new_data;
+        b->capacity = capacity;
+    }
+
+    memset(b->data + b->len, 0, at - b->len);
+    if (data)
+        memcpy(b->data + at, data, len);
+    else
+        memset(b->data + at, 0, len);
+    b->len = at + len;
+    *offset = at;
+    return 0;
+}
+
+static int put_rolling(struct buffer *b, const struct rolling *r, uint64_t *offset) {
+    int res = put(b, NULL, rolling_record_size(r->horizon), offset);
+    if (res == 0)
+        rolling_save(r, b->data + *offset);
+    return res;
+}
+
+static int put_vma(const struct target *t, size_t i, struct buffer *b,
+                   struct checkpoint_vma *rec) {
+    const struct vma_table *vmas = &t->vmas;
+    const struct vma_info *info = &vmas->info[i];
+
+    memset(rec, 0, sizeof(*rec));
+    rec->start = vmas->start[i];
+    rec->end = vmas->end[i];
+    rec->committed = vmas->committed[i];
+    rec->accessed = vmas->accessed[i];
+    rec->softdirty = vmas->softdirty[i];
+    memcpy(rec->perms, info->perms, sizeof(info->perms));
+
+    int res = put(b, info->pathname, strlen(info->pathname) + 1, &rec->pathname);
+    if (res == 0 && info->planes) {
+        size_t words = (info->planes_end - info->planes_start + 63) / 64;
+        rec->planes_start = info->planes_start;
+        rec->planes_end = info->planes_end;
+        res = put(b, info->planes, NUM_PLANES * words * sizeof(*info->planes), &rec->planes);
+    }
+
+    if (res == 0 && info->windows) {
+        struct checkpoint_vma_window *windows = calloc(t->num_windows, sizeof(*windows));
+        if (!windows) {
+            perror("calloc");
+            return 2;
+        }
+        for (size_t w = 0; w < t->num_windows; ++w) {
+            windows[w].accessed = info->windows[w].accessed;
+            windows[w].softdirty = info->windows[w].softdirty;
+            windows[w].epoch = info->window_epochs[w];
+        }
+        res = put(b, windows, t->num_windows * sizeof(*windows), &rec->windows);
+        free(windows);
+
+        if (res == 0 && info->window_bits) {
+            size_t words = (info->window_end - info->window_start + 63) / 64;
+            rec->window_start = info->window_start;
+            rec->window_end = info->window_end;
+            res = put(b, info->window_bits, 2 * t->num_windows * words * sizeof(*info->window_bits),
+                      &rec->window_bits);
+        }
+    }
+
+    if (res == 0 && info->rolling)
+        res = put_rolling(b, info->rolling, &rec->rolling);
+    return res;
+}
+
+static int build(const struct target *t, struct buffer *b) {
+    struct checkpoint_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.page_size = g_system_pagesize;
+    header.pid = t->pid;
+    header.sec = t->frame.timestamp.tv_sec;
+    header.usec = t->frame.timestamp.tv_usec;
+    header.track_accessed = t->config.track_accessed;
+    header.track_softdirty = t->config.track_softdirty;
+    header.has_planes = t->has_planes;
+
+    int res = read_start_time(t->pid, &header.start_time);
+    if (res != 0)
+        return res;
+
+    uint64_t offset;
+    res = put(b, NULL, sizeof(header), &offset);
+    if (res != 0)
+        return res;
+
+    header.num_vmas = t->vmas.len;
+    res = put(b, NULL, t->vmas.len * sizeof(struct checkpoint_vma), &header.vmas);
+    for (size_t i = 0; res == 0 && i < t->vmas.len; ++i) {
+        struct checkpoint_vma rec;
+        res = put_vma(t, i, b, &rec);
+        if (res == 0)
+            memcpy(b->data + header.vmas + i * sizeof(rec), &rec, sizeof(rec));
+    }
+    if (res != 0)
+        return res;
+
+    if (t->num_windows) {
+        struct checkpoint_window windows[t->num_windows];
+        for (size_t w = 0; w < t->num_windows; ++w) {
+            windows[w].length = t->frame.windows[w].length;
+            windows[w].frames = t->frame.windows[w].frames;
+            windows[w].elapsed_ms = t->frame.windows[w].elapsed_ms;
+            windows[w].epoch = t->window_epochs[w];
+        }
+        header.num_windows = t->num_windows;
+        res = put(b, windows, sizeof(windows), &header.windows);
+        if (res != 0)
+            return res;
+    }
+
+    if (t->rolling) {
+        header.rolling_horizon = t->rolling->horizon;
+        res = put_rolling(b, t->rolling, &header.rolling);
+        if (res != 0)
+            return res;
+    }
+
+    header.size = b->len;
+    memcpy(b->data, &header, sizeof(header));
+    return 0;
+}
+
+int checkpoint_write(const struct target *t, const char *path) {
+    if (t->io.mode == PROCFS_REPLAY) {
+        fprintf(stderr, "checkpoints are not available when replaying\n");
+        return 1;
+    }
+
+    struct buffer b = { NULL, 0, 0 };
+    int res = build(t, &b);
+    if (res != 0) {
+        free(b.data);
+        return res;
+    }
+
+    // written aside and renamed, so a crash leaves the previous checkpoint
+    char *tmp = makestr("%s.tmp", path);
+    if (!tmp) {
+        perror("makestr");
+        free(b.data);
+        return 2;
+    }
+
+    int fd = open(tmp, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "%s: ", tmp);
+        perror("open");
+        free(tmp);
+        free(b.data);
+        return 1;
+    }
+
+    size_t written = 0;
+    while (res == 0 && written < b.len) {
+        ssize_t bytes = write(fd, b.data + written, b.len - written);
+        if (bytes < 0) {
+            fprintf(stderr, "%s: ", tmp);
+            perror("write");
+            res = 1;
+        } else {
+            written += bytes;
+        }
+    }
+    if (res == 0 && fsync(fd) != 0) {
+        fprintf(stderr, "%s: ", tmp);
+        perror("fsync");
+        res = 1;
+    }
+    close(fd);
+
+    if (res == 0 && rename(tmp, path) != 0) {
+        fprintf(stderr, "%s: ", path);
+        perror("rename");
+        res = 1;
+    }
+    if (res != 0)
+        unlink(tmp);
+
+    free(tmp);
+    free(b.data);
+    return res;
+}
+
+struct mapping {
+    const char *data;
+    size_t size;
+};
+
+// a part of the checkpoint, or NULL if it is not within the file
+static const void *part(const struct mapping *m, uint64_t offset, uint64_t n, size_t size) {
+    if (!offset || offset % 8 || offset > m->size)
+        return NULL;
+    if (size && n > (m->size - offset) / size)
+        return NULL;
+    return m->data + offset;
+}
+
+static const struct rolling_record *rolling_part(const struct mapping *m, uint64_t offset,
+                                                 uint64_t horizon) {
+    if (!horizon || horizon > m->size)
+        return NULL;
+    return part(m, offset, 1, rolling_record_size(horizon));
+}
+
+// the configuration parts of the state are restored only where it is unchanged
+struct restore {
+    const struct checkpoint_header *header;
+    int planes;
+    int windows;
+    size_t horizon;
+};
+
+static int restore_vma(const struct restore *r, const struct mapping *m,
+                       const struct checkpoint_vma *rec, struct vma_table *table) {
+    if (rec->start >= rec->end || (table->len && rec->start < table->end[table->len - 1]))
+        return SMOG_STALE_CHECKPOINT;
+
+    const char *pathname = part(m, rec->pathname, 1, 1);
+    if (!pathname || !memchr(pathname, 0, m->size - rec->pathname))
+        return SMOG_STALE_CHECKPOINT;
+
+    int res = append_vma(table, rec->start, rec->end, pathname);
+    if (res != 0)
+        return res;
+
+    size_t i = table->len - 1;
+    struct vma_info *info = &table->info[i];
+    table->committed[i] = rec->committed;
+    table->accessed[i] = rec->accessed;
+    table->softdirty[i] = rec->softdirty;
+    memcpy(info->perms, rec->perms, sizeof(info->perms) - 1);
+
+    if (r->planes && rec->planes) {
+        size_t words = (rec->planes_end - rec->planes_start + 63) / 64;
+        const uint64_t *planes = part(m, rec->planes, NUM_PLANES * words, sizeof(*planes));
+        if (rec->planes_start >= rec->planes_end || !planes)
+            return SMOG_STALE_CHECKPOINT;
+
+        info->planes = malloc(NUM_PLANES * words * sizeof(*info->planes));
+        if (!info->planes) {
+            perror("malloc");
+            return 2;
+        }
+        memcpy(info->planes, planes, NUM_PLANES * words * sizeof(*info->planes));
+        info->planes_start = rec->planes_start;
+        info->planes_end = rec->planes_end;
+    }
+
+    size_t n = r->header->num_windows;
+    if (r->windows && rec->windows) {
+        const struct checkpoint_vma_window *windows = part(m, rec->windows, n, sizeof(*windows));
+        if (!windows)
+            return SMOG_STALE_CHECKPOINT;
+
+        info->windows = calloc(n, sizeof(*info->windows));
+        info->window_epochs = malloc(n * sizeof(*info->window_epochs));
+        if (!info->windows || !info->window_epochs) {
+            perror("calloc");
+            return 2;
+        }
+        for (size_t w = 0; w < n; ++w) {
+            info->windows[w].accessed = windows[w].accessed;
+            info->windows[w].softdirty = windows[w].softdirty;
+            info->window_epochs[w] = windows[w].epoch;
+        }
+
+        if (rec->window_bits) {
+            size_t words = (rec->window_end - rec->window_start + 63) / 64;
+            const uint64_t *bits = part(m, rec->window_bits, 2 * n * words, sizeof(*bits));
+            if (rec->window_start >= rec->window_end || !bits)
+                return SMOG_STALE_CHECKPOINT;
+
+            info->window_bits = malloc(2 * n * words * sizeof(*info->window_bits));
+            if (!info->window_bits) {
+                perror("malloc");
+                return 2;
+            }
+            memcpy(info->window_bits, bits, 2 * n * words * sizeof(*info->window_bits));
+            info->window_start = rec->window_start;
+            info->window_end = rec->window_end;
+        }
+    }
+
+    if (r->horizon && rec->rolling) {
+        const struct rolling_record *rolling = rolling_part(m, rec->rolling, r->horizon);
+        if (!rolling || rolling->horizon != r->horizon)
+            return SMOG_STALE_CHECKPOINT;
+        info->rolling = rolling_load(rolling, rolling_record_size(r->horizon));
+        if (!info->rolling)
+            return SMOG_STALE_CHECKPOINT;
+    }
+
+    return 0;
+}
+
+static int windows_unchanged(const struct target *t, const struct mapping *m,
+                             const struct checkpoint_header *header) {
+    if (!header->num_windows || header->num_windows != t->config.num_windows)
+        return 0;
+
+    const struct checkpoint_window *windows = part(m, header->windows, header->num_windows,
+                                                   sizeof(*windows));
+    if (!windows)
+        return 0;
+    for (size_t w = 0; w < header->num_windows; ++w) {
+        if (windows[w].length != t->config.windows[w] || windows[w].frames > windows[w].length)
+            return 0;
+    }
+    return 1;
+}
+
+// restore the windows of the target, which prepare_windows then keeps
+static int restore_windows(struct target *t, const struct mapping *m,
+                           const struct checkpoint_header *header) {
+    size_t n = header->num_windows;
+    const struct checkpoint_window *windows = part(m, header->windows, n, sizeof(*windows));
+
+    t->frame.windows = calloc(n, sizeof(*t->frame.windows));
+    t->window_epochs = calloc(n, sizeof(*t->window_epochs));
+    if (!t->frame.windows || !t->window_epochs) {
+        perror("calloc");
+        return 2;
+    }
+    for (size_t w = 0; w < n; ++w) {
+        t->frame.windows[w].length = windows[w].length;
+        t->frame.windows[w].frames = windows[w].frames;
+        t->frame.windows[w].elapsed_ms = windows[w].elapsed_ms;
+        t->window_epochs[w] = windows[w].epoch;
+    }
+    t->num_windows = n;
+    return 0;
+}
+
+static int restore(struct target *t, const struct mapping *m, const char *path) {
+    const struct checkpoint_header *header = (const void*)m->data;
+    if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic))
+            || header->version != CHECKPOINT_VERSION || header->size != m->size) {
+        fprintf(stderr, "%s: not a checkpoint, not resumed\n", path);
+        return SMOG_STALE_CHECKPOINT;
+    }
+
+    uint64_t start_time;
+    int res = read_start_time(t->pid, &start_time);
+    if (res != 0)
+        return res;
+    if (header->pid != (uint64_t)t->pid || header->start_time != start_time
+            || header->page_size != g_system_pagesize) {
+        fprintf(stderr, "%s: checkpoint of another process, not resumed\n", path);
+        return SMOG_STALE_CHECKPOINT;
+    }
+
+    struct restore r;
+    r.header = header;
+    r.planes = header->has_planes
+            && header->track_accessed == (uint32_t)t->config.track_accessed
+            && header->track_softdirty == (uint32_t)t->config.track_softdirty;
+    r.windows = windows_unchanged(t, m, header);
+    r.horizon = header->rolling_horizon == t->config.rolling_horizon ? header->rolling_horizon : 0;
+
+    const struct checkpoint_vma *vmas = part(m, header->vmas, header->num_vmas, sizeof(*vmas));
+    if (header->num_vmas && !vmas) {
+        fprintf(stderr, "%s: corrupt checkpoint, not resumed\n", path);
+        return SMOG_STALE_CHECKPOINT;
+    }
+
+    // restored aside, so nothing is left of a checkpoint that turns out corrupt
+    struct vma_table table;
+    memset(&table, 0, sizeof(table));
+    for (size_t i = 0; res == 0 && i < header->num_vmas; ++i)
+        res = restore_vma(&r, m, &vmas[i], &table);
+
+    struct rolling *rolling = NULL;
+    if (res == 0 && r.horizon && header->rolling) {
+        const struct rolling_record *rec = rolling_part(m, header->rolling, r.horizon);
+        rolling = rec ? rolling_load(rec, rolling_record_size(r.horizon)) : NULL;
+        if (!rolling)
+            res = SMOG_STALE_CHECKPOINT;
+    }
+
+    if (res != 0) {
+        destroy_vmas(&table);
+        rolling_destroy(rolling);
+        if (res == SMOG_STALE_CHECKPOINT)
+            fprintf(stderr, "%s: corrupt checkpoint, not resumed\n", path);
+        return res;
+    }
+
+    if (r.windows) {
+        res = restore_windows(t, m, header);
+        if (res != 0) {
+            destroy_vmas(&table);
+            rolling_destroy(rolling);
+            return res;
+        }
+    }
+
+    destroy_vmas(&t->vmas);
+    t->vmas = table;
+    t->rolling = rolling;
+    t->has_planes = r.planes;
+    return 0;
+}
+
+int checkpoint_restore(struct target *t, const char *path) {
+    if (t->io.mode == PROCFS_REPLAY) {
+        fprintf(stderr, "checkpoints are not available when replaying\n");
+        return 1;
+    }
+    if (t->vmas.len || t->has_planes || t->num_windows || t->rolling) {
+        fprintf(stderr, "%s: a checkpoint is only resumed before the first frame\n", path);
+        return 1;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            fprintf(stderr, "%s: no checkpoint, not resumed\n", path);
+            return SMOG_STALE_CHECKPOINT;
+        }
+        fprintf(stderr, "%s: ", path);
+        perror("open");
+        return 1;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) != 0) {
+        fprintf(stderr, "%s: ", path);
+        perror("fstat");
+        close(fd);
+        return 1;
+    }
+    if ((size_t)sb.st_size < sizeof(struct checkpoint_header)) {
+        close(fd);
+        fprintf(stderr, "%s: not a checkpoint, not resumed\n", path);
+        return SMOG_STALE_CHECKPOINT;
+    }
+
+    void *data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "%s: ", path);
+        perror("mmap");
+        return 1;
+    }
+
+    struct mapping m = { data, sb.st_size };
+    int res = restore(t, &m, path);
+    munmap(data, sb.st_size);
+    return res;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "./target.h"
+
+#define CHECKPOINT_MAGIC "SMOGCKP1"
+#define CHECKPOINT_VERSION 1
+
+// a checkpoint is a single file of records and arrays, aligned to 8 bytes
+// and referenced by their offset from the start of the file, so that it can
+// be mapped and read in place. an offset of 0 marks an absent part.
+struct checkpoint_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t page_size;
+    uint64_t size;
+
+    // the process, told apart from a later one of the same pid by its start
+    // time in clock ticks after boot
+    uint64_t pid;
+    uint64_t start_time;
+
+    // when the checkpoint was taken
+    uint64_t sec;
+    uint64_t usec;
+
+    // the tracking modes of the bit planes, and whether they are complete
+    uint32_t track_accessed;
+    uint32_t track_softdirty;
+    uint64_t has_planes;
+
+    // the windows, as num_windows checkpoint_window records
+    uint64_t num_windows;
+    uint64_t windows;
+
+    // the rolling statistics of the totals, as a rolling_record
+    uint64_t rolling_horizon;
+    uint64_t rolling;
+
+    // num_vmas checkpoint_vma records, ordered by address
+    uint64_t num_vmas;
+    uint64_t vmas;
+};
+
+struct checkpoint_window {
+    uint64_t length;
+    uint64_t frames;
+    uint64_t elapsed_ms;
+    uint64_t epoch;
+};
+
+struct checkpoint_vma_window {
+    uint64_t accessed;
+    uint64_t softdirty;
+    uint64_t epoch;
+};
+
+struct checkpoint_vma {
+    uint64_t start;
+    uint64_t end;
+    uint64_t committed;
+    uint64_t accessed;
+    uint64_t softdirty;
+    char perms[8];
+    uint64_t pathname;
+
+    // the present, accessed and softdirty bitmaps over the planes extent
+    uint64_t planes_start;
+    uint64_t planes_end;
+    uint64_t planes;
+
+    // num_windows checkpoint_vma_window records, and an accessed and a
+    // softdirty bitmap per window over the window extent
+    uint64_t windows;
+    uint64_t window_start;
+    uint64_t window_end;
+    uint64_t window_bits;
+
+    uint64_t rolling;
+};
+
+// write the state of the target to path, replacing it atomically
+int checkpoint_write(const struct target *t, const char *path);
+
+// restore the state of the target from path before its first frame. returns
+// SMOG_STALE_CHECKPOINT if there is none for the process. state that depends
+// on a configuration that changed since is dropped.
+int checkpoint_restore(struct target *t, const char *path);
+
+#endif  // CHECKPOINT_H_
@@ -0,0 +1,513 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#include "./daemon.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "./smog-meter.h"
+#include "./smogmeter.h"
+#include "./util.h"
+
+#define MAX_CLIENTS 64
+#define MAX_REQUEST 4096
+#define MAX_PENDING (64 << 20)  // bytes queued for a client before dropping it
+
+#define SUBSCRIBE_NONE -1
+#define SUBSCRIBE_ALL 0
+
+struct client {
+    int fd;
+    pid_t subscribed;
+
+    char in[MAX_REQUEST];
+    size_t in_len;
+
+    char *out;
+    size_t out_len;
+    size_t out_capacity;
+};
+
+struct daemon_target {
+    pid_t pid;
+    struct smog_ctx *ctx;
+    char *vma_filter;
+};
+
+static struct client clients[MAX_CLIENTS];
+static size_t num_clients = 0;
+
+static struct daemon_target *targets = NULL;
+static size_t num_targets = 0;
+
+static volatile sig_atomic_t running = 1;
+
+static void handle_signal(int sig) {
+    (void)sig;
+    running = 0;
+}
+
+static void drop_client(size_t c) {
+    close(clients[c].fd);
+    free(clients[c].out);
+    clients[c] = clients[--num_clients];
+}
+
+// queue data for a client, it is flushed as the socket becomes writable.
+static int client_send(struct client *client, const char *buf, size_t len) {
+    if (client->out_len + len > MAX_PENDING) {
+        fprintf(stderr, "daemon: client not keeping up, dropping\n");
+        return 1;
+    }
+
+    if (client->out_len + len > client->out_capacity) {
+        size_t new_capacity = client->out_capacity ? client->out_capacity : 4096;
+        while (new_capacity < client->out_len + len)
+            new_capacity *= 2;
+
+        char *out = realloc(client->out, new_capacity);
+        if (!out) {
+            perror("realloc");
+            return 2;
+        }
+        client->out = out;
+        client->out_capacity = new_capacity;
+    }
+
+    memcpy(client->out + client->out_len, buf, len);
+    client->out_len += len;
+    return 0;
+}
+
+static int client_printf(struct client *client, const char *format, ...) {
+    char buf[MAX_REQUEST];
+
+    va_list ap;
+    va_start(ap, format);
+    int n = vsnprintf(buf, sizeof(buf), format, ap);
+    va_end(ap);
+
+    if (n < 0)
+        return 1;
+    if ((size_t)n >= sizeof(buf))
+        n = sizeof(buf) - 1;
+
+    return client_send(client, buf, n);
+}
+
+static int client_flush(struct client *client) {
+    while (client->out_len > 0) {
+        ssize_t n = send(client->fd, client->out, client->out_len,
+                         MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return 1;
+        }
+        memmove(client->out, client->out + n, client->out_len - n);
+        client->out_len -= n;
+    }
+    return 0;
+}
+
+static struct daemon_target *find_target(pid_t pid) {
+    for (size_t i = 0; i < num_targets; ++i) {
+        if (targets[i].pid == pid)
+            return &targets[i];
+    }
+    return NULL;
+}
+
+// the configuration of a target, from the daemon-wide settings
+static struct smog_config target_config(const struct daemon_target *dt) {
+    struct smog_config config = {
+        arguments.track_accessed,
+        arguments.track_softdirty,
+        0,
+        arguments.skip_unpopulated,
+        dt->vma_filter,
+        0,
+        0,
+        NULL,
+        0,
+        NULL,
+        0,
+        0,
+        0,
+    };
+    return config;
+}
+
+// apply changed daemon-wide settings to all targets
+static int configure_targets(void) {
+    for (size_t i = 0; i < num_targets; ++i) {
+        struct smog_config config = target_config(&targets[i]);
+        int res = smog_configure(targets[i].ctx, &config);
+        if (res != 0)
+            return res;
+    }
+    return 0;
+}
+
+static void remove_target(struct daemon_target *dt) {
+    smog_destroy(dt->ctx);
+    free(dt->vma_filter);
+    *dt = targets[--num_targets];
+}
+
+// render the latest frame of a target in the textual wire format.
+static char *format_frame(struct daemon_target *dt, size_t *len) {
+    char *buf = NULL;
+    FILE *f = open_memstream(&buf, len);
+    if (!f) {
+        perror("open_memstream");
+        return NULL;
+    }
+
+    const struct smog_frame *frame = smog_last_frame(dt->ctx);
+    fprintf(f, "frame %d %ld.%06ld %zu %zu %zu %zu %zu %zu\n",
+            dt->pid, (long)frame->timestamp.tv_sec, (long)frame->timestamp.tv_usec,
+            frame->elapsed_ms, frame->reserved, frame->committed,
+            frame->accessed, frame->softdirty, frame->num_vmas);
+    for (size_t i = 0; i < frame->num_vmas; ++i) {
+        fprintf(f, "vma %#zx %#zx %zu %zu %zu %s\n",
+                frame->vma_start[i], frame->vma_end[i], frame->vma_committed[i],
+                frame->vma_accessed[i], frame->vma_softdirty[i],
+                smog_vma_pathname(dt->ctx, i));
+    }
+    fprintf(f, "end\n");
+
+    if (fclose(f) != 0) {
+        perror("fclose");
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+static int parse_flag(const char *arg, int *flag) {
+    if (!arg)
+        return 1;
+    if (!strcmp(arg, "1") || !strcmp(arg, "on")) {
+        *flag = 1;
+    } else if (!strcmp(arg, "0") || !strcmp(arg, "off")) {
+        *flag = 0;
+    } else {
+        return 1;
+    }
+    return 0;
+}
+
+static int handle_request(struct client *client, char *line) {
+    char *saveptr = NULL;
+    char *cmd = strtok_r(line, " \t", &saveptr);
+    char *arg1 = strtok_r(NULL, " \t", &saveptr);
+    char *arg2 = strtok_r(NULL, "", &saveptr);
+
+    if (!cmd)
+        return 0;
+
+    if (!strcmp(cmd, "add") && arg1) {
+        pid_t pid = strtol(arg1, NULL, 0);
+        if (pid <= 0)
+            return client_printf(client, "error invalid pid: %s\n", arg1);
+        if (find_target(pid))
+            return client_printf(client, "error already monitoring %d\n", pid);
+
+        struct daemon_target *new_targets = realloc(targets, sizeof(*targets) * (num_targets + 1));
+        if (!new_targets) {
+            perror("realloc");
+            return 2;
+        }
+        targets = new_targets;
+
+        struct daemon_target *dt = &targets[num_targets];
+        memset(dt, 0, sizeof(*dt));
+        dt->pid = pid;
+        if (arg2) {
+            dt->vma_filter = strdup(arg2);
+            if (!dt->vma_filter) {
+                perror("strdup");
+                return 2;
+            }
+        }
+
+        struct smog_config config = target_config(dt);
+        dt->ctx = smog_create(&config);
+        if (!dt->ctx) {
+            free(dt->vma_filter);
+            return 2;
+        }
+        if (smog_attach(dt->ctx, pid) != 0) {
+            smog_destroy(dt->ctx);
+            free(dt->vma_filter);
+            return client_printf(client, "error unable to attach to %d\n", pid);
+        }
+        num_targets++;
+
+        printf("daemon: monitoring %d\n", pid);
+        return client_printf(client, "ok\n");
+    } else if (!strcmp(cmd, "remove") && arg1) {
+        struct daemon_target *dt = find_target(strtol(arg1, NULL, 0));
+        if (!dt)
+            return client_printf(client, "error not monitoring %s\n", arg1);
+
+        printf("daemon: no longer monitoring %d\n", dt->pid);
+        remove_target(dt);
+        return client_printf(client, "ok\n");
+    } else if (!strcmp(cmd, "list")) {
+        for (size_t i = 0; i < num_targets; ++i) {
+            int res = client_printf(client, "target %d %s\n", targets[i].pid,
+                                    targets[i].vma_filter ? targets[i].vma_filter : "");
+            if (res != 0)
+                return res;
+        }
+        return client_printf(client, "ok\n");
+    } else if (!strcmp(cmd, "set") && arg1) {
+        if (!strcmp(arg1, "interval")) {
+            uint64_t millis = arg2 ? strtoull(arg2, NULL, 0) : 0;
+            if (millis == 0)
+                return client_printf(client, "error invalid interval\n");
+            arguments.delay = millis;
+        } else if (!strcmp(arg1, "accessed")) {
+            if (parse_flag(arg2, &arguments.track_accessed))
+                return client_printf(client, "error expected 0 or 1\n");
+        } else if (!strcmp(arg1, "softdirty")) {
+            if (parse_flag(arg2, &arguments.track_softdirty))
+                return client_printf(client, "error expected 0 or 1\n");
+        } else {
+            return client_printf(client, "error unknown setting: %s\n", arg1);
+        }
+        int res = configure_targets();
+        if (res != 0)
+            return res;
+        return client_printf(client, "ok\n");
+    } else if (!strcmp(cmd, "query") && arg1) {
+        struct daemon_target *dt = find_target(strtol(arg1, NULL, 0));
+        if (!dt)
+            return client_printf(client, "error not monitoring %s\n", arg1);
+        if (!smog_last_frame(dt->ctx))
+            return client_printf(client, "error no frame yet\n");
+
+        size_t len;
+        char *buf = format_frame(dt, &len);
+        if (!buf)
+            return 2;
+        int res = client_send(client, buf, len);
+        free(buf);
+        if (res != 0)
+            return res;
+        return client_printf(client, "ok\n");
+    } else if (!strcmp(cmd, "subscribe")) {
+        client->subscribed = arg1 ? strtol(arg1, NULL, 0) : SUBSCRIBE_ALL;
+        return client_printf(client, "ok\n");
+    } else if (!strcmp(cmd, "unsubscribe")) {
+        client->subscribed = SUBSCRIBE_NONE;
+        return client_printf(client, "ok\n");
+    }
+
+    return client_printf(client, "error unknown request: %s\n", cmd);
+}
+
+// consume all complete lines from a client's input buffer.
+static int handle_input(struct client *client) {
+    ssize_t n = read(client->fd, client->in + client->in_len,
+                     sizeof(client->in) - client->in_len);
+    if (n <= 0)
+        return 1;
+    client->in_len += n;
+
+    char *line = client->in;
+    char *eol;
+    while ((eol = memchr(line, '\n', client->in + client->in_len - line))) {
+        *eol = 0;
+        if (eol > line && eol[-1] == '\r')
+            eol[-1] = 0;
+
+        int res = handle_request(client, line);
+        if (res != 0)
+            return res;
+
+        line = eol + 1;
+    }
+
+    client->in_len -= line - client->in;
+    memmove(client->in, line, client->in_len);
+
+    if (client->in_len >= sizeof(client->in)) {
+        fprintf(stderr, "daemon: request too long, dropping client\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+// take a frame of every target and publish it to the subscribers.
+static void tick(void) {
+    size_t i = 0;
+    while (i < num_targets) {
+        struct daemon_target *dt = &targets[i];
+
+        int res = smog_scan(dt->ctx);
+        if (res != 0) {
+            fprintf(stderr, "daemon: lost %d, no longer monitoring\n", dt->pid);
+            for (size_t c = 0; c < num_clients; ++c) {
+                if (clients[c].subscribed == SUBSCRIBE_ALL || clients[c].subscribed == dt->pid)
+                    client_printf(&clients[c], "gone %d\n", dt->pid);
+            }
+            remove_target(dt);
+            continue;
+        }
+
+        size_t len;
+        char *buf = format_frame(dt, &len);
+        if (buf) {
+            for (size_t c = 0; c < num_clients; ++c) {
+                if (clients[c].subscribed != SUBSCRIBE_ALL && clients[c].subscribed != dt->pid)
+                    continue;
+                // a client that cannot take the frame is hung up on, and
+                // dropped by the poll loop
+                if (client_send(&clients[c], buf, len) != 0)
+                    shutdown(clients[c].fd, SHUT_RDWR);
+            }
+            free(buf);
+        }
+
+        i++;
+    }
+}
+
+int run_daemon(const char *socket_path) {
+    struct sockaddr_un addr = { 0 };
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", socket_path);
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    unlink(socket_path);
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "%s: ", socket_path);
+        perror("bind");
+        return 1;
+    }
+    if (listen(listen_fd, 8) != 0) {
+        fprintf(stderr, "%s: ", socket_path);
+        perror("listen");
+        return 1;
+    }
+
+    struct sigaction sa = { 0 };
+    sa.sa_handler = handle_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    printf("Listening on:             %s\n", socket_path);
+
+    struct timeval now;
+    struct timeval next;
+    gettimeofday(&now, NULL);
+    struct timeval delay = TIMEVAL_FROM_MILLIS(arguments.delay);
+    timeradd(&now, &delay, &next);
+
+    int ret = 0;
+    while (running) {
+        struct pollfd fds[MAX_CLIENTS + 1];
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        for (size_t c = 0; c < num_clients; ++c) {
+            fds[c + 1].fd = clients[c].fd;
+            fds[c + 1].events = POLLIN | (clients[c].out_len ? POLLOUT : 0);
+        }
+
+        gettimeofday(&now, NULL);
+        int timeout = 0;
+        if (timercmp(&now, &next, <)) {
+            struct timeval remaining;
+            timersub(&next, &now, &remaining);
+            timeout = remaining.tv_sec * 1000 + remaining.tv_usec / 1000 + 1;
+        }
+
+        int n = poll(fds, num_clients + 1, timeout);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            ret = 1;
+            break;
+        }
+
+        // service the clients in reverse, so dropping one does not disturb
+        // the pollfd indices of those not yet handled
+        for (size_t c = num_clients; c-- > 0;) {
+            int res = 0;
+            if (fds[c + 1].revents & (POLLERR | POLLHUP | POLLNVAL))
+                res = 1;
+            if (!res && (fds[c + 1].revents & POLLIN))
+                res = handle_input(&clients[c]);
+            if (!res && (fds[c + 1].revents & POLLOUT))
+                res = client_flush(&clients[c]);
+            if (res == 2) {
+                ret = 2;
+                running = 0;
+            }
+            if (res != 0)
+                drop_client(c);
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd < 0) {
+                perror("accept");
+            } else if (num_clients >= MAX_CLIENTS) {
+                fprintf(stderr, "daemon: too many clients\n");
+                close(fd);
+            } else {
+                memset(&clients[num_clients], 0, sizeof(clients[num_clients]));
+                clients[num_clients].fd = fd;
+                clients[num_clients].subscribed = SUBSCRIBE_NONE;
+                num_clients++;
+            }
+        }
+
+        gettimeofday(&now, NULL);
+        if (!timercmp(&now, &next, <)) {
+            tick();
+
+            // the interval may have been changed by a request
+            delay = (struct timeval)TIMEVAL_FROM_MILLIS(arguments.delay);
+            timeradd(&next, &delay, &next);
+            if (timercmp(&next, &now, <))
+                timeradd(&now, &delay, &next);
+        }
+    }
+
+    while (num_clients > 0)
+        drop_client(num_clients - 1);
+    while (num_targets > 0)
+        remove_target(&targets[num_targets - 1]);
+    free(targets);
+
+    close(listen_fd);
+    unlink(socket_path);
+
+    return ret;
+}
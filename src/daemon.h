@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#ifndef DAEMON_H_
+#define DAEMON_H_
+
+// run the scan loop as a long-lived daemon, accepting line-based requests on
+// a unix domain socket at the given path. requests are:
+//
+//   add PID [VMA_NAME]    start monitoring a process
+//   remove PID            stop monitoring a process
+//   list                  list the monitored processes
+//   set interval MS       change the monitor interval
+//   set accessed 0|1      switch accessed tracking on or off
+//   set softdirty 0|1     switch softdirty tracking on or off
+//   query PID             return the latest frame of a process
+//   subscribe [PID]       stream every frame (of a process) as it is taken
+//   unsubscribe           stop streaming frames
+//
+// every request is answered with "ok" or "error <reason>". frames are sent
+// as a "frame" line, followed by one "vma" line per VMA and an "end" line.
+int run_daemon(const char *socket_path);
+
+#endif  // DAEMON_H_
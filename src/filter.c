@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#include "./filter.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./util.h"
+
+static unsigned next_filter_id = 0;
+
+static int glob_compile(struct glob *g, const char *pattern) {
+    memset(g, 0, sizeof(*g));
+
+    size_t len = strlen(pattern);
+    g->pattern = strdup(pattern);
+    g->segments = malloc((len / 2 + 1) * sizeof(*g->segments));
+    if (!g->pattern || !g->segments) {
+        perror("malloc");
+        return 2;
+    }
+
+    g->anchored_start = len == 0 || pattern[0] != '*';
+    g->anchored_end = len == 0 || pattern[len - 1] != '*';
+
+    // runs of '*' separate the segments
+    const char *p = g->pattern;
+    while (*p) {
+        while (*p == '*')
+            p++;
+        const char *seg = p;
+        while (*p && *p != '*')
+            p++;
+        if (p > seg) {
+            g->segments[g->num_segments].chars = seg;
+            g->segments[g->num_segments].len = p - seg;
+            g->num_segments++;
+        }
+    }
+
+    return 0;
+}
+
+static int segment_at(const struct glob_segment *seg, const char *str) {
+    for (size_t k = 0; k < seg->len; ++k) {
+        if (seg->chars[k] != '?' && seg->chars[k] != str[k])
+            return 0;
+    }
+    return 1;
+}
+
+// anchored segments are matched at the ends of the string, the others as
+// far left as possible, which is sufficient as '*' can absorb any gap
+static int glob_match(const struct glob *g, const char *str, size_t n) {
+    size_t first = 0;
+    size_t last = g->num_segments;
+    size_t pos = 0;
+    size_t end = n;
+
+    if (g->anchored_start) {
+        if (!last)
+            return n == 0;
+        const struct glob_segment *seg = &g->segments[0];
+        if (seg->len > n || !segment_at(seg, str))
+            return 0;
+        pos = seg->len;
+        first = 1;
+    }
+
+    if (g->anchored_end) {
+        if (last == first)
+            return pos == end;
+        const struct glob_segment *seg = &g->segments[last - 1];
+        if (seg->len > end - pos || !segment_at(seg, str + end - seg->len))
+            return 0;
+        end -= seg->len;
+        last--;
+    }
+
+    for (size_t k = first; k < last; ++k) {
+        const struct glob_segment *seg = &g->segments[k];
+        while (pos + seg->len <= end && !segment_at(seg, str + pos))
+            pos++;
+        if (pos + seg->len > end)
+            return 0;
+        pos += seg->len;
+    }
+
+    return 1;
+}
+
+static void glob_destroy(struct glob *g) {
+    free(g->pattern);
+    free(g->segments);
+}
+
+static int add_glob(struct glob **globs, size_t *n, const char *pattern) {
+    struct glob *new_globs = realloc(*globs, (*n + 1) * sizeof(**globs));
+    if (!new_globs) {
+        perror("realloc");
+        return 2;
+    }
+    *globs = new_globs;
+
+    int res = glob_compile(&new_globs[*n], pattern);
+    (*n)++;
+    return res;
+}
+
+static int parse_term(struct vma_filter *filter, const char *term) {
+    if (!strcmp(term, "anon")) {
+        filter->kind = VMA_ANON;
+    } else if (!strcmp(term, "file")) {
+        filter->kind = VMA_FILE;
+    } else if (!strncmp(term, "perms=", 6)) {
+        const char *mask = term + 6;
+        if (strlen(mask) > 4)
+            return 1;
+        for (size_t k = 0; k < 4 && mask[k]; ++k)
+            filter->perms[k] = mask[k] == '?' ? 0 : mask[k];
+    } else if (!strncmp(term, "addr=", 5)) {
+        char *dash;
+        errno = 0;
+        size_t start = strtoull(term + 5, &dash, 16);
+        if (errno != 0 || *dash != '-')
+            return 1;
+        char *end_ptr;
+        size_t end = strtoull(dash + 1, &end_ptr, 16);
+        if (errno != 0 || *end_ptr || end <= start)
+            return 1;
+        filter->addr_start = start / g_system_pagesize;
+        filter->addr_end = (end + g_system_pagesize - 1) / g_system_pagesize;
+    } else if (!strncmp(term, "min=", 4)) {
+        size_t bytes;
+        if (parse_size(term + 4, &bytes) != 0)
+            return 1;
+        filter->min_pages = (bytes + g_system_pagesize - 1) / g_system_pagesize;
+    } else if (term[0] == '!') {
+        return add_glob(&filter->exclude, &filter->num_exclude, term + 1);
+    } else {
+        return add_glob(&filter->include, &filter->num_include, term);
+    }
+    return 0;
+}
+
+int filter_compile(struct vma_filter *filter, const char *spec) {
+    memset(filter, 0, sizeof(*filter));
+    filter->id = ++next_filter_id;
+    filter->addr_end = (size_t)-1;
+
+    char *terms = strdup(spec);
+    if (!terms) {
+        perror("strdup");
+        return 2;
+    }
+
+    int res = 0;
+    char *saveptr;
+    for (char *term = strtok_r(terms, ",", &saveptr); term && res == 0;
+            term = strtok_r(NULL, ",", &saveptr)) {
+        res = parse_term(filter, term);
+        if (res == 1)
+            fprintf(stderr, "invalid VMA filter term: %s\n", term);
+    }
+
+    free(terms);
+    if (res != 0)
+        filter_destroy(filter);
+    return res;
+}
+
+// shared anonymous memory shows up as a deleted /dev/zero
+static int is_file_backed(const char *pathname) {
+    return pathname[0] == '/' && strcmp(pathname, "/dev/zero (deleted)");
+}
+
+int filter_match(const struct vma_filter *filter, size_t start, size_t end,
+                 const char *perms, const char *pathname) {
+    if (end - start < filter->min_pages)
+        return 0;
+    if (end <= filter->addr_start || start >= filter->addr_end)
+        return 0;
+
+    for (size_t k = 0; k < 4; ++k) {
+        if (filter->perms[k] && filter->perms[k] != perms[k])
+            return 0;
+    }
+
+    if (filter->kind != VMA_ANY && is_file_backed(pathname) != (filter->kind == VMA_FILE))
+        return 0;
+
+    size_t n = strlen(pathname);
+    int included = !filter->num_include;
+    for (size_t k = 0; k < filter->num_include && !included; ++k)
+        included = glob_match(&filter->include[k], pathname, n);
+    if (!included)
+        return 0;
+
+    for (size_t k = 0; k < filter->num_exclude; ++k) {
+        if (glob_match(&filter->exclude[k], pathname, n))
+            return 0;
+    }
+
+    return 1;
+}
+
+void filter_destroy(struct vma_filter *filter) {
+    for (size_t k = 0; k < filter->num_include; ++k)
+        glob_destroy(&filter->include[k]);
+    for (size_t k = 0; k < filter->num_exclude; ++k)
+        glob_destroy(&filter->exclude[k]);
+    free(filter->include);
+    free(filter->exclude);
+    memset(filter, 0, sizeof(*filter));
+}
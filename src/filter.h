@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#ifndef FILTER_H_
+#define FILTER_H_
+
+#include <stddef.h>
+
+// a glob pattern, split at its '*' into segments matched from left to right
+struct glob_segment {
+    const char *chars;
+    size_t len;
+};
+
+struct glob {
+    char *pattern;
+    struct glob_segment *segments;
+    size_t num_segments;
+
+    // whether the pattern does not begin or end with a '*'
+    int anchored_start;
+    int anchored_end;
+};
+
+enum vma_kind {
+    VMA_ANY,
+    VMA_ANON,
+    VMA_FILE,
+};
+
+// a VMA filter, compiled from a comma-separated list of terms:
+//
+//   PATTERN          include VMAs whose pathname matches the glob
+//   !PATTERN         exclude VMAs whose pathname matches the glob
+//   perms=MASK       permissions as in /proc/<pid>/maps, '?' matches any
+//   anon, file       VMAs without or with a backing file
+//   addr=START-END   VMAs overlapping the hexadecimal address range
+//   min=SIZE         VMAs of at least SIZE bytes, with a K, M or G suffix
+//
+// a VMA is selected if it matches any include pattern, or there are none,
+// matches no exclude pattern, and satisfies all other terms.
+struct vma_filter {
+    // identifies the filter a decision was cached for
+    unsigned id;
+
+    struct glob *include;
+    size_t num_include;
+    struct glob *exclude;
+    size_t num_exclude;
+
+    char perms[4];
+    enum vma_kind kind;
+
+    // in pages
+    size_t addr_start;
+    size_t addr_end;
+    size_t min_pages;
+};
+
+int filter_compile(struct vma_filter *filter, const char *spec);
+
+int filter_match(const struct vma_filter *filter, size_t start, size_t end,
+                 const char *perms, const char *pathname);
+
+void filter_destroy(struct vma_filter *filter);
+
+#endif  // FILTER_H_
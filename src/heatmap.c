@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#include "./heatmap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "./smog-meter.h"
+#include "./target.h"
+
+#define HEATMAP_INDENT "    "
+#define HEATMAP_PREFIX_LEN 9  // indent, row label and frame
+
+// glyphs by increasing density, the first one meaning empty
+static const char RAMP[] = "_.:-=+*#@";
+#define RAMP_LEVELS (sizeof(RAMP) - 2)
+
+size_t heatmap_default_width(void) {
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > HEATMAP_PREFIX_LEN)
+        return ws.ws_col - HEATMAP_PREFIX_LEN;
+    return 80 - HEATMAP_PREFIX_LEN;
+}
+
+static char glyph(size_t count, size_t size) {
+    if (!count)
+        return RAMP[0];
+    return RAMP[1 + (count * (RAMP_LEVELS - 1)) / size];
+}
+
+static int write_row(char *line, size_t n) {
+    size_t written = 0;
+    while (written < n) {
+        ssize_t res = write(STDOUT_FILENO, line + written, n - written);
+        if (res < 0) {
+            perror("write");
+            return 1;
+        }
+        written += res;
+    }
+    return 0;
+}
+
+int render_heatmap(const uint64_t *pagemap, size_t len, size_t width) {
+    static char *line = NULL;
+    static size_t line_capacity = 0;
+    static size_t *counts = NULL;
+    static size_t counts_capacity = 0;
+
+    if (len == 0)
+        return 0;
+    if (width == 0)
+        width = 1;
+    if (width > len)
+        width = len;
+
+    // committed, accessed and softdirty counts per bucket
+    if (counts_capacity < width * 3) {
+        counts = realloc(counts, sizeof(*counts) * width * 3);
+        if (!counts) {
+            perror("realloc");
+            return 2;
+        }
+        counts_capacity = width * 3;
+    }
+    memset(counts, 0, sizeof(*counts) * width * 3);
+    size_t *committed = counts;
+    size_t *accessed = counts + width;
+    size_t *softdirty = counts + 2 * width;
+
+    for (size_t b = 0; pagemap && b < width; ++b) {
+        size_t first = b * len / width;
+        size_t last = (b + 1) * len / width;
+        for (size_t j = first; j < last; ++j) {
+            uint64_t pte = pagemap[j];
+            if (!(pte & PM_PRESENT))
+                continue;
+            committed[b]++;
+            accessed[b] += !!(pte & PM_ACCESSED);
+            softdirty[b] += !!(pte & PM_SOFT_DIRTY);
+        }
+    }
+
+    // indent, label, color escape, glyphs, reset escape, newline
+    size_t needed = width + 32;
+    if (line_capacity < needed) {
+        line = realloc(line, needed);
+        if (!line) {
+            perror("realloc");
+            return 2;
+        }
+        line_capacity = needed;
+    }
+
+    struct {
+        int enabled;
+        const char *label;
+        const char *color;
+        const size_t *counts;
+    } rows[] = {
+        { 1, "C", "", committed },
+        { arguments.track_accessed, "A", "\e[0;32m", accessed },
+        { arguments.track_softdirty, "D", "\e[0;31m", softdirty },
+    };
+
+    // anything printed so far must precede the raw writes
+    fflush(stdout);
+
+    for (size_t r = 0; r < sizeof(rows) / sizeof(*rows); ++r) {
+        if (!rows[r].enabled)
+            continue;
+
+        size_t n = sprintf(line, HEATMAP_INDENT "%s |%s", rows[r].label, rows[r].color);
+        for (size_t b = 0; b < width; ++b) {
+            size_t size = (b + 1) * len / width - b * len / width;
+            line[n++] = glyph(rows[r].counts[b], size);
+        }
+        n += sprintf(line + n, "%s|\n", *rows[r].color ? "\e[0m" : "");
+
+        int res = write_row(line, n);
+        if (res != 0)
+            return res;
+    }
+
+    return 0;
+}
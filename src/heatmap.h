@@ -0,0 +1,20 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#ifndef HEATMAP_H_
+#define HEATMAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// determine the heatmap width from the terminal, or fall back to 80 columns
+size_t heatmap_default_width(void);
+
+// render the pages of a VMA, downsampled into at most `width` buckets. every
+// tracked property (committed, and accessed and softdirty if enabled) is
+// drawn as a row of density glyphs, each row emitted with a single write.
+// a NULL pagemap is rendered as a VMA without present pages.
+int render_heatmap(const uint64_t *pagemap, size_t len, size_t width);
+
+#endif  // HEATMAP_H_
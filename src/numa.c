@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#include "./numa.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "./target.h"
+#include "./util.h"
+
+#define SYSFS_NODES "/sys/devices/system/node"
+#define SYSFS_BLOCK_SIZE "/sys/devices/system/memory/block_size_bytes"
+
+// pages handed to a single move_pages call
+#define MOVE_PAGES_BATCH 4096
+
+size_t g_numa_nodes = 0;
+
+// node of every memory block, indexed by block number, -1 if unknown
+static int *block_node = NULL;
+static size_t num_blocks = 0;
+static size_t pages_per_block = 0;
+
+static int add_block(size_t block, int node) {
+    if (block >= num_blocks) {
+        size_t new_num = num_blocks ? num_blocks : 64;
+        while (new_num <= block)
+            new_num *= 2;
+
+        block_node = realloc(block_node, sizeof(*block_node) * new_num);
+        if (!block_node) {
+            perror("realloc");
+            return 2;
+        }
+        for (size_t i = num_blocks; i < new_num; ++i)
+            block_node[i] = -1;
+        num_blocks = new_num;
+    }
+
+    block_node[block] = node;
+    return 0;
+}
+
+int numa_init(void) {
+    DIR *nodes = opendir(SYSFS_NODES);
+    if (!nodes) {
+        // not a NUMA system, everything lives on node 0
+        g_numa_nodes = 1;
+        return 0;
+    }
+
+    FILE *f = fopen(SYSFS_BLOCK_SIZE, "r");
+    if (f) {
+        size_t block_size;
+        if (fscanf(f, "%zx", &block_size) == 1)
+            pages_per_block = block_size / g_system_pagesize;
+        fclose(f);
+    }
+
+    struct dirent *node_entry;
+    while ((node_entry = readdir(nodes))) {
+        int node;
+        if (sscanf(node_entry->d_name, "node%d", &node) != 1)
+            continue;
+
+        if ((size_t)node + 1 > g_numa_nodes)
+            g_numa_nodes = node + 1;
+
+        if (!pages_per_block)
+            continue;
+
+        char path[512];
+        snprintf(path, sizeof(path), SYSFS_NODES "/%s", node_entry->d_name);
+        DIR *blocks = opendir(path);
+        if (!blocks)
+            continue;
+
+        struct dirent *block_entry;
+        while ((block_entry = readdir(blocks))) {
+            size_t block;
+            if (sscanf(block_entry->d_name, "memory%zu", &block) != 1)
+                continue;
+
+            int res = add_block(block, node);
+            if (res != 0) {
+                closedir(blocks);
+                closedir(nodes);
+                return res;
+            }
+        }
+        closedir(blocks);
+    }
+    closedir(nodes);
+
+    if (!g_numa_nodes)
+        g_numa_nodes = 1;
+
+    return 0;
+}
+
+// resolve nodes through the kernel, for pages without a known pfn
+static int resolve_move_pages(pid_t pid, const uint64_t *pagemap, size_t start,
+                              size_t len, int *nodes) {
+    void *pages[MOVE_PAGES_BATCH];
+    int status[MOVE_PAGES_BATCH];
+    size_t index[MOVE_PAGES_BATCH];
+
+    size_t j = 0;
+    while (j < len) {
+        size_t count = 0;
+        for (; j < len && count < MOVE_PAGES_BATCH; ++j) {
+            if (nodes[j] >= 0 || !(pagemap[j] & PM_PRESENT))
+                continue;
+            pages[count] = (void*)((start + j) * g_system_pagesize);
+            index[count] = j;
+            count++;
+        }
+        if (!count)
+            break;
+
+        // with a NULL nodes argument, move_pages only reports the node
+        long res = syscall(SYS_move_pages, pid, count, pages, NULL, status, 0);
+        if (res < 0) {
+            perror("move_pages");
+            return 1;
+        }
+
+        for (size_t k = 0; k < count; ++k) {
+            if (status[k] >= 0 && (size_t)status[k] < g_numa_nodes)
+                nodes[index[k]] = status[k];
+        }
+    }
+
+    return 0;
+}
+
+int numa_resolve(pid_t pid, const uint64_t *pagemap, size_t start, size_t len, int *nodes) {
+    int unresolved = 0;
+
+    for (size_t j = 0; j < len; ++j) {
+        nodes[j] = -1;
+        if (!(pagemap[j] & PM_PRESENT))
+            continue;
+
+        if (g_numa_nodes == 1) {
+            nodes[j] = 0;
+            continue;
+        }
+
+        // the pfn reads as zero without CAP_SYS_ADMIN
+        size_t pfn = pagemap[j] & PM_PFN_MASK;
+        size_t block = pages_per_block ? pfn / pages_per_block : num_blocks;
+        if (pfn && block < num_blocks && block_node[block] >= 0) {
+            nodes[j] = block_node[block];
+        } else {
+            unresolved = 1;
+        }
+    }
+
+    if (unresolved)
+        return resolve_move_pages(pid, pagemap, start, len, nodes);
+
+    return 0;
+}
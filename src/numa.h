@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#ifndef NUMA_H_
+#define NUMA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "./smogmeter.h"
+
+// the number of NUMA nodes, i.e. the highest node id plus one
+extern size_t g_numa_nodes;
+
+// discover the NUMA topology and the physical memory blocks of every node
+int numa_init(void);
+
+// resolve the nodes of the present pages in pagemap, which covers `len`
+// pages of the process starting at virtual page `start`. nodes[j] is set to
+// the node of page j, or -1 if it is not present or cannot be resolved.
+int numa_resolve(pid_t pid, const uint64_t *pagemap, size_t start, size_t len, int *nodes);
+
+#endif  // NUMA_H_
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#include "./pagecache.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "./target.h"
+#include "./util.h"
+
+#ifndef __NR_cachestat
+#define __NR_cachestat 451
+#endif
+
+// pages queried by a single cachestat call before dirty ranges are refined
+#define CACHESTAT_CHUNK 512
+
+struct cache_range {
+    uint64_t off;
+    uint64_t len;
+};
+
+struct cache_stat {
+    uint64_t nr_cache;
+    uint64_t nr_dirty;
+    uint64_t nr_writeback;
+    uint64_t nr_evicted;
+    uint64_t nr_recently_evicted;
+};
+
+static int cachestat(int fd, size_t first, size_t count, struct cache_stat *cs) {
+    struct cache_range range = {
+        first * g_system_pagesize,
+        count * g_system_pagesize,
+    };
+    return syscall(__NR_cachestat, fd, &range, cs, 0);
+}
+
+int page_cache_init(struct page_cache *pc, const char *path, int fd,
+                    void *mapping, size_t size) {
+    memset(pc, 0, sizeof(*pc));
+    pc->fd = fd;
+    pc->mapping = mapping;
+    pc->pages = (size + g_system_pagesize - 1) / g_system_pagesize;
+
+    char *name = makestr("[pagecache:%s]", path);
+    if (!name) {
+        perror("makestr");
+        return 2;
+    }
+    int res = append_vma(&pc->vmas, 0, pc->pages, name);
+    free(name);
+    if (res != 0)
+        return res;
+
+    pc->pagemap = calloc(pc->pages, sizeof(*pc->pagemap));
+    pc->residency = calloc(pc->pages, sizeof(*pc->residency));
+    pc->prev_dirty = calloc((pc->pages + 63) / 64, sizeof(*pc->prev_dirty));
+    if (!pc->pagemap || !pc->residency || !pc->prev_dirty) {
+        perror("calloc");
+        return 2;
+    }
+
+    struct cache_stat cs;
+    pc->has_cachestat = cachestat(fd, 0, 1, &cs) == 0;
+    if (!pc->has_cachestat) {
+        fprintf(stderr, "warning: cachestat: %s, dirty page cache pages are not tracked\n",
+                strerror(errno));
+    }
+
+    return 0;
+}
+
+// mark the dirty pages of a range, splitting it until the dirty pages are
+// isolated. clean parts of the file cost one call per chunk.
+static int mark_dirty(struct page_cache *pc, size_t first, size_t count,
+                      const struct cache_stat *cs) {
+    if (!cs->nr_dirty)
+        return 0;
+
+    if (count == 1 || cs->nr_dirty >= count) {
+        for (size_t j = first; j < first + count; ++j)
+            pc->pagemap[j] |= PM_SOFT_DIRTY;
+        return 0;
+    }
+
+    size_t half = count / 2;
+    struct cache_stat lower;
+    struct cache_stat upper;
+    if (cachestat(pc->fd, first, half, &lower) != 0
+            || cachestat(pc->fd, first + half, count - half, &upper) != 0) {
+        perror("cachestat");
+        return 1;
+    }
+
+    int res = mark_dirty(pc, first, half, &lower);
+    if (res != 0)
+        return res;
+    return mark_dirty(pc, first + half, count - half, &upper);
+}
+
+int page_cache_scan(struct page_cache *pc) {
+    // residency of the whole file in a single call
+    int res = mincore(pc->mapping, pc->pages * g_system_pagesize, pc->residency);
+    if (res != 0) {
+        perror("mincore");
+        return 1;
+    }
+
+    size_t committed = 0;
+    for (size_t j = 0; j < pc->pages; ++j) {
+        pc->pagemap[j] = (pc->residency[j] & 1) ? PM_PRESENT : 0;
+        committed += pc->residency[j] & 1;
+    }
+
+    pc->dirty = 0;
+    pc->writeback = 0;
+    pc->evicted = 0;
+    if (pc->has_cachestat) {
+        for (size_t first = 0; first < pc->pages; first += CACHESTAT_CHUNK) {
+            size_t count = pc->pages - first;
+            if (count > CACHESTAT_CHUNK)
+                count = CACHESTAT_CHUNK;
+
+            struct cache_stat cs;
+            if (cachestat(pc->fd, first, count, &cs) != 0) {
+                perror("cachestat");
+                return 1;
+            }
+            pc->dirty += cs.nr_dirty;
+            pc->writeback += cs.nr_writeback;
+            pc->evicted += cs.nr_recently_evicted;
+
+            res = mark_dirty(pc, first, count, &cs);
+            if (res != 0)
+                return res;
+        }
+    }
+
+    // dirty pages are a level rather than an event, so the rate is derived
+    // from pages that were clean in the previous frame
+    pc->newly_dirty = 0;
+    for (size_t j = 0; j < pc->pages; ++j) {
+        uint64_t mask = 1ULL << (j % 64);
+        if (pc->pagemap[j] & PM_SOFT_DIRTY) {
+            pc->newly_dirty += !(pc->prev_dirty[j / 64] & mask);
+            pc->prev_dirty[j / 64] |= mask;
+        } else {
+            pc->prev_dirty[j / 64] &= ~mask;
+        }
+    }
+
+    pc->vmas.committed[0] = committed;
+    pc->vmas.accessed[0] = 0;
+    pc->vmas.softdirty[0] = pc->dirty;
+
+    return 0;
+}
+
+void page_cache_destroy(struct page_cache *pc) {
+    destroy_vmas(&pc->vmas);
+    free(pc->pagemap);
+    free(pc->residency);
+    free(pc->prev_dirty);
+    memset(pc, 0, sizeof(*pc));
+}
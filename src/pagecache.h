@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#ifndef PAGECACHE_H_
+#define PAGECACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "./vmas.h"
+
+struct page_cache {
+    int fd;
+    void *mapping;
+    size_t pages;
+
+    // whether cachestat(2) is available, otherwise only residency is known
+    int has_cachestat;
+
+    // the file as a single VMA spanning its pages, by file offset
+    struct vma_table vmas;
+
+    // per-page state in pagemap format, PM_PRESENT for pages in the page
+    // cache and PM_SOFT_DIRTY for dirty ones
+    uint64_t *pagemap;
+    unsigned char *residency;
+    uint64_t *prev_dirty;
+
+    size_t dirty;
+    size_t newly_dirty;
+    size_t writeback;
+    size_t evicted;
+};
+
+// track the page cache of the file behind fd, which is mapped at mapping
+int page_cache_init(struct page_cache *pc, const char *path, int fd,
+                    void *mapping, size_t size);
+
+int page_cache_scan(struct page_cache *pc);
+
+void page_cache_destroy(struct page_cache *pc);
+
+#endif  // PAGECACHE_H_
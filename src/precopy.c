@@ -0,0 +1,417 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+// pre-copy live migration simulator for smog-meter tracefiles.
+//
+// the first round transfers all pages present at the start of the migration.
+// every further round transfers the pages dirtied during the previous one,
+// until the remaining dirty pages can be sent within the downtime target in
+// a final stop-and-copy round. a migration has
+//
+//   converged  if the final round met the downtime target,
+//   diverged   if it was forced by the round limit, or by a round dirtying
+//              as many pages as it sent,
+//   exhausted  if the trace ended before the migration did.
+//
+// dirty pages are known per frame only, so a round that covers a frame
+// partially is charged the share of the frame's pages it overlaps.
+
+#include <argp.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./trace.h"
+#include "./util.h"
+
+struct arguments {
+    char *tracefile;
+
+    double *bandwidths;
+    size_t num_bandwidths;
+
+    uint64_t max_downtime;
+    uint64_t max_rounds;
+    uint64_t start_frame;
+    int keep_going;
+};
+
+static struct arguments arguments = { NULL, NULL, 0, 300, 30, 0, 0 };
+
+static const char doc[] = "Simulate pre-copy live migration of a traced process";
+static const char args_doc[] = "TRACEFILE";
+
+static struct argp_option options[] = {
+    { "bandwidth", 'b', "RATE[,RATE...]", 0,
+      "link bandwidth in bytes per second, with an optional K, M or G suffix. "
+      "may be given multiple times to sweep bandwidths.", 0 },
+    { "max-downtime", 'd', "MS", 0,
+      "the downtime target for the final stop-and-copy round", 0 },
+    { "max-rounds", 'r', "ROUNDS", 0,
+      "the maximum number of pre-copy rounds before stopping the process", 0 },
+    { "start-frame", 's', "FRAME", 0,
+      "the frame of the trace at which the migration starts", 0 },
+    { "keep-going", 'g', 0, 0,
+      "keep copying when a round dirties as many pages as it sent", 0 },
+    { 0 }
+};
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+    struct arguments *arguments = (struct arguments*)state->input;
+
+    switch (key) {
+        case 'b': {
+            char *saveptr = NULL;
+            for (char *rate = strtok_r(arg, ",", &saveptr); rate;
+                 rate = strtok_r(NULL, ",", &saveptr)) {
+                double *bandwidths = realloc(arguments->bandwidths,
+                                             (arguments->num_bandwidths + 1) * sizeof(double));
+                if (!bandwidths)
+                    argp_failure(state, 1, errno, "unable to allocate memory");
+                arguments->bandwidths = bandwidths;
+
+                size_t bandwidth;
+                if (parse_size(rate, &bandwidth) || !bandwidth)
+                    argp_failure(state, 1, 0, "invalid bandwidth: %s", rate);
+                arguments->bandwidths[arguments->num_bandwidths++] = bandwidth;
+            }
+            break;
+        }
+        case 'd':
+            errno = 0;
+            arguments->max_downtime = strtoll(arg, NULL, 0);
+            if (errno != 0)
+                argp_failure(state, 1, errno, "invalid downtime: %s", arg);
+            break;
+        case 'r':
+            errno = 0;
+            arguments->max_rounds = strtoll(arg, NULL, 0);
+            if (errno != 0 || !arguments->max_rounds)
+                argp_failure(state, 1, errno, "invalid number of rounds: %s", arg);
+            break;
+        case 's':
+            errno = 0;
+            arguments->start_frame = strtoll(arg, NULL, 0);
+            if (errno != 0)
+                argp_failure(state, 1, errno, "invalid frame: %s", arg);
+            break;
+        case 'g':
+            arguments->keep_going = 1;
+            break;
+
+        case ARGP_KEY_ARG:
+            if (state->arg_num >= 1)
+                argp_usage(state);
+            arguments->tracefile = arg;
+            break;
+
+        case ARGP_KEY_END:
+            if (state->arg_num < 1)
+                argp_usage(state);
+            if (!arguments->num_bandwidths)
+                argp_failure(state, 1, 0, "at least one bandwidth is required.");
+            break;
+
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+static struct argp argp = { options, parse_opt, args_doc, doc, NULL, NULL, NULL };
+
+// the dirty pages of a trace, preprocessed so the number of distinct pages
+// dirtied within any range of frames can be counted without a page walk.
+// every dirty page of a frame is stored with the frame it was dirty in
+// before, plus one, or zero if it was not. a page dirty in frames [a, b) is
+// counted once, in the first of these frames, where its previous frame is
+// below a.
+struct dirty_log {
+    size_t num_frames;
+    double *timestamps;  // seconds
+    size_t *present;     // pages present in every frame
+
+    // the largest time between the first and the last VMA read of a frame,
+    // in seconds, if the trace has per-VMA times
+    double max_skew;
+
+    // offsets into prev, per frame, with one past the end
+    size_t *offsets;
+    uint32_t *prev;
+    size_t len;
+    size_t capacity;
+};
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static int log_append(struct dirty_log *log, uint32_t prev) {
+    if (log->len == log->capacity) {
+        size_t capacity = log->capacity ? log->capacity * 2 : 1 << 16;
+        uint32_t *new_prev = realloc(log->prev, capacity * sizeof(*new_prev));
+        if (!new_prev) {
+            perror("realloc");
+            return 2;
+        }
+        log->prev = new_prev;
+        log->capacity = capacity;
+    }
+    log->prev[log->len++] = prev;
+    return 0;
+}
+
+static int load_trace(const char *path, struct dirty_log *log) {
+    struct trace_reader r;
+    int res = trace_open(&r, path);
+    if (res != 0)
+        return res;
+
+    // the last frame every page was dirty in, plus one
+    struct page_index idx = { 0 };
+    uint32_t *last = NULL;
+    size_t last_capacity = 0;
+
+    size_t frames_capacity = 0;
+    struct timeval timestamp;
+    uint32_t num_vmas;
+    while ((res = trace_next_frame(&r, &timestamp, &num_vmas)) == 0) {
+        size_t k = log->num_frames;
+        if (k + 2 > frames_capacity) {
+            frames_capacity = frames_capacity ? frames_capacity * 2 : 1024;
+            double *timestamps = realloc(log->timestamps, frames_capacity * sizeof(double));
+            size_t *present = realloc(log->present, frames_capacity * sizeof(size_t));
+            size_t *offsets = realloc(log->offsets, frames_capacity * sizeof(size_t));
+            if (timestamps)
+                log->timestamps = timestamps;
+            if (present)
+                log->present = present;
+            if (offsets)
+                log->offsets = offsets;
+            if (!timestamps || !present || !offsets) {
+                perror("realloc");
+                res = 2;
+                break;
+            }
+        }
+        log->timestamps[k] = timestamp.tv_sec + timestamp.tv_usec / 1e6;
+        log->present[k] = 0;
+        log->offsets[k] = log->len;
+
+        // a frame is complete once its last VMA was read
+        uint32_t first_read = UINT32_MAX;
+        uint32_t last_read = 0;
+
+        struct trace_vma vma;
+        while ((res = trace_next_vma(&r, &vma)) == 0) {
+            if (!trace_is_process_vma(&vma))
+                continue;
+
+            if (vma.has_times) {
+                if (vma.scan_start_us < first_read)
+                    first_read = vma.scan_start_us;
+                if (vma.scan_end_us > last_read)
+                    last_read = vma.scan_end_us;
+            }
+
+            size_t len = vma.end - vma.start;
+            size_t words = (len + TRACE_PAGES_PER_WORD - 1) / TRACE_PAGES_PER_WORD;
+            for (size_t w = 0; w < words && res == 0; ++w) {
+                uint32_t word = vma.pages[w];
+                log->present[k] += __builtin_popcount((word | word >> 1) & TRACE_LOW_BITS);
+
+                // softdirty pages have both bits set
+                uint32_t dirty = word & word >> 1 & TRACE_LOW_BITS;
+                while (dirty) {
+                    size_t bit = __builtin_ctz(dirty);
+                    dirty &= dirty - 1;
+
+                    int64_t id = page_index_get(&idx, vma.start + w * TRACE_PAGES_PER_WORD + bit / 2);
+                    if (id < 0) {
+                        res = 2;
+                        break;
+                    }
+                    if ((size_t)id >= last_capacity) {
+                        size_t capacity = last_capacity ? last_capacity * 2 : 1 << 16;
+                        uint32_t *new_last = realloc(last, capacity * sizeof(*last));
+                        if (!new_last) {
+                            perror("realloc");
+                            res = 2;
+                            break;
+                        }
+                        memset(new_last + last_capacity, 0,
+                               (capacity - last_capacity) * sizeof(*last));
+                        last = new_last;
+                        last_capacity = capacity;
+                    }
+
+                    res = log_append(log, last[id]);
+                    last[id] = k + 1;
+                }
+            }
+            if (res != 0)
+                break;
+        }
+        if (res != TRACE_END)
+            break;
+
+        if (last_read) {
+            log->timestamps[k] += last_read / 1e6;
+            if (first_read < last_read && (last_read - first_read) / 1e6 > log->max_skew)
+                log->max_skew = (last_read - first_read) / 1e6;
+        }
+
+        if (log->len > log->offsets[k]) {
+            qsort(log->prev + log->offsets[k], log->len - log->offsets[k],
+                  sizeof(*log->prev), cmp_u32);
+        }
+        log->num_frames++;
+    }
+
+    if (log->offsets)
+        log->offsets[log->num_frames] = log->len;
+
+    free(last);
+    page_index_destroy(&idx);
+    trace_close(&r);
+    return res == TRACE_END ? 0 : res;
+}
+
+// the dirty pages of a frame whose previous dirty frame lies below a
+static size_t count_new(const struct dirty_log *log, size_t k, size_t a) {
+    // the first entry above a, that is, with a previous frame of a or later
+    size_t lo = log->offsets[k];
+    size_t hi = log->offsets[k + 1];
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (log->prev[mid] <= a)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo - log->offsets[k];
+}
+
+// the distinct pages dirtied between two points in time. frame k covers the
+// time since frame k - 1, and frames that overlap partially are weighted by
+// the overlap. returns -1 if the trace ends before the given time.
+static double dirtied_between(const struct dirty_log *log, double from, double to) {
+    if (to > log->timestamps[log->num_frames - 1])
+        return -1;
+
+    // the first frame ending after from
+    size_t lo = 1;
+    size_t hi = log->num_frames;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (log->timestamps[mid] <= from)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    size_t a = lo;
+    double dirtied = 0;
+    for (size_t k = a; k < log->num_frames && log->timestamps[k - 1] < to; ++k) {
+        double begin = log->timestamps[k - 1];
+        double end = log->timestamps[k];
+        double overlap = (end < to ? end : to) - (begin > from ? begin : from);
+        double weight = end > begin ? overlap / (end - begin) : 1;
+        dirtied += weight * count_new(log, k, a);
+    }
+
+    return dirtied;
+}
+
+struct migration {
+    size_t rounds;
+    double transferred;  // bytes
+    double duration;     // seconds, including the downtime
+    double downtime;     // seconds
+    const char *result;
+};
+
+static void simulate(const struct dirty_log *log, double bandwidth, struct migration *m) {
+    double max_downtime = arguments.max_downtime / 1000.0;
+    double now = log->timestamps[arguments.start_frame];
+    double to_send = log->present[arguments.start_frame];
+
+    memset(m, 0, sizeof(*m));
+    while (1) {
+        m->rounds++;
+
+        double seconds = to_send * g_system_pagesize / bandwidth;
+        m->transferred += to_send * g_system_pagesize;
+
+        double dirtied = dirtied_between(log, now, now + seconds);
+        now += seconds;
+        m->duration += seconds;
+        if (dirtied < 0) {
+            m->result = "exhausted";
+            return;
+        }
+
+        m->downtime = dirtied * g_system_pagesize / bandwidth;
+        if (m->downtime <= max_downtime) {
+            m->result = "converged";
+        } else if (m->rounds >= arguments.max_rounds
+                   || (!arguments.keep_going && dirtied >= to_send)) {
+            m->result = "diverged";
+        } else {
+            to_send = dirtied;
+            continue;
+        }
+
+        // the final stop-and-copy round
+        m->transferred += dirtied * g_system_pagesize;
+        m->duration += m->downtime;
+        return;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    detect_system();
+
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    struct dirty_log log = { 0 };
+    int res = load_trace(arguments.tracefile, &log);
+    if (res != 0)
+        return res;
+
+    if (arguments.start_frame + 1 >= log.num_frames) {
+        fprintf(stderr, "%s: %zu frames, too few to start at frame %lu\n",
+                arguments.tracefile, log.num_frames, arguments.start_frame);
+        return 1;
+    }
+
+    printf("# %zu frames over %.1f s, %zu pages present at frame %lu, %zu dirty page samples\n",
+           log.num_frames, log.timestamps[log.num_frames - 1] - log.timestamps[0],
+           log.present[arguments.start_frame], arguments.start_frame, log.len);
+    if (log.max_skew > 0) {
+        printf("# VMAs of a frame read up to %.1f ms apart\n", log.max_skew * 1000);
+    }
+    printf("# %-14s %6s %16s %12s %12s  %s\n",
+           "bandwidth B/s", "rounds", "transferred B", "duration ms", "downtime ms", "result");
+
+    for (size_t i = 0; i < arguments.num_bandwidths; ++i) {
+        struct migration m;
+        simulate(&log, arguments.bandwidths[i], &m);
+        printf("%16.0f %6zu %16.0f %12.1f %12.1f  %s\n",
+               arguments.bandwidths[i], m.rounds, m.transferred,
+               m.duration * 1000, m.downtime * 1000, m.result);
+    }
+
+    free(log.timestamps);
+    free(log.present);
+    free(log.offsets);
+    free(log.prev);
+    free(arguments.bandwidths);
+
+    return 0;
+}
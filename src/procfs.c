@@ -0,0 +1,405 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#include "./procfs.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "./util.h"
+
+enum procfs_op {
+    OP_OPEN,
+    OP_PREAD,
+    OP_PWRITE,
+    OP_READ_FILE,
+    OP_WRITE_FILE,
+    OP_CLOCK,
+};
+
+static const char *op_names[] = {
+    "open", "pread", "pwrite", "read", "write", "clock",
+};
+
+static const char *file_names[] = {
+    "maps", "smaps", "pagemap", "clear_refs", "page_idle", "stat", "schedstat",
+};
+
+static const size_t RECORDING_BUFFER = 1 << 20;
+
+int procfs_init(struct procfs *p, pid_t pid, enum procfs_mode mode, const char *recording) {
+    memset(p, 0, sizeof(*p));
+    p->mode = mode;
+    for (size_t i = 0; i < PROCFS_NUM_FILES; ++i)
+        p->fds[i] = -1;
+
+    if (mode != PROCFS_LIVE) {
+        p->recording = strdup(recording);
+        if (!p->recording) {
+            perror("strdup");
+            return 2;
+        }
+
+        p->f = fopen(recording, mode == PROCFS_RECORD ? "w" : "r");
+        if (!p->f) {
+            fprintf(stderr, "%s: ", recording);
+            perror("fopen");
+            return 1;
+        }
+        setvbuf(p->f, NULL, _IOFBF, RECORDING_BUFFER);
+    }
+
+    struct procfs_header header;
+    if (mode == PROCFS_REPLAY) {
+        if (fread(&header, sizeof(header), 1, p->f) != 1
+                || memcmp(header.magic, PROCFS_MAGIC, sizeof(header.magic))) {
+            fprintf(stderr, "%s: not a recording\n", recording);
+            return 1;
+        }
+        if (header.pagesize != g_system_pagesize) {
+            fprintf(stderr, "%s: recorded with a page size of %u bytes\n",
+                    recording, header.pagesize);
+            return 1;
+        }
+        pid = header.pid;
+    } else if (mode == PROCFS_RECORD) {
+        memcpy(header.magic, PROCFS_MAGIC, sizeof(header.magic));
+        header.pid = pid;
+        header.pagesize = g_system_pagesize;
+        if (fwrite(&header, sizeof(header), 1, p->f) != 1) {
+            fprintf(stderr, "%s: ", recording);
+            perror("fwrite");
+            return 1;
+        }
+    }
+    p->pid = pid;
+
+    p->paths[PROCFS_MAPS] = makestr("/proc/%d/maps", pid);
+    p->paths[PROCFS_SMAPS] = makestr("/proc/%d/smaps", pid);
+    p->paths[PROCFS_PAGEMAP] = makestr("/proc/%d/pagemap", pid);
+    p->paths[PROCFS_CLEAR_REFS] = makestr("/proc/%d/clear_refs", pid);
+    p->paths[PROCFS_PAGE_IDLE] = makestr("/sys/kernel/mm/page_idle/bitmap");
+    p->paths[PROCFS_STAT] = makestr("/proc/%d/stat", pid);
+    p->paths[PROCFS_SCHEDSTAT] = makestr("/proc/%d/schedstat", pid);
+    for (size_t i = 0; i < PROCFS_NUM_FILES; ++i) {
+        if (!p->paths[i]) {
+            perror("makestr");
+            return 2;
+        }
+    }
+
+    return 0;
+}
+
+// append an operation to the recording, along with the data read by it
+static int record(struct procfs *p, enum procfs_op op, uint32_t file,
+                  uint64_t offset, uint64_t length, int64_t result, const void *data) {
+    if (p->mode != PROCFS_RECORD)
+        return 0;
+
+    struct procfs_record r = { op, file, offset, length, result };
+    int ok = fwrite(&r, sizeof(r), 1, p->f) == 1;
+    if (ok && data && result > 0)
+        ok = fwrite(data, result, 1, p->f) == 1;
+
+    // the clock starts every frame, so a recording cut short by a signal
+    // still has all frames before the last one
+    if (ok && op == OP_CLOCK && file == PROCFS_CLOCK_FRAME)
+        ok = fflush(p->f) == 0;
+
+    if (!ok) {
+        fprintf(stderr, "%s: ", p->recording);
+        perror("fwrite");
+        return -1;
+    }
+
+    p->num_records++;
+    return 0;
+}
+
+// fetch the next operation of a replay, which has to be the requested one
+static int replay(struct procfs *p, enum procfs_op op, enum procfs_file file,
+                  uint64_t offset, uint64_t length, int64_t *result) {
+    struct procfs_record r;
+    if (fread(&r, sizeof(r), 1, p->f) != 1) {
+        p->end = 1;
+        errno = ENODATA;
+        return -1;
+    }
+
+    if (r.op != op || r.file != file || r.offset != offset || r.length != length) {
+        fprintf(stderr, "%s: replay diverged at record %zu, expected %s of %s, found %s of %s\n",
+                p->recording, p->num_records,
+                op_names[op], file_names[file],
+                r.op <= OP_CLOCK ? op_names[r.op] : "?",
+                r.file < PROCFS_NUM_FILES ? file_names[r.file] : "?");
+        errno = EIO;
+        return -1;
+    }
+
+    p->num_records++;
+    *result = r.result;
+    return 0;
+}
+
+// read the data of a replayed operation
+static int replay_data(struct procfs *p, void *buf, int64_t result) {
+    if (result > 0 && fread(buf, result, 1, p->f) != 1) {
+        p->end = 1;
+        errno = ENODATA;
+        return -1;
+    }
+    return 0;
+}
+
+static int64_t result_of(ssize_t res) {
+    return res < 0 ? -errno : res;
+}
+
+static int failed(int64_t result) {
+    if (result >= 0)
+        return 0;
+    errno = -result;
+    return 1;
+}
+
+int procfs_open(struct procfs *p, enum procfs_file file, int flags) {
+    int64_t result;
+
+    if (p->mode == PROCFS_REPLAY) {
+        if (replay(p, OP_OPEN, file, 0, flags, &result) != 0)
+            return -1;
+        return failed(result) ? -1 : 0;
+    }
+
+    p->fds[file] = open(p->paths[file], flags);
+    result = result_of(p->fds[file] < 0 ? -1 : 0);
+    if (record(p, OP_OPEN, file, 0, flags, result, NULL) != 0)
+        return -1;
+    return failed(result) ? -1 : 0;
+}
+
+ssize_t procfs_pread(struct procfs *p, enum procfs_file file, void *buf, size_t len, off_t off) {
+    int64_t result;
+
+    if (p->mode == PROCFS_REPLAY) {
+        if (replay(p, OP_PREAD, file, off, len, &result) != 0)
+            return -1;
+        if (failed(result))
+            return -1;
+        if (replay_data(p, buf, result) != 0)
+            return -1;
+        return result;
+    }
+
+    result = result_of(pread(p->fds[file], buf, len, off));
+    if (record(p, OP_PREAD, file, off, len, result, buf) != 0)
+        return -1;
+    return failed(result) ? -1 : result;
+}
+
+ssize_t procfs_pwrite(struct procfs *p, enum procfs_file file, const void *buf, size_t len,
+                      off_t off) {
+    int64_t result;
+
+    if (p->mode == PROCFS_REPLAY) {
+        if (replay(p, OP_PWRITE, file, off, len, &result) != 0)
+            return -1;
+        return failed(result) ? -1 : result;
+    }
+
+    result = result_of(pwrite(p->fds[file], buf, len, off));
+    if (record(p, OP_PWRITE, file, off, len, result, NULL) != 0)
+        return -1;
+    return failed(result) ? -1 : result;
+}
+
+// read a file of unknown size, as procfs reports none
+static ssize_t slurp(const char *path, char **buf) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    size_t len = 0;
+    size_t capacity = 64 * 1024;
+    *buf = malloc(capacity);
+    while (*buf) {
+        if (len == capacity) {
+            capacity *= 2;
+            char *new_buf = realloc(*buf, capacity);
+            if (!new_buf)
+                break;
+            *buf = new_buf;
+        }
+
+        ssize_t n = read(fd, *buf + len, capacity - len);
+        if (n < 0) {
+            int err = errno;
+            close(fd);
+            free(*buf);
+            *buf = NULL;
+            errno = err;
+            return -1;
+        }
+        if (n == 0) {
+            close(fd);
+            return len;
+        }
+        len += n;
+    }
+
+    close(fd);
+    free(*buf);
+    *buf = NULL;
+    errno = ENOMEM;
+    return -1;
+}
+
+int procfs_read_file(struct procfs *p, enum procfs_file file, char **buf, size_t *len) {
+    int64_t result;
+    *buf = NULL;
+
+    if (p->mode == PROCFS_REPLAY) {
+        if (replay(p, OP_READ_FILE, file, 0, 0, &result) != 0)
+            return -1;
+        if (failed(result))
+            return -1;
+
+        // one spare byte, as empty buffers cannot be opened as streams
+        *buf = malloc(result + 1);
+        if (!*buf)
+            return -1;
+        if (replay_data(p, *buf, result) != 0) {
+            free(*buf);
+            *buf = NULL;
+            return -1;
+        }
+        *len = result;
+        return 0;
+    }
+
+    result = result_of(slurp(p->paths[file], buf));
+    if (record(p, OP_READ_FILE, file, 0, 0, result, *buf) != 0) {
+        free(*buf);
+        *buf = NULL;
+        return -1;
+    }
+    if (failed(result))
+        return -1;
+    *len = result;
+    return 0;
+}
+
+int procfs_write_file(struct procfs *p, enum procfs_file file, const void *buf, size_t len) {
+    int64_t result;
+
+    if (p->mode == PROCFS_REPLAY) {
+        if (replay(p, OP_WRITE_FILE, file, 0, len, &result) != 0)
+            return -1;
+        return failed(result) ? -1 : 0;
+    }
+
+    int fd = open(p->paths[file], O_WRONLY);
+    if (fd < 0) {
+        result = -errno;
+    } else {
+        result = result_of(write(fd, buf, len));
+        close(fd);
+    }
+
+    if (record(p, OP_WRITE_FILE, file, 0, len, result, NULL) != 0)
+        return -1;
+    return failed(result) ? -1 : 0;
+}
+
+int procfs_replay_done(struct procfs *p) {
+    if (p->mode != PROCFS_REPLAY)
+        return 0;
+
+    int c = fgetc(p->f);
+    if (c == EOF) {
+        p->end = 1;
+        return 1;
+    }
+    ungetc(c, p->f);
+    return 0;
+}
+
+int procfs_now(struct procfs *p, struct timeval *tv) {
+    if (p->mode == PROCFS_REPLAY) {
+        struct procfs_record r;
+        if (fread(&r, sizeof(r), 1, p->f) != 1) {
+            p->end = 1;
+            errno = ENODATA;
+            return -1;
+        }
+        if (r.op != OP_CLOCK) {
+            fprintf(stderr, "%s: replay diverged at record %zu, expected clock, found %s\n",
+                    p->recording, p->num_records, r.op <= OP_CLOCK ? op_names[r.op] : "?");
+            errno = EIO;
+            return -1;
+        }
+        p->num_records++;
+        tv->tv_sec = r.offset;
+        tv->tv_usec = r.length;
+        p->last = *tv;
+        return 0;
+    }
+
+    gettimeofday(tv, NULL);
+    p->last = *tv;
+    return record(p, OP_CLOCK, PROCFS_CLOCK_FRAME, tv->tv_sec, tv->tv_usec, 0, NULL);
+}
+
+int procfs_now_fine(struct procfs *p, struct timeval *tv) {
+    if (p->mode == PROCFS_REPLAY) {
+        struct procfs_record r;
+        size_t n = fread(&r, sizeof(r), 1, p->f);
+        if (n == 1 && r.op == OP_CLOCK && r.file == PROCFS_CLOCK_FINE) {
+            p->num_records++;
+            tv->tv_sec = r.offset;
+            tv->tv_usec = r.length;
+            p->last = *tv;
+            return 0;
+        }
+
+        // not recorded, leave the record to the operation it belongs to
+        if (n == 1 && fseek(p->f, -(long)sizeof(r), SEEK_CUR) != 0) {
+            perror("fseek");
+            return -1;
+        }
+        clearerr(p->f);
+        *tv = p->last;
+        return 0;
+    }
+
+    gettimeofday(tv, NULL);
+    p->last = *tv;
+    return record(p, OP_CLOCK, PROCFS_CLOCK_FINE, tv->tv_sec, tv->tv_usec, 0, NULL);
+}
+
+const char *procfs_path(const struct procfs *p, enum procfs_file file) {
+    if (p->mode == PROCFS_REPLAY)
+        return p->recording;
+    return p->paths[file];
+}
+
+void procfs_destroy(struct procfs *p) {
+    for (size_t i = 0; i < PROCFS_NUM_FILES; ++i) {
+        if (p->fds[i] >= 0)
+            close(p->fds[i]);
+        free(p->paths[i]);
+    }
+
+    if (p->f)
+        fclose(p->f);
+    free(p->recording);
+
+    memset(p, 0, sizeof(*p));
+    for (size_t i = 0; i < PROCFS_NUM_FILES; ++i)
+        p->fds[i] = -1;
+}
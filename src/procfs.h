@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#ifndef PROCFS_H_
+#define PROCFS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+// all I/O of a target on procfs and sysfs goes through a provider, which can
+// record it to a file and replay it later without access to the process.
+//
+// a recording starts with a struct procfs_header, followed by one struct
+// procfs_record per operation. reads are followed by the bytes read. replay
+// expects the operations in the recorded order, so a recording has to be
+// replayed with the tracking options it was taken with.
+enum procfs_mode {
+    PROCFS_LIVE,
+    PROCFS_RECORD,
+    PROCFS_REPLAY,
+};
+
+enum procfs_file {
+    PROCFS_MAPS,
+    PROCFS_SMAPS,
+    PROCFS_PAGEMAP,
+    PROCFS_CLEAR_REFS,
+    PROCFS_PAGE_IDLE,
+    PROCFS_STAT,
+    PROCFS_SCHEDSTAT,
+    PROCFS_NUM_FILES,
+};
+
+#define PROCFS_MAGIC "SMOGREC1"
+
+struct procfs_header {
+    char magic[8];
+    int32_t pid;
+    uint32_t pagesize;
+};
+
+// clock records tell the clock of a frame from those taken within it in
+// their file field
+enum procfs_clock {
+    PROCFS_CLOCK_FRAME,
+    PROCFS_CLOCK_FINE,
+};
+
+struct procfs_record {
+    uint32_t op;
+    uint32_t file;
+    uint64_t offset;
+    uint64_t length;
+
+    // bytes transferred, or the negated errno of a failed operation
+    int64_t result;
+};
+
+struct procfs {
+    enum procfs_mode mode;
+    pid_t pid;
+
+    char *paths[PROCFS_NUM_FILES];
+    int fds[PROCFS_NUM_FILES];
+
+    // the recording, and the number of operations in it so far
+    char *recording;
+    FILE *f;
+    size_t num_records;
+
+    // whether a replay ran out of records
+    int end;
+
+    // the time of day last taken
+    struct timeval last;
+};
+
+// in replay mode, the pid is taken from the recording
+int procfs_init(struct procfs *p, pid_t pid, enum procfs_mode mode, const char *recording);
+
+// these behave like their system call counterparts, returning -1 and
+// setting errno on failure
+int procfs_open(struct procfs *p, enum procfs_file file, int flags);
+
+ssize_t procfs_pread(struct procfs *p, enum procfs_file file, void *buf, size_t len, off_t off);
+
+ssize_t procfs_pwrite(struct procfs *p, enum procfs_file file, const void *buf, size_t len,
+                      off_t off);
+
+// read a whole file into a newly allocated buffer
+int procfs_read_file(struct procfs *p, enum procfs_file file, char **buf, size_t *len);
+
+int procfs_write_file(struct procfs *p, enum procfs_file file, const void *buf, size_t len);
+
+// the time of day, as it was when recorded in replay mode
+int procfs_now(struct procfs *p, struct timeval *tv);
+
+// the time of day within a frame. replays of recordings that did not take
+// these repeat the last time instead.
+int procfs_now_fine(struct procfs *p, struct timeval *tv);
+
+// whether a replay has no records left, which is never the case otherwise
+int procfs_replay_done(struct procfs *p);
+
+const char *procfs_path(const struct procfs *p, enum procfs_file file);
+
+void procfs_destroy(struct procfs *p);
+
+#endif  // PROCFS_H_
@@ -0,0 +1,407 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#include "./reclaim.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include "./util.h"
+
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open 434
+#endif
+#ifndef __NR_process_madvise
+#define __NR_process_madvise 440
+#endif
+#ifndef MADV_COLD
+#define MADV_COLD 20
+#endif
+#ifndef MADV_PAGEOUT
+#define MADV_PAGEOUT 21
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+
+// defaults
+#define RECLAIM_AFTER 3
+#define RECLAIM_LIMIT (64 << 20)
+
+// the state of a page: frames it has been cold for, saturating, whether it
+// was acted on, and whether it has left memory since
+#define PAGE_AGE 0x3f
+#define PAGE_ACTED 0x40
+#define PAGE_GONE 0x80
+
+// ranges handed to a single process_madvise call, and pages to move_pages
+#define MADVISE_BATCH 512
+#define MOVE_BATCH 1024
+
+static const char *action_names[] = { "advised cold", "paged out", "moved" };
+
+static int parse_count(const char *arg, size_t *n) {
+    char *end;
+    errno = 0;
+    *n = strtoull(arg, &end, 0);
+    return errno != 0 || end == arg || *end;
+}
+
+static int parse_term(struct reclaim_config *config, const char *term) {
+    if (!strcmp(term, "cold")) {
+        config->action = RECLAIM_COLD;
+    } else if (!strcmp(term, "pageout")) {
+        config->action = RECLAIM_PAGEOUT;
+    } else if (!strncmp(term, "node=", 5)) {
+        size_t node;
+        if (parse_count(term + 5, &node) || node > INT16_MAX)
+            return 1;
+        config->action = RECLAIM_MOVE;
+        config->node = node;
+    } else if (!strncmp(term, "after=", 6)) {
+        if (parse_count(term + 6, &config->after) || !config->after
+                || config->after > PAGE_AGE)
+            return 1;
+    } else if (!strncmp(term, "limit=", 6)) {
+        if (parse_size(term + 6, &config->limit) != 0 || config->limit < g_system_pagesize)
+            return 1;
+    } else if (!strcmp(term, "dry-run")) {
+        config->dry_run = 1;
+    } else {
+        return 1;
+    }
+    return 0;
+}
+
+int reclaim_parse(struct reclaim_config *config, const char *spec) {
+    memset(config, 0, sizeof(*config));
+    config->after = RECLAIM_AFTER;
+    config->limit = RECLAIM_LIMIT;
+
+    char *terms = strdup(spec);
+    if (!terms) {
+        perror("strdup");
+        return 2;
+    }
+
+    int res = 0;
+    char *saveptr;
+    for (char *term = strtok_r(terms, ",", &saveptr); term && res == 0;
+            term = strtok_r(NULL, ",", &saveptr)) {
+        res = parse_term(config, term);
+        if (res == 1)
+            fprintf(stderr, "invalid reclaim term: %s\n", term);
+    }
+
+    free(terms);
+    return res;
+}
+
+int reclaim_enabled(const struct reclaim_config *config) {
+    return config->after != 0;
+}
+
+int reclaim_init(struct reclaim *r, const struct reclaim_config *config, pid_t pid) {
+    memset(r, 0, sizeof(*r));
+    r->config = *config;
+    r->pid = pid;
+    r->pidfd = -1;
+
+    if (!config->dry_run && config->action != RECLAIM_MOVE) {
+        r->pidfd = syscall(__NR_pidfd_open, pid, 0);
+        if (r->pidfd < 0) {
+            perror("pidfd_open");
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void reclaim_begin_frame(struct reclaim *r, const struct smog_frame *frame) {
+    // the budget accrues by the time passed, up to a second's worth
+    r->budget += (double)r->config.limit * frame->elapsed_ms / 1000;
+    if (r->budget > r->config.limit)
+        r->budget = r->config.limit;
+
+    r->cursor = 0;
+    r->len = 0;
+    r->num_ranges = 0;
+    r->acted = 0;
+    r->failed = 0;
+    r->reclaimed = 0;
+    r->refaults = 0;
+}
+
+static int grow(void **buf, size_t *capacity, size_t n, size_t size) {
+    if (n <= *capacity)
+        return 0;
+
+    size_t new_capacity = *capacity ? *capacity * 2 : 64;
+    while (new_capacity < n)
+        new_capacity *= 2;
+
+    void *new_buf = realloc(*buf, new_capacity * size);
+    if (!new_buf) {
+        perror("realloc");
+        return 2;
+    }
+    *buf = new_buf;
+    *capacity = new_capacity;
+    return 0;
+}
+
+// the state of a VMA of the previous frame with the same range, or a new one.
+// VMAs are visited by address, so a cursor finds the previous ones.
+static int take_vma(struct reclaim *r, size_t start, size_t end) {
+    int res = grow((void**)&r->vmas, &r->capacity, r->len + 1, sizeof(*r->vmas));
+    if (res != 0)
+        return res;
+
+    while (r->cursor < r->prev_len && r->prev[r->cursor].start < start)
+        r->cursor++;
+
+    struct reclaim_vma *vma = &r->vmas[r->len];
+    struct reclaim_vma *prev = r->cursor < r->prev_len ? &r->prev[r->cursor] : NULL;
+    if (prev && prev->start == start && prev->end == end && prev->pages) {
+        *vma = *prev;
+        prev->pages = NULL;
+    } else {
+        vma->start = start;
+        vma->end = end;
+        vma->pages = calloc(end - start, sizeof(*vma->pages));
+        if (!vma->pages) {
+            perror("calloc");
+            return 2;
+        }
+    }
+
+    r->len++;
+    return 0;
+}
+
+static int add_page(struct reclaim *r, size_t vma, size_t j) {
+    if (r->num_ranges) {
+        struct reclaim_range *last = &r->ranges[r->num_ranges - 1];
+        if (last->vma == vma && last->first + last->count == j) {
+            last->count++;
+            return 0;
+        }
+    }
+
+    int res = grow((void**)&r->ranges, &r->ranges_capacity, r->num_ranges + 1, sizeof(*r->ranges));
+    if (res != 0)
+        return res;
+    r->ranges[r->num_ranges++] = (struct reclaim_range){ vma, j, 1 };
+    return 0;
+}
+
+int reclaim_vma(struct reclaim *r, const struct smog_frame *frame, size_t index,
+                const uint64_t *pagemap, int track_accessed, int track_softdirty) {
+    size_t start = frame->vma_start[index];
+    size_t end = frame->vma_end[index];
+    int res = take_vma(r, start, end);
+    if (res != 0)
+        return res;
+
+    uint64_t used_mask = (track_accessed ? SMOG_PAGE_ACCESSED : 0)
+                       | (track_softdirty ? SMOG_PAGE_SOFTDIRTY : 0);
+    uint8_t *pages = r->vmas[r->len - 1].pages;
+    for (size_t j = 0; j < end - start; ++j) {
+        uint64_t entry = pagemap ? pagemap[j] : 0;
+        int present = !!(entry & SMOG_PAGE_PRESENT);
+        int used = !!(entry & used_mask);
+        uint8_t state = pages[j];
+
+        // pages acted on are watched until they come back into use
+        if (state & PAGE_ACTED) {
+            if (present && (used || (state & PAGE_GONE))) {
+                r->refaults++;
+                pages[j] = 0;
+            } else if (!present && !(state & PAGE_GONE)) {
+                r->reclaimed++;
+                pages[j] = state | PAGE_GONE;
+            }
+            continue;
+        }
+
+        if (!present || used) {
+            pages[j] = 0;
+            continue;
+        }
+        if ((state & PAGE_AGE) < PAGE_AGE)
+            pages[j] = ++state;
+
+        if (state >= r->config.after) {
+            res = add_page(r, r->len - 1, j);
+            if (res != 0)
+                return res;
+        }
+    }
+
+    return 0;
+}
+
+static void mark_acted(struct reclaim *r, const struct reclaim_range *range, size_t count) {
+    uint8_t *pages = r->vmas[range->vma].pages + range->first;
+    for (size_t k = 0; k < count; ++k)
+        pages[k] = PAGE_ACTED;
+    r->acted += count;
+}
+
+static int madvise_ranges(struct reclaim *r, const struct reclaim_range *ranges,
+                          const size_t *counts, size_t n) {
+    struct iovec iov[MADVISE_BATCH];
+    for (size_t k = 0; k < n; ++k) {
+        iov[k].iov_base = (void*)((r->vmas[ranges[k].vma].start + ranges[k].first) * g_system_pagesize);
+        iov[k].iov_len = counts[k] * g_system_pagesize;
+    }
+
+    int advice = r->config.action == RECLAIM_PAGEOUT ? MADV_PAGEOUT : MADV_COLD;
+    long res = syscall(__NR_process_madvise, r->pidfd, iov, n, advice, 0);
+    if (res < 0) {
+        // the process may have unmapped a range since it was read
+        if (errno != ENOMEM && errno != EINVAL) {
+            perror("process_madvise");
+            return 1;
+        }
+        for (size_t k = 0; k < n; ++k)
+            r->failed += counts[k];
+        return 0;
+    }
+
+    // the advice stops at the first range it fails on
+    size_t left = res / g_system_pagesize;
+    for (size_t k = 0; k < n; ++k) {
+        size_t count = counts[k] < left ? counts[k] : left;
+        mark_acted(r, &ranges[k], count);
+        r->failed += counts[k] - count;
+        left -= count;
+    }
+    return 0;
+}
+
+static int move_range(struct reclaim *r, const struct reclaim_range *range, size_t count) {
+    void *pages[MOVE_BATCH];
+    int nodes[MOVE_BATCH];
+    int status[MOVE_BATCH];
+
+    for (size_t done = 0; done < count; ) {
+        size_t n = count - done < MOVE_BATCH ? count - done : MOVE_BATCH;
+        size_t first = r->vmas[range->vma].start + range->first + done;
+        for (size_t k = 0; k < n; ++k) {
+            pages[k] = (void*)((first + k) * g_system_pagesize);
+            nodes[k] = r->config.node;
+        }
+
+        long res = syscall(SYS_move_pages, r->pid, n, pages, nodes, status, MPOL_MF_MOVE);
+        if (res < 0) {
+            perror("move_pages");
+            return 1;
+        }
+
+        uint8_t *state = r->vmas[range->vma].pages + range->first + done;
+        for (size_t k = 0; k < n; ++k) {
+            if (status[k] == r->config.node) {
+                state[k] = PAGE_ACTED;
+                r->acted++;
+            } else {
+                r->failed++;
+            }
+        }
+        done += n;
+    }
+    return 0;
+}
+
+static int act(struct reclaim *r) {
+    struct reclaim_range batch[MADVISE_BATCH];
+    size_t counts[MADVISE_BATCH];
+    size_t n = 0;
+
+    for (size_t k = 0; k < r->num_ranges; ++k) {
+        size_t allowed = r->budget / g_system_pagesize;
+        if (!allowed)
+            break;
+
+        const struct reclaim_range *range = &r->ranges[k];
+        size_t count = range->count < allowed ? range->count : allowed;
+        r->budget -= count * g_system_pagesize;
+
+        int res = 0;
+        if (r->config.dry_run) {
+            mark_acted(r, range, count);
+        } else if (r->config.action == RECLAIM_MOVE) {
+            res = move_range(r, range, count);
+        } else {
+            batch[n] = *range;
+            counts[n++] = count;
+            if (n == MADVISE_BATCH) {
+                res = madvise_ranges(r, batch, counts, n);
+                n = 0;
+            }
+        }
+        if (res != 0)
+            return res;
+    }
+
+    if (n)
+        return madvise_ranges(r, batch, counts, n);
+    return 0;
+}
+
+int reclaim_end_frame(struct reclaim *r, const struct smog_frame *frame) {
+    int res = act(r);
+    if (res != 0)
+        return res;
+
+    // VMAs gone since the previous frame
+    for (size_t k = 0; k < r->prev_len; ++k)
+        free(r->prev[k].pages);
+
+    struct reclaim_vma *vmas = r->prev;
+    size_t capacity = r->prev_capacity;
+    r->prev = r->vmas;
+    r->prev_len = r->len;
+    r->prev_capacity = r->capacity;
+    r->vmas = vmas;
+    r->capacity = capacity;
+    r->len = 0;
+
+    r->total_acted += r->acted;
+    r->total_refaults += r->refaults;
+
+    printf("Reclaim:   %zu Pages (%s) %s%s",
+           r->acted, format_size_string(r->acted * g_system_pagesize),
+           r->config.dry_run ? "would be " : "", action_names[r->config.action]);
+    if (r->config.action == RECLAIM_MOVE)
+        printf(" to node %d", r->config.node);
+    if (r->failed)
+        printf(", %zu failed", r->failed);
+    printf(", %zu reclaimed, %zu refaulted (%.0f/s); %zu refaulted of %zu in total\n",
+           r->reclaimed, r->refaults,
+           frame->elapsed_ms ? r->refaults * 1000.0 / frame->elapsed_ms : 0.0,
+           r->total_refaults, r->total_acted);
+
+    return 0;
+}
+
+void reclaim_destroy(struct reclaim *r) {
+    for (size_t k = 0; k < r->len; ++k)
+        free(r->vmas[k].pages);
+    for (size_t k = 0; k < r->prev_len; ++k)
+        free(r->prev[k].pages);
+    free(r->vmas);
+    free(r->prev);
+    free(r->ranges);
+    if (r->pidfd >= 0)
+        close(r->pidfd);
+    memset(r, 0, sizeof(*r));
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#ifndef RECLAIM_H_
+#define RECLAIM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "./smogmeter.h"
+
+enum reclaim_action {
+    RECLAIM_COLD,     // process_madvise(MADV_COLD)
+    RECLAIM_PAGEOUT,  // process_madvise(MADV_PAGEOUT)
+    RECLAIM_MOVE,     // move_pages to a node
+};
+
+struct reclaim_config {
+    enum reclaim_action action;
+    int node;
+
+    // the frames a page has to stay cold before it is acted on, 0 if disabled
+    size_t after;
+    // the bytes acted on per second
+    size_t limit;
+    // only count the pages that would be acted on
+    int dry_run;
+};
+
+// the cold age and action state of every page of a VMA, found again by its
+// range in the next frame
+struct reclaim_vma {
+    size_t start;
+    size_t end;
+    uint8_t *pages;
+};
+
+// a run of cold pages of a VMA of the frame
+struct reclaim_range {
+    size_t vma;
+    size_t first;
+    size_t count;
+};
+
+struct reclaim {
+    struct reclaim_config config;
+    pid_t pid;
+    int pidfd;
+
+    // the VMAs of this frame and of the previous one, ordered by address
+    struct reclaim_vma *vmas;
+    size_t len;
+    size_t capacity;
+    struct reclaim_vma *prev;
+    size_t prev_len;
+    size_t prev_capacity;
+    size_t cursor;
+
+    // the candidates of this frame, acted on once it ends
+    struct reclaim_range *ranges;
+    size_t num_ranges;
+    size_t ranges_capacity;
+
+    // the bytes that may still be acted on
+    double budget;
+
+    // pages of this frame, and over the run
+    size_t acted;
+    size_t failed;
+    size_t reclaimed;
+    size_t refaults;
+    size_t total_acted;
+    size_t total_refaults;
+};
+
+// parse comma-separated terms: cold, pageout, node=N, after=FRAMES,
+// limit=SIZE and dry-run
+int reclaim_parse(struct reclaim_config *config, const char *spec);
+
+int reclaim_enabled(const struct reclaim_config *config);
+
+int reclaim_init(struct reclaim *r, const struct reclaim_config *config, pid_t pid);
+
+void reclaim_begin_frame(struct reclaim *r, const struct smog_frame *frame);
+
+// age the pages of a VMA of the frame, and collect the cold ones. pages are
+// cold while present and neither accessed nor dirtied, as far as tracked.
+int reclaim_vma(struct reclaim *r, const struct smog_frame *frame, size_t index,
+                const uint64_t *pagemap, int track_accessed, int track_softdirty);
+
+// act on the cold pages within the budget and report the frame
+int reclaim_end_frame(struct reclaim *r, const struct smog_frame *frame);
+
+void reclaim_destroy(struct reclaim *r);
+
+#endif  // RECLAIM_H_
@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#include "./rolling.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct rolling *rolling_create(size_t horizon) {
+    struct rolling *r = calloc(1, sizeof(*r));
+    if (!r) {
+        perror("calloc");
+        return NULL;
+    }
+
+    r->horizon = horizon;
+    r->rates = malloc(horizon * sizeof(*r->rates));
+    r->working_sets = malloc(horizon * sizeof(*r->working_sets));
+    if (!r->rates || !r->working_sets) {
+        perror("malloc");
+        rolling_destroy(r);
+        return NULL;
+    }
+
+    return r;
+}
+
+// rates in units of the lowest bucket
+#define ROLLING_SCALE ((double)(1ULL << -ROLLING_MIN_EXP))
+
+static size_t bucket_of(double rate) {
+    double x = rate * ROLLING_SCALE;
+    if (x < 1)
+        return 0;
+    if (x >= (double)(1ULL << (ROLLING_MAX_EXP - ROLLING_MIN_EXP)))
+        return ROLLING_BUCKETS - 1;
+
+    size_t octave = 63 - __builtin_clzll((uint64_t)x);
+    size_t sub = (x / (1ULL << octave) - 1) * ROLLING_SUB_BUCKETS;
+    return 1 + octave * ROLLING_SUB_BUCKETS + sub;
+}
+
+static double bucket_middle(size_t bucket) {
+    if (bucket == 0)
+        return 0;
+
+    size_t octave = (bucket - 1) / ROLLING_SUB_BUCKETS;
+    size_t sub = (bucket - 1) % ROLLING_SUB_BUCKETS;
+    return (1 + (sub + 0.5) / ROLLING_SUB_BUCKETS) * (1ULL << octave) / ROLLING_SCALE;
+}
+
+// the nearest-rank quantile q, no more than the exact maximum
+static double quantile(const struct rolling_sketch *s, double q, double max) {
+    size_t rank = q * s->len;
+    if (rank < q * s->len || rank == 0)
+        rank++;
+
+    size_t seen = 0;
+    for (size_t b = 0; b < ROLLING_BUCKETS; ++b) {
+        seen += s->counts[b];
+        if (seen >= rank) {
+            double middle = bucket_middle(b);
+            return middle < max ? middle : max;
+        }
+    }
+    return max;
+}
+
+static void fill_stats(struct smog_rolling_stats *stats, const struct rolling_sketch *s,
+                       double ewma, double max_rate, size_t peak) {
+    stats->frames = s->len;
+    stats->ewma_rate = ewma;
+    stats->p50_rate = quantile(s, 0.5, max_rate);
+    stats->p99_rate = quantile(s, 0.99, max_rate);
+    stats->max_rate = max_rate;
+    stats->peak_working_set = peak;
+}
+
+void rolling_add(struct rolling *r, double rate, size_t working_set) {
+    // smoothed over about the horizon
+    double alpha = 2.0 / (r->horizon + 1);
+    r->ewma = r->total.len ? alpha * rate + (1 - alpha) * r->ewma : rate;
+
+    int rescan = 0;
+    if (r->len == r->horizon) {
+        // the oldest sample leaves the horizon
+        double old_rate = r->rates[r->next];
+        r->window.counts[bucket_of(old_rate)]--;
+        r->window.len--;
+        rescan = old_rate >= r->window_max_rate || r->working_sets[r->next] >= r->window_peak;
+    } else {
+        r->len++;
+    }
+
+    size_t bucket = bucket_of(rate);
+    r->window.counts[bucket]++;
+    r->window.len++;
+    r->total.counts[bucket]++;
+    r->total.len++;
+
+    r->rates[r->next] = rate;
+    r->working_sets[r->next] = working_set;
+    r->next = (r->next + 1) % r->horizon;
+
+    if (rescan) {
+        r->window_max_rate = 0;
+        r->window_peak = 0;
+        for (size_t k = 0; k < r->len; ++k) {
+            if (r->rates[k] > r->window_max_rate)
+                r->window_max_rate = r->rates[k];
+            if (r->working_sets[k] > r->window_peak)
+                r->window_peak = r->working_sets[k];
+        }
+    } else {
+        if (rate > r->window_max_rate)
+            r->window_max_rate = rate;
+        if (working_set > r->window_peak)
+            r->window_peak = working_set;
+    }
+
+    double max_rate = r->stats[1].max_rate > rate ? r->stats[1].max_rate : rate;
+    size_t peak = r->stats[1].peak_working_set > working_set
+                ? r->stats[1].peak_working_set : working_set;
+
+    fill_stats(&r->stats[0], &r->window, r->ewma, r->window_max_rate, r->window_peak);
+    fill_stats(&r->stats[1], &r->total, r->ewma, max_rate, peak);
+}
+
+size_t rolling_record_size(size_t horizon) {
+    return sizeof(struct rolling_record) + 2 * sizeof(((struct rolling_sketch*)0)->counts)
+         + horizon * (sizeof(double) + sizeof(uint64_t));
+}
+
+void rolling_save(const struct rolling *r, void *record) {
+    struct rolling_record *rec = record;
+    rec->horizon = r->horizon;
+    rec->len = r->len;
+    rec->next = r->next;
+    rec->window_len = r->window.len;
+    rec->total_len = r->total.len;
+    rec->window_peak = r->window_peak;
+    rec->ewma = r->ewma;
+    rec->window_max_rate = r->window_max_rate;
+    memcpy(rec->stats, r->stats, sizeof(rec->stats));
+
+    char *p = (char*)(rec + 1);
+    memcpy(p, r->window.counts, sizeof(r->window.counts));
+    p += sizeof(r->window.counts);
+    memcpy(p, r->total.counts, sizeof(r->total.counts));
+    p += sizeof(r->total.counts);
+    memcpy(p, r->rates, r->horizon * sizeof(*r->rates));
+    p += r->horizon * sizeof(*r->rates);
+    uint64_t *working_sets = (uint64_t*)p;
+    for (size_t k = 0; k < r->horizon; ++k)
+        working_sets[k] = r->working_sets[k];
+}
+
+struct rolling *rolling_load(const void *record, size_t size) {
+    const struct rolling_record *rec = record;
+    if (size < sizeof(*rec) || !rec->horizon || rec->horizon > size
+            || rolling_record_size(rec->horizon) != size
+            || rec->len > rec->horizon || rec->next >= rec->horizon
+            || rec->window_len != rec->len)
+        return NULL;
+
+    struct rolling *r = rolling_create(rec->horizon);
+    if (!r)
+        return NULL;
+
+    r->len = rec->len;
+    r->next = rec->next;
+    r->window.len = rec->window_len;
+    r->total.len = rec->total_len;
+    r->window_peak = rec->window_peak;
+    r->ewma = rec->ewma;
+    r->window_max_rate = rec->window_max_rate;
+    memcpy(r->stats, rec->stats, sizeof(r->stats));
+
+    const char *p = (const char*)(rec + 1);
+    memcpy(r->window.counts, p, sizeof(r->window.counts));
+    p += sizeof(r->window.counts);
+    memcpy(r->total.counts, p, sizeof(r->total.counts));
+    p += sizeof(r->total.counts);
+    memcpy(r->rates, p, r->horizon * sizeof(*r->rates));
+    p += r->horizon * sizeof(*r->rates);
+    const uint64_t *working_sets = (const uint64_t*)p;
+    for (size_t k = 0; k < r->horizon; ++k)
+        r->working_sets[k] = working_sets[k];
+
+    return r;
+}
+
+void rolling_destroy(struct rolling *r) {
+    if (!r)
+        return;
+    free(r->rates);
+    free(r->working_sets);
+    free(r);
+}
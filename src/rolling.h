@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#ifndef ROLLING_H_
+#define ROLLING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "./smogmeter.h"
+
+// dirty rates are binned into log-scaled buckets, SUB_BUCKETS per power of
+// two between 2^MIN_EXP and 2^MAX_EXP pages/s, with bucket 0 for anything
+// below. a quantile is reported as the middle of its bucket, which is within
+// 1/(2 * SUB_BUCKETS) of the exact rate.
+#define ROLLING_SUB_BUCKETS 8
+#define ROLLING_MIN_EXP (-4)
+#define ROLLING_MAX_EXP 40
+#define ROLLING_BUCKETS (1 + (ROLLING_MAX_EXP - ROLLING_MIN_EXP) * ROLLING_SUB_BUCKETS)
+
+struct rolling_sketch {
+    uint32_t counts[ROLLING_BUCKETS];
+    size_t len;
+};
+
+// streaming statistics of the dirty rate and working set of a VMA or the
+// process, over a horizon of frames and over the whole run. the memory is
+// fixed by the horizon.
+struct rolling {
+    size_t horizon;
+
+    // the samples of the last frames up to the horizon, as rings
+    double *rates;
+    size_t *working_sets;
+    size_t len;
+    size_t next;
+
+    struct rolling_sketch window;
+    struct rolling_sketch total;
+    double ewma;
+
+    // maxima over the rings, found again when their sample leaves
+    double window_max_rate;
+    size_t window_peak;
+
+    // over the horizon, and over the run
+    struct smog_rolling_stats stats[2];
+};
+
+// the layout of rolling statistics in a checkpoint, followed by the counts
+// of the window and total sketches and the rates and working sets of the
+// rings over the horizon
+struct rolling_record {
+    uint64_t horizon;
+    uint64_t len;
+    uint64_t next;
+    uint64_t window_len;
+    uint64_t total_len;
+    uint64_t window_peak;
+    double ewma;
+    double window_max_rate;
+    struct smog_rolling_stats stats[2];
+};
+
+struct rolling *rolling_create(size_t horizon);
+
+// add the sample of a frame and update the statistics
+void rolling_add(struct rolling *r, double rate, size_t working_set);
+
+// the bytes of the record of statistics over a horizon
+size_t rolling_record_size(size_t horizon);
+
+void rolling_save(const struct rolling *r, void *record);
+
+// restore statistics from a record of the given size, or return NULL if it
+// is malformed
+struct rolling *rolling_load(const void *record, size_t size);
+
+void rolling_destroy(struct rolling *r);
+
+#endif  // ROLLING_H_
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+// micro-benchmark of the page loop of a scan, comparing the kernels
+// specialized for every tracking mode with the generic loop
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "./target.h"
+
+#define BENCH_PAGES (1 << 20)
+#define BENCH_PFNS (1 << 22)
+#define BENCH_ROUNDS 20
+
+// share of the pages, in percent
+#define BENCH_PRESENT 90
+#define BENCH_SOFTDIRTY 30
+#define BENCH_IDLE 70
+
+struct mode {
+    const char *name;
+    int track_accessed;
+    int track_softdirty;
+    int track_blocks;
+};
+
+static const struct mode modes[] = {
+    { "present", 0, 0, 0 },
+    { "softdirty", 0, 1, 0 },
+    { "accessed", 1, 0, 0 },
+    { "accessed+softdirty", 1, 1, 0 },
+    { "softdirty+blocks", 0, 1, 1 },
+    { "accessed+softdirty+blocks", 1, 1, 1 },
+};
+
+static size_t granularities[] = { 16 };
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// set up a target with a single VMA and an idle bitmap that is entirely
+// cached, so that the kernels never touch procfs
+static int init_target(struct target *t, const struct mode *m) {
+    memset(t, 0, sizeof(*t));
+    t->config.track_accessed = m->track_accessed;
+    t->config.track_softdirty = m->track_softdirty;
+
+    int res = append_vma(&t->vmas, 1 << 20, (1 << 20) + BENCH_PAGES, "[bench]");
+    if (res != 0)
+        return res;
+
+    size_t pfn_words = BENCH_PFNS / 64;
+    t->idle_map = malloc(pfn_words * sizeof(*t->idle_map));
+    t->pfn_cache = calloc(pfn_words, sizeof(*t->pfn_cache));
+    t->idle_cache = malloc(pfn_words * sizeof(*t->idle_cache));
+    t->planes = malloc(3 * BENCH_PAGES / 64 * sizeof(*t->planes));
+    if (!t->idle_map || !t->pfn_cache || !t->idle_cache || !t->planes) {
+        perror("malloc");
+        return 2;
+    }
+    memset(t->idle_map, 0xff, pfn_words * sizeof(*t->idle_map));
+    t->idle_map_capacity = pfn_words;
+    t->idle_cache_capacity = pfn_words;
+    t->planes_capacity = 3 * BENCH_PAGES / 64;
+
+    for (size_t k = 0; k < pfn_words; ++k) {
+        uint64_t idle = 0;
+        for (size_t b = 0; b < 64; ++b)
+            idle |= (uint64_t)(rand() % 100 < BENCH_IDLE) << b;
+        t->idle_cache[k] = idle;
+    }
+
+    if (m->track_blocks) {
+        t->config.num_granularities = 1;
+        t->config.granularities = granularities;
+        t->num_granularities = 1;
+        t->last_accessed_block = malloc(sizeof(*t->last_accessed_block));
+        t->last_softdirty_block = malloc(sizeof(*t->last_softdirty_block));
+        t->vmas.info[0].blocks = malloc(sizeof(*t->vmas.info[0].blocks));
+        if (!t->last_accessed_block || !t->last_softdirty_block || !t->vmas.info[0].blocks) {
+            perror("malloc");
+            return 2;
+        }
+    }
+
+    return 0;
+}
+
+static void destroy_target(struct target *t) {
+    destroy_vmas(&t->vmas);
+    free(t->idle_map);
+    free(t->pfn_cache);
+    free(t->idle_cache);
+    free(t->planes);
+    free(t->last_accessed_block);
+    free(t->last_softdirty_block);
+}
+
+// the mean time per page of a kernel, restoring the pagemap and the
+// counters of the VMA before every round
+static int bench(struct target *t, scan_kernel scan, const uint64_t *pagemap,
+                 uint64_t *work, double *ns_per_page) {
+    double total = 0;
+    for (size_t r = 0; r < BENCH_ROUNDS; ++r) {
+        memcpy(work, pagemap, BENCH_PAGES * sizeof(*work));
+        memset(t->planes, 0, t->planes_capacity * sizeof(*t->planes));
+        if (t->num_granularities) {
+            memset(t->vmas.info[0].blocks, 0, sizeof(*t->vmas.info[0].blocks));
+            t->last_accessed_block[0] = SIZE_MAX;
+            t->last_softdirty_block[0] = SIZE_MAX;
+        }
+
+        double start = now_ns();
+        int res = scan(t, 0, work);
+        total += now_ns() - start;
+        if (res != 0)
+            return res;
+    }
+
+    *ns_per_page = total / BENCH_ROUNDS / BENCH_PAGES;
+    return 0;
+}
+
+int main(void) {
+    srand(42);
+
+    uint64_t *pagemap = malloc(BENCH_PAGES * sizeof(*pagemap));
+    uint64_t *work = malloc(BENCH_PAGES * sizeof(*work));
+    if (!pagemap || !work) {
+        perror("malloc");
+        return 2;
+    }
+    for (size_t j = 0; j < BENCH_PAGES; ++j) {
+        uint64_t pte = (uint64_t)rand() % BENCH_PFNS;
+        if (rand() % 100 < BENCH_PRESENT)
+            pte |= PM_PRESENT;
+        if (rand() % 100 < BENCH_SOFTDIRTY)
+            pte |= PM_SOFT_DIRTY;
+        pagemap[j] = pte;
+    }
+
+    printf("%-28s %12s %12s %8s\n", "mode", "generic", "specialized", "speedup");
+    for (size_t k = 0; k < sizeof(modes) / sizeof(*modes); ++k) {
+        struct target t;
+        int res = init_target(&t, &modes[k]);
+
+        double generic = 0;
+        double specialized = 0;
+        if (res == 0)
+            res = bench(&t, target_scan_generic, pagemap, work, &generic);
+        if (res == 0)
+            res = bench(&t, target_scan_kernel(&t), pagemap, work, &specialized);
+
+        destroy_target(&t);
+        if (res != 0) {
+            free(pagemap);
+            free(work);
+            return res;
+        }
+
+        printf("%-28s %9.2f ns %9.2f ns %7.2fx\n",
+               modes[k].name, generic, specialized, generic / specialized);
+    }
+
+    free(pagemap);
+    free(work);
+    return 0;
+}
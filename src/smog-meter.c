@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <time.h>
 #include <sys/time.h>
 #include <assert.h>
@@ -16,87 +17,622 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 
-#include "./vmas.h"
+#include "./daemon.h"
+#include "./heatmap.h"
+#include "./numa.h"
+#include "./pagecache.h"
+#include "./reclaim.h"
+#include "./smogmeter.h"
+#include "./stacks.h"
+#include "./target.h"
+#include "./trace.h"
+#include "./trigger.h"
 #include "./util.h"
 
-#define PM_PFRAME_BITS 55
-#define PM_PFN_MASK ((1LL << PM_PFRAME_BITS) - 1)
-#define PM_PRESENT (1ULL << 63)
-
-#define PM_SOFT_DIRTY (1ULL << 55)
-#define PM_ACCESSED (1ULL << 57)  // using a free bit in the pte structure here
-
-#define KPF_REFERENCED (1ULL << 6)
-
-#define write4(FD, BUF) do { \
+#define write4(CLIENT, BUF) do { \
     assert(sizeof(*(BUF)) == 4); \
-    ssize_t bytes = write((FD), (BUF), 4); \
-    assert(bytes == 4); \
+    int written = trace_write((CLIENT), (BUF), 4); \
+    assert(written == 0); \
 } while(0)
 
-#define write8(FD, BUF) do { \
+#define write8(CLIENT, BUF) do { \
     assert(sizeof(*(BUF)) == 8); \
-    ssize_t bytes = write((FD), (BUF), 8); \
-    assert(bytes == 8); \
+    int written = trace_write((CLIENT), (BUF), 8); \
+    assert(written == 0); \
 } while(0)
 
 // defaults
-struct arguments arguments = { -1, 0, 0, 1000, 0, 0, 0, 0, 0, 0, 0, NULL, NULL };
-
-// globals
-size_t g_system_pagesize = 0;
-size_t g_system_physical_pages = 0;
+struct arguments arguments = { -1, 0, 0, 0, 1000, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, NULL, 0, NULL, 0, NULL, 0, 0, { 0, 0, 0, 0, 0, 0 }, { 0, 0, 0, 0, 0 }, NULL, 0, 0 };
 
 extern struct argp argp;
 
-int main(int argc, char* argv[]) {
-    // determine system characteristics
-    g_system_pagesize = sysconf(_SC_PAGE_SIZE);
-    g_system_physical_pages = sysconf(_SC_PHYS_PAGES);
+// state of the CLI client across the frames
+struct client {
+    int trace_fd;
+    // with a trigger, the trace of a frame is buffered until it ends
+    struct trigger *trigger;
+    struct trace_buffer *trace_buffer;
+    struct reclaim *reclaim;
+    struct thread_stacks *stacks;
+    char *proc_maps;
+    struct page_cache *page_cache;
+
+    // the time of the previous frame, the sampling interval is based on it
+    struct timeval prev;
+};
+
+// report the accessed and dirty blocks of every granularity, and the runs
+// of dirty pages
+static void report_blocks(const char *indent, const struct smog_frame *frame,
+                          const struct smog_block_counters *blocks,
+                          const struct smog_run_stats *runs, size_t softdirty) {
+    for (size_t g = 0; blocks && g < frame->num_granularities; ++g) {
+        printf("%sBlocks of %s: ", indent,
+               format_size_string(frame->granularities[g] * g_system_pagesize));
+        if (arguments.track_accessed) {
+            printf("%zu accessed, ", blocks[g].accessed);
+        }
+        printf("%zu softdirty\n", blocks[g].softdirty);
+    }
 
-    // parse CLI options
-    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+    if (runs && arguments.track_softdirty && runs->runs) {
+        printf("%sDirty runs: %zu, longest %zu Pages, mean %.1f Pages\n",
+               indent, runs->runs, runs->longest, (double)softdirty / runs->runs);
+    }
+}
 
-    printf("SMOG dirty-rate meter\n");
-    printf("  System page size:       %s\n", format_size_string(g_system_pagesize));
-    printf("  System physical pages:  %zu (%s)\n",
-           g_system_physical_pages,
-           format_size_string(g_system_physical_pages * g_system_pagesize));
-    printf("Monitored PID:            %d\n", arguments.pid);
+static void report_churn(const char *indent, const struct smog_churn *churn) {
+    printf("%sChurn:     %zu Pages committed, %zu freed", indent, churn->committed, churn->freed);
+    if (arguments.track_accessed || arguments.track_softdirty) {
+        printf(", %zu became hot, %zu went cold", churn->heated, churn->cooled);
+    }
+    printf("\n");
+}
+
+static void report_rolling(const char *indent, const char *label,
+                           const struct smog_rolling_stats *rolling) {
+    printf("%s%s", indent, label);
+    if (arguments.track_softdirty) {
+        printf("%.0f/s smoothed, p50 %.0f/s, p99 %.0f/s, max %.0f/s, ",
+               rolling->ewma_rate, rolling->p50_rate, rolling->p99_rate, rolling->max_rate);
+    }
+    printf("peak %s %zu Pages, %s\n", arguments.track_accessed ? "accessed" : "committed",
+           rolling->peak_working_set,
+           format_size_string(rolling->peak_working_set * g_system_pagesize));
+}
+
+// report the pages accessed and dirtied within the windows completed by a
+// frame, of a VMA or in total if counters is NULL
+static void report_windows(const char *indent, const struct smog_frame *frame,
+                           const struct smog_window_counters *counters) {
+    for (size_t w = 0; w < frame->num_windows; ++w) {
+        const struct smog_window *window = &frame->windows[w];
+        if (window->frames < window->length)
+            continue;
+
+        const struct smog_window_counters *c = counters ? &counters[w] : &window->totals;
+        printf("%sWindow of %zu ms: ", indent, window->length * arguments.delay);
+        if (arguments.track_accessed) {
+            printf("%zu Pages accessed, ", c->accessed);
+        }
+        printf("%zu Pages softdirty, %s in %zu ms (%.0f/s)\n",
+               c->softdirty, format_size_string(c->softdirty * g_system_pagesize),
+               window->elapsed_ms, c->softdirty * 1000.0 / window->elapsed_ms);
+    }
+}
+
+// tracefile is encoded as:
+//   00 not present
+//   01 idle
+//   10 accessed
+//   11 softdirty
+//
+// this loses some information where pages are dirty but
+// not accessed, but given that these are caused by
+// imprecise measurements and time drifting, it's probalby
+// okay. still, as usual, here be dragons.
+//
+// the encoding is instantiated with and without accessed tracking, and
+// computed without branches.
+static inline __attribute__((always_inline))
+void encode_pages(uint32_t *words, const uint64_t *pagemap, size_t len, int track_accessed) {
+    for (size_t w = 0; w < (len + 15) / 16; ++w) {
+        size_t n = len - w * 16 < 16 ? len - w * 16 : 16;
+        const uint64_t *ptes = pagemap + w * 16;
+
+        uint32_t flags = 0;
+        for (size_t k = 0; k < n; ++k) {
+            uint32_t present = ptes[k] >> 63;
+            uint32_t softdirty = !!(ptes[k] & PM_SOFT_DIRTY);
+            uint32_t accessed = track_accessed && (ptes[k] & PM_ACCESSED);
+
+            uint32_t v = 1 + (accessed & !softdirty) + 2 * softdirty;
+            flags |= (v & -present) << (2 * k);
+        }
+        words[w] = flags;
+    }
+}
+
+static void encode_pages_accessed(uint32_t *words, const uint64_t *pagemap, size_t len) {
+    encode_pages(words, pagemap, len, 1);
+}
+
+static void encode_pages_softdirty(uint32_t *words, const uint64_t *pagemap, size_t len) {
+    encode_pages(words, pagemap, len, 0);
+}
+
+// the pages of a VMA are encoded and written in batches of this many words
+#define ENCODE_BATCH 1024
+
+static int trace_write(struct client *client, const void *data, size_t len) {
+    if (client->trace_buffer) {
+        return trace_buffer_append(client->trace_buffer, data, len);
+    }
+
+    ssize_t bytes = write(client->trace_fd, data, len);
+    if (bytes < (ssize_t)len) {
+        fprintf(stderr, "%s: partial write\n", arguments.tracefile);
+        return 1;
+    }
+    return 0;
+}
+
+static int write_pages(struct client *client, const uint64_t *pagemap, size_t len) {
+    void (*encode)(uint32_t *, const uint64_t *, size_t) =
+        arguments.track_accessed ? encode_pages_accessed : encode_pages_softdirty;
+
+    uint32_t words[ENCODE_BATCH];
+    for (size_t j = 0; j < len; j += ENCODE_BATCH * 16) {
+        size_t n = len - j < ENCODE_BATCH * 16 ? len - j : ENCODE_BATCH * 16;
+        encode(words, pagemap + j, n);
+        int res = trace_write(client, words, (n + 15) / 16 * 4);
+        if (res != 0) {
+            return res;
+        }
+    }
+    return 0;
+}
+
+// skipped VMAs have no present pages
+static int write_unpopulated(struct client *client, size_t len) {
+    static const uint32_t zeros[ENCODE_BATCH] = { 0 };
+    size_t words = (len + 15) / 16;
+    while (words > 0) {
+        size_t n = words < ENCODE_BATCH ? words : ENCODE_BATCH;
+        int res = trace_write(client, zeros, n * 4);
+        if (res != 0) {
+            return res;
+        }
+        words -= n;
+    }
+    return 0;
+}
+
+// the microseconds from one time to a later one, clamped to the trace fields
+static uint32_t micros_since(const struct timeval *from, const struct timeval *to) {
+    struct timeval d;
+    timersub(to, from, &d);
+    if (d.tv_sec < 0) {
+        return 0;
+    }
+    uint64_t us = d.tv_sec * 1000000 + d.tv_usec;
+    return us < UINT32_MAX ? us : UINT32_MAX;
+}
+
+static int report_vma(const struct smog_frame *frame, size_t i, const char *pathname,
+                      const struct smog_node_counters *nodes,
+                      const struct smog_block_counters *blocks,
+                      const struct smog_run_stats *runs,
+                      const struct smog_window_counters *windows,
+                      const struct smog_churn *churn,
+                      const struct smog_rolling_stats *rolling,
+                      const struct smog_vma_times *times, const uint64_t *pagemap,
+                      struct client *client) {
+    size_t start = frame->vma_start[i];
+    size_t end = frame->vma_end[i];
+    size_t len = end - start;
+    // rates are taken over the time the pages of the VMA were counted, if known
+    double elapsed_ms = times ? times->window_us / 1000.0 : frame->elapsed_ms;
+    size_t committed = frame->vma_committed[i];
+    size_t accessed = frame->vma_accessed[i];
+    size_t softdirty = frame->vma_softdirty[i];
+
+    if (arguments.verbose
+            && len >= arguments.min_vma_reserved
+            && committed >= arguments.min_vma_committed
+            && (!arguments.track_accessed || accessed >= arguments.min_vma_accessed)
+            && softdirty >= arguments.min_vma_dirty) {
+        printf("  VMA #%zu: %#zx ... %#zx %s\n",
+               i, start, end, pathname);
+
+        double persec = softdirty * 1000.0 / elapsed_ms;
+        printf("    - Reserved:  %zu Pages, %s\n",
+               len,
+               format_size_string(len * g_system_pagesize));
+        printf("    - Committed: %zu Pages, %s\n",
+               committed,
+               format_size_string(committed * g_system_pagesize));
+        if (arguments.track_accessed) {
+            printf("    - Accessed: %zu Pages, %s\n",
+                   accessed,
+                   format_size_string(accessed * g_system_pagesize));
+        }
+        if (arguments.track_softdirty) {
+            printf("    - Softdirty: %zu Pages, %s in %zu ms (%.0f/s; %.2f%%)\n",
+                   softdirty,
+                   format_size_string(softdirty * g_system_pagesize),
+                   (size_t)elapsed_ms, persec, 100.0 * softdirty / committed);
+        }
+        report_blocks("    - ", frame, blocks, runs, softdirty);
+        if (windows) {
+            report_windows("    - ", frame, windows);
+        }
+        if (churn && (churn->committed || churn->freed || churn->heated || churn->cooled)) {
+            report_churn("    - ", churn);
+        }
+        if (rolling) {
+            report_rolling("    - ", "Rolling:   ", rolling);
+        }
+
+        if (nodes) {
+            for (size_t n = 0; n < frame->num_nodes; ++n) {
+                const struct smog_node_counters *nc = &nodes[n];
+                if (!nc->committed)
+                    continue;
+                printf("    - Node %zu: %zu Pages committed, %zu accessed, %zu softdirty (%.0f/s)\n",
+                       n, nc->committed, nc->accessed, nc->softdirty,
+                       nc->softdirty * 1000.0 / elapsed_ms);
+            }
+        }
+
+        if (arguments.verbose >= 2) {
+            int res = render_heatmap(pagemap, len, arguments.heatmap_width);
+            if (res != 0) {
+                return res;
+            }
+        }
+    }
 
-    // prepare tracefile
-    int trace_fd = -1;
     if (arguments.tracefile) {
-        trace_fd = open(arguments.tracefile, O_CREAT | O_RDWR | O_TRUNC, 0644);
-        if (trace_fd < 0) {
+        uint64_t addr_start = start;
+        uint64_t addr_end = end | (times ? TRACE_VMA_EXTENDED : 0);
+        write8(client, &addr_start);
+        write8(client, &addr_end);
+
+        uint32_t name_length = strlen(pathname) + 1;
+        write4(client, &name_length);
+        int res = trace_write(client, pathname, name_length);
+        if (res != 0) {
+            return res;
+        }
+
+        if (times) {
+            uint32_t extension[5] = {
+                TRACE_VMA_EXTENSION_VERSION,
+                TRACE_VMA_EXTENSION_LENGTH,
+                micros_since(&frame->timestamp, &times->scan_start),
+                micros_since(&frame->timestamp, &times->scan_end),
+                times->window_us < UINT32_MAX ? times->window_us : UINT32_MAX,
+            };
+            res = trace_write(client, extension, sizeof(extension));
+            if (res != 0) {
+                return res;
+            }
+        }
+
+        res = pagemap ? write_pages(client, pagemap, len) : write_unpopulated(client, len);
+        if (res != 0) {
+            return res;
+        }
+
+        // buffered frames are synced when they are written out
+        if (!client->trace_buffer && fsync(client->trace_fd) != 0) {
             fprintf(stderr, "%s: ", arguments.tracefile);
-            perror("open");
-            return 1;
+            perror("fsync");
         }
     }
 
-    // produce paths to various procfs files for the monitored process
-    char *proc_pagemap = makestr("/proc/%d/pagemap", arguments.pid);
-    if (!proc_pagemap) {
-        perror("makestr");
-        return 2;
+    return 0;
+}
+
+static int on_vma(struct smog_ctx *ctx, const struct smog_frame *frame,
+                  size_t index, const uint64_t *pagemap, void *arg) {
+    struct client *client = arg;
+
+    // the stacks of threads other than the main one are named after them
+    const char *pathname = smog_vma_pathname(ctx, index);
+    char stack_name[32];
+    const struct thread_stack *thread = client->stacks ? thread_stacks_find(client->stacks, index) : NULL;
+    if (thread && !*pathname) {
+        snprintf(stack_name, sizeof(stack_name), "[stack:%d]", thread->tid);
+        pathname = stack_name;
     }
-    char *proc_maps = makestr("/proc/%d/maps", arguments.pid);
-    if (!proc_maps) {
-        perror("makestr");
-        return 2;
+
+    int res = report_vma(frame, index, pathname, smog_vma_nodes(ctx, index),
+                         smog_vma_blocks(ctx, index), smog_vma_runs(ctx, index),
+                         smog_vma_windows(ctx, index), smog_vma_churn(ctx, index),
+                         smog_vma_rolling(ctx, index), smog_vma_times(ctx, index),
+                         pagemap, client);
+    if (res != 0) {
+        return res;
     }
-    char *proc_smaps = makestr("/proc/%d/smaps", arguments.pid);
-    if (!proc_smaps) {
-        perror("makestr");
-        return 2;
+
+    if (client->reclaim) {
+        return reclaim_vma(client->reclaim, frame, index, pagemap,
+                           arguments.track_accessed, arguments.track_softdirty);
     }
-    char *proc_clear_refs = makestr("/proc/%d/clear_refs", arguments.pid);
-    if (!proc_clear_refs) {
-        perror("makestr");
-        return 2;
+    return 0;
+}
+
+static int on_begin_frame(struct smog_ctx *ctx, const struct smog_frame *frame, void *arg) {
+    (void)ctx;
+    struct client *client = arg;
+
+    struct timeval now = frame->timestamp;
+    client->prev = now;
+
+    if (client->trigger) {
+        client->trace_buffer = trigger_begin_frame(client->trigger);
+    }
+    if (client->reclaim) {
+        reclaim_begin_frame(client->reclaim, frame);
+    }
+    if (client->stacks) {
+        int res = thread_stacks_begin_frame(client->stacks, frame);
+        if (res != 0) {
+            return res;
+        }
+    }
+
+    struct tm *ti = localtime(&now.tv_sec);
+    char time_buf[64] = { 0 };
+    strftime(time_buf, 64, "%F_%T", ti);
+
+    if (arguments.tracefile) {
+        uint32_t sec = now.tv_sec;
+        uint32_t usec = now.tv_usec;
+        write4(client, &sec);
+        write4(client, &usec);
+
+        uint32_t nvmas = frame->num_vmas + (client->page_cache ? 1 : 0);
+        write4(client, &nvmas);
+    }
+
+    if (arguments.verbose) {
+        printf("\n");
+        printf("%s.%06lu - Parsed %zu VMAs from %s:\n",
+               time_buf, now.tv_usec, frame->num_vmas, client->proc_maps);
+    } else {
+        printf("%s.%06lu - Parsed %zu VMAs from %s\n",
+               time_buf, now.tv_usec, frame->num_vmas, client->proc_maps);
+    }
+
+    return 0;
+}
+
+static int on_end_frame(struct smog_ctx *ctx, const struct smog_frame *frame, void *arg) {
+    struct client *client = arg;
+    struct page_cache *page_cache = client->page_cache;
+
+    // the page cache of the mapped file is reported as an additional VMA
+    if (page_cache) {
+        int res = page_cache_scan(page_cache);
+        if (res != 0) {
+            return res;
+        }
+
+        struct smog_frame view = *frame;
+        view.num_vmas = 1;
+        view.num_nodes = 0;
+        view.vma_start = page_cache->vmas.start;
+        view.vma_end = page_cache->vmas.end;
+        view.vma_committed = page_cache->vmas.committed;
+        view.vma_accessed = page_cache->vmas.accessed;
+        view.vma_softdirty = page_cache->vmas.softdirty;
+        res = report_vma(&view, 0, page_cache->vmas.info[0].pathname, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+                         page_cache->pagemap, client);
+        if (res != 0) {
+            return res;
+        }
+    }
+
+    double persec = frame->softdirty * 1000.0 / frame->elapsed_ms;
+    printf("Reserved:  %zu Pages, %s\n",
+           frame->reserved,
+           format_size_string(frame->reserved * g_system_pagesize));
+    printf("Committed: %zu Pages, %s\n",
+           frame->committed,
+           format_size_string(frame->committed * g_system_pagesize));
+    if (arguments.track_accessed) {
+        printf("Accessed: %zu Pages, %s\n",
+               frame->accessed,
+               format_size_string(frame->accessed * g_system_pagesize));
+    }
+    if (arguments.track_softdirty) {
+        printf("Softdirty: %zu Pages, %s in %zu ms (%.0f/s; %.2f%%)\n",
+               frame->softdirty,
+               format_size_string(frame->softdirty * g_system_pagesize),
+               frame->elapsed_ms, persec, 100.0 * frame->softdirty / frame->committed);
+    }
+    report_churn("", &frame->churn);
+    report_blocks("", frame, frame->blocks, &frame->runs, frame->softdirty);
+    report_windows("", frame, NULL);
+    if (arguments.rolling) {
+        report_rolling("", "Rolling:   ", &frame->rolling);
+    }
+    printf("Skew:      %.1f ms from the first to the last VMA read\n",
+           frame->stats.skew.tv_sec * 1000.0 + frame->stats.skew.tv_usec / 1000.0);
+
+    if (arguments.track_process) {
+        const struct smog_process_stats *ps = &frame->process;
+        printf("Process:   %zu minor faults (%.0f/s", ps->minflt, ps->minflt * 1000.0 / frame->elapsed_ms);
+        if (arguments.track_softdirty && frame->softdirty) {
+            printf(", %.2f per softdirty page", (double)ps->minflt / frame->softdirty);
+        }
+        printf("), %zu major, %zu ms user, %zu ms system CPU\n",
+               ps->majflt, ps->utime_ms, ps->stime_ms);
+    }
+    if (arguments.track_schedstat) {
+        const struct smog_process_stats *ps = &frame->process;
+        printf("Schedstat: %.1f ms on CPU, %.1f ms waiting, %" PRIu64 " timeslices\n",
+               ps->run_ns / 1e6, ps->wait_ns / 1e6, ps->timeslices);
+    }
+
+    if (frame->nodes) {
+        for (size_t n = 0; n < frame->num_nodes; ++n) {
+            const struct smog_node_counters *nc = &frame->nodes[n];
+            printf("Node %zu:    %zu Pages committed (%s), %zu accessed, %zu softdirty (%.0f/s)\n",
+                   n, nc->committed,
+                   format_size_string(nc->committed * g_system_pagesize),
+                   nc->accessed, nc->softdirty,
+                   nc->softdirty * 1000.0 / frame->elapsed_ms);
+        }
+    }
+
+    if (page_cache) {
+        printf("Page cache: %zu Pages, %s cached, %zu dirty (%zu new, %.0f/s), %zu writeback, %zu evicted\n",
+               page_cache->vmas.committed[0],
+               format_size_string(page_cache->vmas.committed[0] * g_system_pagesize),
+               page_cache->dirty, page_cache->newly_dirty,
+               page_cache->newly_dirty * 1000.0 / frame->elapsed_ms,
+               page_cache->writeback, page_cache->evicted);
+    }
+
+    if (client->stacks) {
+        thread_stacks_end_frame(client->stacks, frame, arguments.track_accessed,
+                                arguments.track_softdirty);
+    }
+
+    if (arguments.verbose || arguments.skip_unpopulated) {
+        const struct smog_scan_stats *stats = &frame->stats;
+        printf("Scan:      %zu VMAs read (%s of pagemap)",
+               stats->vmas_read, format_size_string(stats->pagemap_read));
+        printf(", %zu skipped (%s avoided) in %zu ms\n",
+               stats->vmas_skipped, format_size_string(stats->pagemap_skipped),
+               stats->scan_time.tv_sec * 1000 + stats->scan_time.tv_usec / 1000);
+    }
+
+    if (client->reclaim) {
+        int res = reclaim_end_frame(client->reclaim, frame);
+        if (res != 0) {
+            return res;
+        }
+    }
+
+    if (arguments.verbose) {
+        for (size_t i = 0; i < frame->num_vmas; ++i) {
+            if (frame->vma_committed[i]
+                    && frame->vma_softdirty[i] >= frame->vma_committed[i]) {
+                fprintf(stderr, "warning: VMA #%zu: maxed out dirty pages!\n", i);
+            }
+        }
+    }
+
+    if (client->trigger) {
+        int res = trigger_end_frame(client->trigger, ctx, frame, client->trace_fd);
+        if (res != 0) {
+            return res;
+        }
+    }
+
+    return 0;
+}
+
+// the rolling statistics over the run of the VMAs still mapped, and of the
+// totals
+static void report_summary(const struct smog_ctx *ctx) {
+    const struct smog_frame *frame = smog_last_frame(ctx);
+    if (!frame) {
+        return;
+    }
+
+    printf("\nSummary over %zu frames:\n", frame->rolling_total.frames);
+    for (size_t i = 0; i < frame->num_vmas; ++i) {
+        const struct smog_rolling_stats *total = smog_vma_rolling_total(ctx, i);
+        if (!total || !total->peak_working_set
+                || total->peak_working_set < arguments.min_vma_committed) {
+            continue;
+        }
+        printf("  VMA #%zu: %#zx ... %#zx %s\n",
+               i, frame->vma_start[i], frame->vma_end[i], smog_vma_pathname(ctx, i));
+        report_rolling("    - ", "", total);
+    }
+    report_rolling("", "Total:     ", &frame->rolling_total);
+}
+
+// the interval may be stretched up to this factor before tracking is reduced
+#define BUDGET_MAX_STRETCH 10
+
+// state of the CPU budget controller
+struct budget {
+    // the CPU time of the meter at the previous frame, and the smoothed cost
+    // of a frame, in milliseconds
+    double prev_cpu_ms;
+    double cost_ms;
+
+    // the current interval in milliseconds
+    uint64_t delay;
+};
+
+static double cpu_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// measure the CPU time the meter took for a frame, and lower the resolution
+// of the next ones if it exceeds the budget. the interval is lengthened
+// first, and shortened again once the cost allows. if that is not enough,
+// accessed tracking, the most expensive part of a scan, is dropped.
+static int adapt_to_budget(struct smog_ctx *ctx, struct smog_config *config,
+                           struct budget *budget, const struct smog_frame *frame) {
+    double now = cpu_time_ms();
+    double cost = now - budget->prev_cpu_ms;
+    budget->prev_cpu_ms = now;
+    budget->cost_ms = budget->cost_ms ? (budget->cost_ms + cost) / 2 : cost;
+
+    double share = arguments.cpu_budget / 100;
+    uint64_t needed = budget->cost_ms / share + 1;
+
+    if (needed > arguments.delay * BUDGET_MAX_STRETCH && config->track_accessed) {
+        config->track_accessed = 0;
+        int res = smog_configure(ctx, config);
+        if (res != 0) {
+            return res;
+        }
+        arguments.track_accessed = 0;
+
+        printf("Budget:    dropped accessed tracking, a frame took %.1f ms of CPU\n",
+               budget->cost_ms);
+
+        // measure the cost without it
+        budget->cost_ms = 0;
+        needed = arguments.delay;
     }
-    char *proc_cmdline = makestr("/proc/%d/cmdline", arguments.pid);
+
+    // shorten the interval only after a clear drop in cost, to not follow
+    // the jitter of every frame
+    uint64_t delay = budget->delay;
+    if (needed > delay) {
+        delay = needed;
+    } else if (needed < delay * 3 / 4) {
+        delay = needed > arguments.delay ? needed : arguments.delay;
+    }
+    if (delay != budget->delay) {
+        printf("Budget:    interval %s to %" PRIu64 " ms\n",
+               delay > budget->delay ? "lengthened" : "shortened", delay);
+        budget->delay = delay;
+    }
+
+    printf("Budget:    %.1f ms of CPU in %zu ms (%.2f%% of %.2f%%)\n",
+           cost, frame->elapsed_ms, frame->elapsed_ms ? 100.0 * cost / frame->elapsed_ms : 0,
+           arguments.cpu_budget);
+
+    return 0;
+}
+
+static int print_cmdline(pid_t pid) {
+    char *proc_cmdline = makestr("/proc/%d/cmdline", pid);
     if (!proc_cmdline) {
         perror("makestr");
         return 2;
@@ -122,10 +658,77 @@ int main(int argc, char* argv[]) {
     printf("\n");
 
     close(cmdline_fd);
+    free(proc_cmdline);
+    return 0;
+}
 
-    int mapping_fd;
-    size_t mapping_sz;
-    void *mapping;
+static int check_smaps(pid_t pid) {
+    char *proc_smaps = makestr("/proc/%d/smaps", pid);
+    if (!proc_smaps) {
+        perror("makestr");
+        return 2;
+    }
+
+    // parse the smaps to warn about hugepages
+    int res = parse_smaps(proc_smaps);
+    if (res != 0) {
+        fprintf(stderr, "%s: ", proc_smaps);
+        perror("parse_smaps");
+        return res;
+    }
+
+    free(proc_smaps);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    // determine system characteristics
+    detect_system();
+
+    // parse CLI options
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    if (!arguments.heatmap_width) {
+        arguments.heatmap_width = heatmap_default_width();
+    }
+
+    printf("SMOG dirty-rate meter\n");
+    printf("  System page size:       %s\n", format_size_string(g_system_pagesize));
+    printf("  System physical pages:  %zu (%s)\n",
+           g_system_physical_pages,
+           format_size_string(g_system_physical_pages * g_system_pagesize));
+
+    if (arguments.daemon) {
+        return run_daemon(arguments.daemon);
+    }
+
+    if (arguments.replay) {
+        printf("Replaying:                %s\n", arguments.replay);
+    } else {
+        printf("Monitored PID:            %d\n", arguments.pid);
+    }
+    // prepare tracefile
+    int trace_fd = -1;
+    if (arguments.tracefile) {
+        trace_fd = open(arguments.tracefile, O_CREAT | O_RDWR | O_TRUNC, 0644);
+        if (trace_fd < 0) {
+            fprintf(stderr, "%s: ", arguments.tracefile);
+            perror("open");
+            return 1;
+        }
+    }
+
+    int res = 0;
+    if (!arguments.replay) {
+        res = print_cmdline(arguments.pid);
+        if (res != 0) {
+            return res;
+        }
+    }
+
+    int mapping_fd = -1;
+    size_t mapping_sz = 0;
+    void *mapping = NULL;
     if (arguments.self_map) {
         printf("Mapping file:             %s\n", arguments.vma);
 
@@ -154,426 +757,239 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    int pagemap_fd = open(proc_pagemap, O_RDONLY);
-    if (pagemap_fd < 0) {
-        fprintf(stderr, "%s: ", proc_pagemap);
-        perror("open");
-        return 1;
-    }
-
-    int page_idle_fd = open("/sys/kernel/mm/page_idle/bitmap", O_RDWR);
-    if (page_idle_fd < 0) {
-        fprintf(stderr, "/sys/kernel/mm/page_idle/bitmap: ");
-        perror("open");
-        return 1;
+    struct page_cache page_cache;
+    if (arguments.track_page_cache) {
+        res = page_cache_init(&page_cache, arguments.vma, mapping_fd, mapping, mapping_sz);
+        if (res != 0) {
+            return res;
+        }
     }
 
-    // parse the smaps to warn about hugepages
-    res = parse_smaps(proc_smaps);
-    if (res != 0) {
-        fprintf(stderr, "%s: ", proc_smaps);
-        perror("parse_smaps");
-        return res;
+    if (!arguments.replay) {
+        res = check_smaps(arguments.pid);
+        if (res != 0) {
+            return res;
+        }
     }
 
-    struct vma *vmas = NULL;
-    size_t num_vmas = 0;
-
-    const size_t CHONK = 8;
-    uint64_t *pfn_cache = NULL;
-    uint64_t *idle_cache = NULL;
-    uint64_t *idle_map = NULL;
-    size_t idle_cache_capacity = 0;
-    size_t idle_map_capacity = 0;
-
-    size_t num_frames = 0;
-
-    struct timeval now;
-    struct timeval prev;
-    gettimeofday(&prev, NULL);
-    struct timeval delay = TIMEVAL_FROM_MILLIS(arguments.delay);
-
-    while (1) {
-        // clear all softdirty flags to initiate the measurement period
-        if (arguments.track_softdirty) {
-            int res = clear_softdirty(proc_clear_refs);
-            if (res != 0) {
-                fprintf(stderr, "%s: ", proc_clear_refs);
-                perror("clear_softdirty");
-                return res;
-            }
+    // windows are configured in frames
+    size_t *window_frames = NULL;
+    if (arguments.num_windows) {
+        window_frames = malloc(arguments.num_windows * sizeof(*window_frames));
+        if (!window_frames) {
+            perror("malloc");
+            return 2;
         }
-
-        // clear all tracked accessed bits
-        if (arguments.track_accessed && idle_cache) {
-            ssize_t wsize = pwrite(page_idle_fd, pfn_cache, idle_cache_capacity * 8, 0);
-            if (wsize < 0) {
-                fprintf(stderr, "/sys/kernel/mm/page_idle/bitmap: ");
-                perror("pwrite");
-                return 1;
-            }
-            while (wsize < (ssize_t)idle_cache_capacity * 8) {
-                // fprintf(stderr, "/sys/kernel/mm/page_idle/bitmap: partial write %zi / %zu\n",
-                //         wsize, idle_cache_capacity * 8);
-                wsize -= wsize % 8;
-                ssize_t _wsize = pwrite(page_idle_fd, pfn_cache + wsize / 8,
-                                        idle_cache_capacity * 8 - wsize, wsize);
-                if (_wsize < 0) {
-                    if (errno = ENXIO) {
-                        errno = 0;
-                        break;
-                    }
-                    fprintf(stderr, "/sys/kernel/mm/page_idle/bitmap: ");
-                    perror("pwrite");
-                    return 1;
-                }
-                wsize += _wsize;
-            }
-            memset(pfn_cache, 0, idle_cache_capacity * 8);
-            memset(idle_cache, 0, idle_cache_capacity * 8);
-            memset(idle_map, 0, idle_map_capacity * 8);
+        for (size_t w = 0; w < arguments.num_windows; ++w) {
+            window_frames[w] = arguments.windows[w] / arguments.delay;
         }
+    }
 
-        // the sampling interval
-        gettimeofday(&now, NULL);
-
-        // determine elapsed time
-        struct timeval elapsed;
-        timersub(&now, &prev, &elapsed);
-
-        // if less time elapsed than the configured delay, sleep the remainder
-        if (timercmp(&elapsed, &delay, <)) {
-            struct timeval remaining;
-            timersub(&delay, &elapsed, &remaining);
+    struct smog_config config = {
+        arguments.track_accessed,
+        arguments.track_softdirty,
+        arguments.track_numa,
+        arguments.skip_unpopulated,
+        arguments.filter,
+        arguments.verbose,
+        arguments.num_granularities,
+        arguments.granularities,
+        arguments.num_windows,
+        window_frames,
+        arguments.track_process,
+        arguments.track_schedstat,
+        arguments.delay ? arguments.rolling / arguments.delay : 0,
+    };
+    struct smog_ctx *ctx = smog_create(&config);
+    if (!ctx) {
+        return 2;
+    }
 
-            //if (arguments.verbose) {
-                printf("+++%zu ms elapsed of %zu ms configured delay. sleeping %zu ms\n", elapsed.tv_sec * 1000 + elapsed.tv_usec / 1000, arguments.delay, remaining.tv_sec * 1000 + remaining.tv_usec / 1000);
-            //}
+    if (arguments.track_numa) {
+        printf("NUMA nodes:               %zu\n", g_numa_nodes);
+    }
 
-            struct timespec delay_ts = TIMEVAL_TO_TIMESPEC(remaining);
+    struct client client = { trace_fd, NULL, NULL, NULL, NULL, NULL, NULL, { 0, 0 } };
+    if (arguments.replay) {
+        client.proc_maps = makestr("%s", arguments.replay);
+    } else {
+        client.proc_maps = makestr("/proc/%d/maps", arguments.pid);
+    }
+    if (!client.proc_maps) {
+        perror("makestr");
+        return 2;
+    }
+    if (arguments.track_page_cache) {
+        client.page_cache = &page_cache;
+    }
 
-            res = nanosleep(&delay_ts, NULL);
-            if (res != 0) {
-                perror("nanosleep");
-                return res;
-            }
-        } else {
-            //if (arguments.verbose) {
-                printf("+++%zu ms elapsed of %zu ms configured delay. no need to sleep\n", elapsed.tv_sec * 1000 + elapsed.tv_usec / 1000, arguments.delay);
-            //}
+    // frames are held back in memory until a trigger writes them out
+    struct trigger trigger;
+    if (trigger_enabled(&arguments.trigger)) {
+        res = trigger_init(&trigger, &arguments.trigger);
+        if (res != 0) {
+            return res;
         }
+        client.trigger = &trigger;
+    }
 
-        gettimeofday(&now, NULL);
-        timersub(&now, &prev, &elapsed);
-
-        size_t elapsed_ms = elapsed.tv_sec * 1000 + elapsed.tv_usec / 1000;
-        prev = now;
+    struct smog_callbacks callbacks = { on_begin_frame, on_vma, on_end_frame, &client };
+    smog_set_callbacks(ctx, &callbacks);
 
-        // update VMAs from /proc/<pid>/maps
-        res = update_vmas(proc_maps, &vmas, &num_vmas, arguments.vma);
+    if (arguments.record) {
+        printf("Recording to:             %s\n", arguments.record);
+        res = smog_record(ctx, arguments.record);
         if (res != 0) {
-            fprintf(stderr, "%s: ", proc_maps);
-            perror("parse_vmas");
-            return 1;
+            return res;
         }
+    }
 
-        struct tm *ti = localtime(&now.tv_sec);
-        char time_buf[64] = { 0 };
-        strftime(time_buf, 64, "%F_%T", ti);
-
-        if (arguments.tracefile) {
-            uint32_t sec = now.tv_sec;
-            uint32_t usec = now.tv_usec;
-            write4(trace_fd, &sec);
-            write4(trace_fd, &usec);
-
-            uint32_t nvmas = num_vmas;
-            write4(trace_fd, &nvmas);
+    if (arguments.replay) {
+        res = smog_replay(ctx, arguments.replay);
+        if (res != 0) {
+            return res;
         }
-
-        if (arguments.verbose) {
-            printf("\n");
-            printf("%s.%06lu - Parsed %zu VMAs from %s:\n",
-                   time_buf, now.tv_usec, num_vmas, proc_maps);
-        } else {
-            printf("%s.%06lu - Parsed %zu VMAs from %s\n",
-                   time_buf, now.tv_usec, num_vmas, proc_maps);
+        printf("Monitored PID:            %d\n\n", smog_pid(ctx));
+    } else {
+        res = smog_attach(ctx, arguments.pid);
+        if (res != 0) {
+            return res;
         }
+    }
 
-        // walk pagemap for the aggregated regions
-        size_t total_reserved = 0;
-        size_t total_committed = 0;
-        size_t total_accessed = 0;
-        size_t total_softdirty = 0;
-
-        for (size_t i = 0; i < num_vmas; ++i) {
-            size_t start = vmas[i].start;
-            size_t end = vmas[i].end;
-
-            ssize_t len = end - start;
-            off_t off = start;
+    // the pages of the filtered VMAs are acted on once they stay cold
+    struct reclaim reclaim;
+    if (reclaim_enabled(&arguments.reclaim)) {
+        res = reclaim_init(&reclaim, &arguments.reclaim, smog_pid(ctx));
+        if (res != 0) {
+            return res;
+        }
+        client.reclaim = &reclaim;
+    }
 
-            uint64_t *pagemap = calloc(len, sizeof(*pagemap));
-            if (!pagemap) {
-                perror("calloc");
-                return 2;
-            }
-            ssize_t bytes = pread(pagemap_fd, pagemap,
-                                  sizeof(*pagemap) * len,
-                                  sizeof(*pagemap) * off);
-            if (bytes < 0) {
-                fprintf(stderr, "%s: ", proc_pagemap);
-                perror("pread");
-                return 1;
-            }
+    // the stacks of the threads are found among the anonymous VMAs
+    struct thread_stacks stacks;
+    if (arguments.track_stacks) {
+        res = thread_stacks_init(&stacks, smog_pid(ctx));
+        if (res != 0) {
+            return res;
+        }
+        client.stacks = &stacks;
+    }
 
-            if (bytes > 0 && (size_t)bytes < len * sizeof(*pagemap)) {
-                fprintf(stderr, "%s: partial read\n", proc_pagemap);
-                return 1;
-            }
+    if (arguments.checkpoint) {
+        res = smog_resume(ctx, arguments.checkpoint);
+        if (res == 0) {
+            printf("Resumed from:             %s\n", arguments.checkpoint);
+        } else if (res != SMOG_STALE_CHECKPOINT) {
+            return res;
+        }
+    }
+    gettimeofday(&client.prev, NULL);
 
-            vmas[i].committed = 0;
-            vmas[i].accessed = 0;
-            vmas[i].softdirty = 0;
-            for (size_t j = 0; j < (size_t)len; ++j) {
-                if (!(pagemap[j] & PM_PRESENT))
-                    continue;
+    size_t num_frames = 0;
+    size_t frames_since_checkpoint = 0;
 
-                vmas[i].committed++;
-
-                if (arguments.track_accessed) {
-                    // extract pageframe number from the pte
-                    size_t pfn_bit = pagemap[j] & PM_PFN_MASK;
-                    size_t pfn_word = pfn_bit / 64;
-                    uint64_t pfn_mask = 1ULL << (pfn_bit % 64);
-
-                    size_t map_bit = pfn_word / CHONK;
-                    size_t map_word = map_bit / 64;
-                    uint64_t map_mask = 1ULL << (map_bit % 64);
-
-                    // make sure the idle map has sufficient capacity
-                    if (map_word >= idle_map_capacity) {
-                        size_t new_capacity = map_word + 1;
-
-                        idle_map = realloc(idle_map, new_capacity * 8);
-
-                        if (!idle_map) {
-                            perror("realloc");
-                            return 2;
-                        }
-
-                        memset(idle_map + idle_map_capacity, 0,
-                               (new_capacity - idle_map_capacity) * 8);
-
-                        idle_map_capacity = new_capacity;
-                    }
-
-                    // make sure the pfn and idle caches have sufficient capacity
-                    if (pfn_word >= idle_cache_capacity) {
-                        size_t new_capacity = idle_map_capacity * 64 * CHONK;
-
-                        // printf("reallocating idle_cache to %zu bytes\n", pfn_index * 8);
-                        pfn_cache = realloc(pfn_cache, new_capacity * 8);
-                        idle_cache = realloc(idle_cache, new_capacity * 8);
-
-                        if (!pfn_cache || !idle_cache) {
-                            perror("realloc");
-                            return 2;
-                        }
-
-                        memset(pfn_cache + idle_cache_capacity, 0,
-                               (new_capacity - idle_cache_capacity) * 8);
-                        memset(idle_cache + idle_cache_capacity, 0,
-                               (new_capacity - idle_cache_capacity) * 8);
-
-                        idle_cache_capacity = new_capacity;
-                    }
-
-                    // mark the page in the pfn cache, used to clear idle bits later
-                    pfn_cache[pfn_word] |= pfn_mask;
-
-                    // read a chonk from the idle bitmap, if necessary
-                    if (!(idle_map[map_word] & map_mask)) {
-                        // printf("reading %zu bytes \n", CHONK * 64 * 8);
-                        ssize_t rbytes = pread(page_idle_fd,
-                                               idle_cache + map_bit * CHONK,
-                                               CHONK * 8,
-                                               map_bit * CHONK * 8);
-                        if (rbytes < 0) {
-                            fprintf(stderr, "/sys/kernel/mm/page_idle/bitmap: ");
-                            perror("pread");
-                            return 1;
-                        }
-                        if (rbytes < (ssize_t)CHONK * 8) {
-                            fprintf(stderr, "/sys/kernel/mm/page_idle/bitmap: partial read");
-                        }
-
-                        idle_map[map_word] |= map_mask;
-                    }
-
-                    // translate the idle map into an accessed bit
-                    pagemap[j] &= ~(PM_ACCESSED);
-                    // printf("%#zx\n", idle_cache[pfn_index]);
-                    if (!(idle_cache[pfn_word] & pfn_mask)) {
-                        pagemap[j] |= PM_ACCESSED;
-                    }
-                }
+    struct timeval now;
+    struct timeval delay = TIMEVAL_FROM_MILLIS(arguments.delay);
 
-                if (!arguments.track_softdirty) {
-                    pagemap[j] &= ~(PM_SOFT_DIRTY);
-                }
+    struct budget budget = { cpu_time_ms(), 0, arguments.delay };
 
-                if (pagemap[j] & PM_ACCESSED) {
-                    vmas[i].accessed++;
-                }
-                if (pagemap[j] & PM_SOFT_DIRTY) {
-                    vmas[i].softdirty++;
-                }
-            }
+    while (1) {
+        // recordings are replayed at full speed
+        if (!arguments.replay) {
+            // the sampling interval
+            gettimeofday(&now, NULL);
 
-            total_reserved += len;
-            total_committed += vmas[i].committed;
-            total_accessed += vmas[i].accessed;
-            total_softdirty += vmas[i].softdirty;
-
-            if (arguments.verbose
-                    && (size_t)len >= arguments.min_vma_reserved
-                    && vmas[i].committed >= arguments.min_vma_committed
-                    && (!arguments.track_accessed || vmas[i].accessed >= arguments.min_vma_accessed)
-                    && vmas[i].softdirty >= arguments.min_vma_dirty) {
-                printf("  VMA #%zu: %#zx ... %#zx %s\n",
-                       i, vmas[i].start, vmas[i].end, vmas[i].pathname);
-
-                double persec = vmas[i].softdirty * 1000.0 / elapsed_ms;
-                printf("    - Reserved:  %zu Pages, %s\n",
-                       len,
-                       format_size_string(len * g_system_pagesize));
-                printf("    - Committed: %zu Pages, %s\n",
-                       vmas[i].committed,
-                       format_size_string(vmas[i].committed * g_system_pagesize));
-                if (arguments.track_accessed) {
-                    printf("    - Accessed: %zu Pages, %s\n",
-                           vmas[i].accessed,
-                           format_size_string(vmas[i].accessed * g_system_pagesize));
-                }
-                if (arguments.track_softdirty) {
-                    printf("    - Softdirty: %zu Pages, %s in %zu ms (%.0f/s; %.2f%%)\n",
-                           vmas[i].softdirty,
-                           format_size_string(vmas[i].softdirty * g_system_pagesize),
-                           elapsed_ms, persec, 100.0 * vmas[i].softdirty / vmas[i].committed);
-                }
+            // determine elapsed time
+            struct timeval elapsed;
+            timersub(&now, &client.prev, &elapsed);
 
-                if (arguments.verbose >= 2) {
-                    for (size_t j = 0; j < (size_t)len; ++j) {
-                        if (!(pagemap[j] & PM_PRESENT)) {
-                            printf("_");
-                        } else if (arguments.track_accessed && (pagemap[j] & PM_ACCESSED)
-                                   && !(pagemap[j] & PM_SOFT_DIRTY)) {
-                            printf("\e[0;32m#\e[0m");
-                        } else if (arguments.track_accessed && !(pagemap[j] & PM_ACCESSED)
-                                   && (pagemap[j] & PM_SOFT_DIRTY)) {
-                            printf("\e[0;33m#\e[0m");
-                        } else if (arguments.track_softdirty && (pagemap[j] & PM_SOFT_DIRTY)) {
-                            printf("\e[0;31m#\e[0m");
-                        } else {
-                            printf("#");
-                        }
-                    }
-                    printf("\n");
-                }
-            }
+            // if less time elapsed than the configured delay, sleep the remainder
+            if (timercmp(&elapsed, &delay, <)) {
+                struct timeval remaining;
+                timersub(&delay, &elapsed, &remaining);
 
-            if (arguments.tracefile) {
-                uint64_t addr_start = start;
-                uint64_t addr_end = end;
-                write8(trace_fd, &addr_start);
-                write8(trace_fd, &addr_end);
-
-                uint32_t name_length = strlen(vmas[i].pathname) + 1;
-                write4(trace_fd, &name_length);
-                ssize_t bytes = write(trace_fd, vmas[i].pathname, name_length);
-                if (bytes < name_length) {
-                    fprintf(stderr, "%s: partial write\n", arguments.tracefile);
-                    return 1;
-                }
+                //if (arguments.verbose) {
+                    printf("+++%zu ms elapsed of %zu ms configured delay. sleeping %zu ms\n", elapsed.tv_sec * 1000 + elapsed.tv_usec / 1000, delay.tv_sec * 1000 + delay.tv_usec / 1000, remaining.tv_sec * 1000 + remaining.tv_usec / 1000);
+                //}
 
-                uint32_t flags = 0;
-                size_t index = 0;
-                for (size_t j = 0; j < (size_t)len; ++j) {
-                    // tracefile is encoded as:
-                    //   00 not present
-                    //   01 idle
-                    //   10 accessed
-                    //   11 softdirty
-                    //
-                    // this loses some information where pages are dirty but
-                    // not accessed, but given that these are caused by
-                    // imprecise measurements and time drifting, it's probalby
-                    // okay. still, as usual, here be dragons.
-
-                    int v;
-                    if (!(pagemap[j] & PM_PRESENT)) {
-                        v = 0x0;
-                    } else if (arguments.track_accessed && (pagemap[j] & PM_ACCESSED)
-                               && !(pagemap[j] & PM_SOFT_DIRTY)) {
-                        v = 0x2;
-                    } else if (pagemap[j] & PM_SOFT_DIRTY) {
-                        v = 0x3;
-                    } else {
-                        v = 0x1;
-                    }
-
-                    flags |= v << index;
-                    index += 2;
-
-                    if (index >= 32 || j == (size_t)len - 1) {
-                        write4(trace_fd, &flags);
-                        flags = 0;
-                        index = 0;
-                    }
-                }
+                struct timespec delay_ts = TIMEVAL_TO_TIMESPEC(remaining);
 
-                int res = fsync(trace_fd);
+                res = nanosleep(&delay_ts, NULL);
                 if (res != 0) {
-                    fprintf(stderr, "%s: ", arguments.tracefile);
-                    perror("fsync");
+                    perror("nanosleep");
+                    return res;
                 }
+            } else {
+                //if (arguments.verbose) {
+                    printf("+++%zu ms elapsed of %zu ms configured delay. no need to sleep\n", elapsed.tv_sec * 1000 + elapsed.tv_usec / 1000, delay.tv_sec * 1000 + delay.tv_usec / 1000);
+                //}
             }
+        }
 
-            free(pagemap);
+        // take a frame, reporting and tracing each VMA as it is scanned
+        res = smog_scan(ctx);
+        if (res == SMOG_END_OF_REPLAY) {
+            break;
+        }
+        if (res != 0) {
+            return res;
         }
 
-        double persec = total_softdirty * 1000.0 / elapsed_ms;
-        printf("Reserved:  %zu Pages, %s\n",
-               total_reserved,
-               format_size_string(total_reserved * g_system_pagesize));
-        printf("Committed: %zu Pages, %s\n",
-               total_committed,
-               format_size_string(total_committed * g_system_pagesize));
-        if (arguments.track_accessed) {
-            printf("Accessed: %zu Pages, %s\n",
-                   total_accessed,
-                   format_size_string(total_accessed * g_system_pagesize));
+        if (arguments.cpu_budget) {
+            res = adapt_to_budget(ctx, &config, &budget, smog_last_frame(ctx));
+            if (res != 0) {
+                return res;
+            }
+            struct timeval adapted = TIMEVAL_FROM_MILLIS(budget.delay);
+            delay = adapted;
         }
-        if (arguments.track_softdirty) {
-            printf("Softdirty: %zu Pages, %s in %zu ms (%.0f/s; %.2f%%)\n",
-                   total_softdirty,
-                   format_size_string(total_softdirty * g_system_pagesize),
-                   elapsed_ms, persec, 100.0 * total_softdirty / total_committed);
+
+        if (client.trigger) {
+            struct timeval interval = TIMEVAL_FROM_MILLIS(trigger_interval(&trigger, arguments.delay));
+            delay = interval;
         }
 
-        if (arguments.verbose) {
-            for (size_t i = 0; i < num_vmas; ++i) {
-                if (vmas[i].committed && vmas[i].softdirty >= vmas[i].committed) {
-                    fprintf(stderr, "warning: VMA #%zu: maxed out dirty pages!\n", i);
-                }
+        if (arguments.checkpoint && ++frames_since_checkpoint >= arguments.checkpoint_frames) {
+            res = smog_checkpoint(ctx, arguments.checkpoint);
+            if (res != 0) {
+                return res;
             }
+            frames_since_checkpoint = 0;
         }
 
         if (arguments.frames && ++num_frames >= arguments.frames)
             break;
     }
 
+    // the state as of the last frame
+    if (arguments.checkpoint && frames_since_checkpoint) {
+        res = smog_checkpoint(ctx, arguments.checkpoint);
+        if (res != 0) {
+            return res;
+        }
+    }
+
+    if (arguments.rolling) {
+        report_summary(ctx);
+    }
+
+    smog_destroy(ctx);
+    free(window_frames);
+    if (arguments.track_page_cache) {
+        page_cache_destroy(&page_cache);
+    }
+    if (client.trigger) {
+        trigger_destroy(&trigger);
+    }
+    if (client.reclaim) {
+        reclaim_destroy(&reclaim);
+    }
+    if (client.stacks) {
+        thread_stacks_destroy(&stacks);
+    }
+    free(client.proc_maps);
     close(trace_fd);
 
     return 0;
@@ -9,14 +9,23 @@
 #include <sys/types.h>
 #include <stdint.h>
 
+#include "./reclaim.h"
+#include "./trigger.h"
+
 struct arguments {
     pid_t pid;
     int self_map;
     int verbose;
+    size_t heatmap_width;
     uint64_t delay;
     uint64_t frames;
     int track_accessed;
     int track_softdirty;
+    int track_numa;
+    int skip_unpopulated;
+    int track_page_cache;
+    int track_process;
+    int track_schedstat;
 
     size_t min_vma_reserved;
     size_t min_vma_committed;
@@ -25,12 +34,39 @@ struct arguments {
 
     char *tracefile;
     char *vma;
+    char *filter;
+    char *daemon;
+    char *record;
+    char *replay;
+
+    // block sizes in pages
+    size_t num_granularities;
+    size_t *granularities;
+
+    // window lengths in milliseconds
+    size_t num_windows;
+    size_t *windows;
+
+    // the share of a core in percent the meter may use, or 0
+    double cpu_budget;
+
+    // the horizon of the rolling statistics in milliseconds, or 0
+    size_t rolling;
+
+    // the conditions of a high-resolution burst, if any
+    struct trigger_config trigger;
+
+    // the action on pages that stay cold, if any
+    struct reclaim_config reclaim;
+
+    // the file to checkpoint the state to, and the frames between checkpoints
+    char *checkpoint;
+    size_t checkpoint_frames;
+
+    // attribute the pages of thread stacks to their threads
+    int track_stacks;
 };
 
 extern struct arguments arguments;
 
-// globals
-extern size_t g_system_pagesize;
-extern size_t g_system_physical_pages;
-
 #endif  // SMOG_METER_H_
@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#include "./smogmeter.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./checkpoint.h"
+#include "./filter.h"
+#include "./numa.h"
+#include "./target.h"
+#include "./util.h"
+
+struct smog_ctx {
+    struct smog_config config;
+    struct smog_callbacks callbacks;
+
+    // compiled from config.vma_filter
+    struct vma_filter filter;
+    int has_filter;
+
+    struct target target;
+    int attached;
+    int has_frame;
+
+    // where to record the next attached process to, if anywhere
+    char *recording;
+};
+
+// validate a list of sizes, which have to be positive
+static int check_sizes(const char *what, const size_t *sizes, size_t n) {
+    for (size_t k = 0; k < n; ++k) {
+        if (!sizes[k]) {
+            fprintf(stderr, "invalid %s of 0\n", what);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static size_t *copy_sizes(const size_t *sizes, size_t n) {
+    size_t *copy = malloc(n * sizeof(*copy));
+    if (!copy) {
+        perror("malloc");
+        return NULL;
+    }
+    memcpy(copy, sizes, n * sizeof(*copy));
+    return copy;
+}
+
+static int set_config(struct smog_ctx *ctx, const struct smog_config *config) {
+    int res = check_sizes("granularity", config->granularities, config->num_granularities);
+    if (res == 0)
+        res = check_sizes("window length", config->windows, config->num_windows);
+    if (res != 0)
+        return res;
+
+    if (config->track_numa && ctx->attached && ctx->target.io.mode == PROCFS_REPLAY) {
+        fprintf(stderr, "NUMA tracking is not available when replaying\n");
+        return 1;
+    }
+
+    if (config->track_numa && !g_numa_nodes) {
+        res = numa_init();
+        if (res != 0)
+            return res;
+    }
+
+    struct vma_filter filter;
+    if (config->vma_filter) {
+        res = filter_compile(&filter, config->vma_filter);
+        if (res != 0)
+            return res;
+    }
+
+    char *vma_filter = NULL;
+    size_t *granularities = NULL;
+    size_t *windows = NULL;
+    if (config->vma_filter) {
+        vma_filter = strdup(config->vma_filter);
+        if (!vma_filter)
+            perror("strdup");
+    }
+    if (config->num_granularities)
+        granularities = copy_sizes(config->granularities, config->num_granularities);
+    if (config->num_windows)
+        windows = copy_sizes(config->windows, config->num_windows);
+    if ((config->vma_filter && !vma_filter)
+            || (config->num_granularities && !granularities)
+            || (config->num_windows && !windows)) {
+        free(vma_filter);
+        free(granularities);
+        free(windows);
+        if (config->vma_filter)
+            filter_destroy(&filter);
+        return 2;
+    }
+
+    if (ctx->has_filter)
+        filter_destroy(&ctx->filter);
+    ctx->has_filter = config->vma_filter != NULL;
+    if (ctx->has_filter)
+        ctx->filter = filter;
+
+    free((char*)ctx->config.vma_filter);
+    free((size_t*)ctx->config.granularities);
+    free((size_t*)ctx->config.windows);
+    ctx->config = *config;
+    ctx->config.vma_filter = vma_filter;
+    ctx->config.granularities = granularities;
+    ctx->config.windows = windows;
+
+    if (ctx->attached) {
+        ctx->target.config = ctx->config;
+        ctx->target.filter = ctx->has_filter ? &ctx->filter : NULL;
+    }
+
+    return 0;
+}
+
+struct smog_ctx *smog_create(const struct smog_config *config) {
+    if (!g_system_pagesize)
+        detect_system();
+
+    struct smog_ctx *ctx = calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        perror("calloc");
+        return NULL;
+    }
+
+    if (set_config(ctx, config) != 0) {
+        free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+int smog_configure(struct smog_ctx *ctx, const struct smog_config *config) {
+    return set_config(ctx, config);
+}
+
+void smog_set_callbacks(struct smog_ctx *ctx, const struct smog_callbacks *callbacks) {
+    ctx->callbacks = *callbacks;
+}
+
+static int attach(struct smog_ctx *ctx, pid_t pid, enum procfs_mode mode, const char *recording) {
+    if (ctx->attached) {
+        target_destroy(&ctx->target);
+        ctx->attached = 0;
+        ctx->has_frame = 0;
+    }
+
+    int res = target_init(&ctx->target, pid, &ctx->config, mode, recording);
+    if (res == 0)
+        res = target_reset(&ctx->target);
+    if (res != 0) {
+        target_destroy(&ctx->target);
+        return res;
+    }
+
+    ctx->target.filter = ctx->has_filter ? &ctx->filter : NULL;
+    ctx->attached = 1;
+    return 0;
+}
+
+int smog_attach(struct smog_ctx *ctx, pid_t pid) {
+    if (ctx->recording)
+        return attach(ctx, pid, PROCFS_RECORD, ctx->recording);
+    return attach(ctx, pid, PROCFS_LIVE, NULL);
+}
+
+int smog_record(struct smog_ctx *ctx, const char *path) {
+    char *recording = NULL;
+    if (path) {
+        recording = strdup(path);
+        if (!recording) {
+            perror("strdup");
+            return 2;
+        }
+    }
+
+    free(ctx->recording);
+    ctx->recording = recording;
+    return 0;
+}
+
+int smog_replay(struct smog_ctx *ctx, const char *path) {
+    if (ctx->config.track_numa) {
+        fprintf(stderr, "NUMA tracking is not available when replaying\n");
+        return 1;
+    }
+
+    return attach(ctx, 0, PROCFS_REPLAY, path);
+}
+
+pid_t smog_pid(const struct smog_ctx *ctx) {
+    return ctx->target.pid;
+}
+
+int smog_checkpoint(const struct smog_ctx *ctx, const char *path) {
+    if (!ctx->attached) {
+        fprintf(stderr, "smog_checkpoint: no process attached\n");
+        return 1;
+    }
+    return checkpoint_write(&ctx->target, path);
+}
+
+int smog_resume(struct smog_ctx *ctx, const char *path) {
+    if (!ctx->attached) {
+        fprintf(stderr, "smog_resume: no process attached\n");
+        return 1;
+    }
+    return checkpoint_restore(&ctx->target, path);
+}
+
+static int forward_vma(struct target *t, size_t index, const uint64_t *pagemap, void *arg) {
+    struct smog_ctx *ctx = arg;
+    return ctx->callbacks.vma(ctx, &t->frame, index, pagemap, ctx->callbacks.arg);
+}
+
+// running out of a replayed recording ends it, even in the middle of a frame
+static int scan_result(struct smog_ctx *ctx, int res) {
+    if (res != 0 && ctx->target.io.end)
+        return SMOG_END_OF_REPLAY;
+    return res;
+}
+
+int smog_scan(struct smog_ctx *ctx) {
+    if (!ctx->attached) {
+        fprintf(stderr, "smog_scan: no process attached\n");
+        return 1;
+    }
+
+    struct target *t = &ctx->target;
+
+    // a replay that ran out between frames keeps its last one
+    if (procfs_replay_done(&t->io))
+        return SMOG_END_OF_REPLAY;
+
+    ctx->has_frame = 0;
+
+    int res = target_update(t);
+    if (res != 0)
+        return scan_result(ctx, res);
+
+    if (ctx->callbacks.begin_frame) {
+        res = ctx->callbacks.begin_frame(ctx, &t->frame, ctx->callbacks.arg);
+        if (res != 0)
+            return res;
+    }
+
+    res = target_scan(t, ctx->callbacks.vma ? forward_vma : NULL, ctx);
+    if (res != 0)
+        return scan_result(ctx, res);
+
+    ctx->has_frame = 1;
+
+    if (ctx->callbacks.end_frame) {
+        res = ctx->callbacks.end_frame(ctx, &t->frame, ctx->callbacks.arg);
+        if (res != 0)
+            return res;
+    }
+
+    // start the measurement period of the next frame
+    return scan_result(ctx, target_reset(t));
+}
+
+const struct smog_frame *smog_last_frame(const struct smog_ctx *ctx) {
+    return ctx->has_frame ? &ctx->target.frame : NULL;
+}
+
+const char *smog_vma_pathname(const struct smog_ctx *ctx, size_t index) {
+    return ctx->target.vmas.info[index].pathname;
+}
+
+const struct smog_node_counters *smog_vma_nodes(const struct smog_ctx *ctx, size_t index) {
+    if (!ctx->config.track_numa)
+        return NULL;
+    return ctx->target.vmas.info[index].nodes;
+}
+
+const struct smog_block_counters *smog_vma_blocks(const struct smog_ctx *ctx, size_t index) {
+    if (!ctx->target.num_granularities)
+        return NULL;
+    return ctx->target.vmas.info[index].blocks;
+}
+
+const struct smog_run_stats *smog_vma_runs(const struct smog_ctx *ctx, size_t index) {
+    return &ctx->target.vmas.info[index].runs;
+}
+
+const struct smog_churn *smog_vma_churn(const struct smog_ctx *ctx, size_t index) {
+    return &ctx->target.vmas.info[index].churn;
+}
+
+const struct smog_window_counters *smog_vma_windows(const struct smog_ctx *ctx, size_t index) {
+    if (!ctx->target.num_windows)
+        return NULL;
+    return ctx->target.vmas.info[index].windows;
+}
+
+const struct smog_vma_times *smog_vma_times(const struct smog_ctx *ctx, size_t index) {
+    return &ctx->target.vmas.info[index].times;
+}
+
+const struct smog_rolling_stats *smog_vma_rolling(const struct smog_ctx *ctx, size_t index) {
+    const struct rolling *r = ctx->target.vmas.info[index].rolling;
+    return r ? &r->stats[0] : NULL;
+}
+
+const struct smog_rolling_stats *smog_vma_rolling_total(const struct smog_ctx *ctx, size_t index) {
+    const struct rolling *r = ctx->target.vmas.info[index].rolling;
+    return r ? &r->stats[1] : NULL;
+}
+
+void smog_destroy(struct smog_ctx *ctx) {
+    if (!ctx)
+        return;
+
+    if (ctx->attached)
+        target_destroy(&ctx->target);
+    free((char*)ctx->config.vma_filter);
+    free((size_t*)ctx->config.granularities);
+    free((size_t*)ctx->config.windows);
+    if (ctx->has_filter)
+        filter_destroy(&ctx->filter);
+    free(ctx->recording);
+    free(ctx);
+}
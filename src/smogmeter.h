@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+// libsmogmeter, the scan engine of smog-meter for use in other programs.
+//
+// a context monitors a single process. every call to smog_scan() takes a
+// frame: it refreshes the VMAs of the process, classifies their pages as
+// present, accessed and softdirty since the previous frame, and passes the
+// results to the registered callbacks. the views handed to the callbacks
+// point into the context and are valid until the next call to smog_scan().
+
+#ifndef SMOGMETER_H_
+#define SMOGMETER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+// page state bits in the pagemap arrays passed to smog_vma_callback
+#define SMOG_PAGE_PRESENT (1ULL << 63)
+#define SMOG_PAGE_SOFTDIRTY (1ULL << 55)
+#define SMOG_PAGE_ACCESSED (1ULL << 57)
+
+// returned by smog_scan() once a replayed recording is exhausted
+#define SMOG_END_OF_REPLAY (-1)
+
+// returned by smog_resume() if there is no checkpoint of the process
+#define SMOG_STALE_CHECKPOINT (-2)
+
+struct smog_config {
+    int track_accessed;
+    int track_softdirty;
+    int track_numa;
+    int skip_unpopulated;
+
+    // only monitor the VMAs selected by this filter, if set. it is a
+    // comma-separated list of terms, which are pathname globs to include,
+    // globs prefixed with '!' to exclude, and perms=MASK, anon, file,
+    // addr=START-END and min=SIZE. VMAs left out are never read.
+    const char *vma_filter;
+
+    // log changes to the VMAs of the process to stdout
+    int verbose;
+
+    // block sizes in pages to aggregate accessed and softdirty pages to,
+    // with blocks aligned to their size in the address space
+    size_t num_granularities;
+    const size_t *granularities;
+
+    // window lengths in frames to accumulate accessed and softdirty pages
+    // over, so a page counts once per window however often it is touched
+    size_t num_windows;
+    const size_t *windows;
+
+    // read the faults and CPU time of the process every frame, and its
+    // scheduler statistics as well if track_schedstat is set
+    int track_process;
+    int track_schedstat;
+
+    // the horizon in frames to keep rolling statistics of the dirty rate
+    // and working set of every VMA over, or 0
+    size_t rolling_horizon;
+};
+
+struct smog_node_counters {
+    size_t committed;
+    size_t accessed;
+    size_t softdirty;
+};
+
+// the blocks of a granularity holding at least one accessed or softdirty page
+struct smog_block_counters {
+    size_t accessed;
+    size_t softdirty;
+};
+
+// runs of contiguous softdirty pages, a run ends at the first page that is
+// not softdirty or at the end of a VMA
+struct smog_run_stats {
+    size_t runs;
+    size_t longest;
+};
+
+// the pages accessed or softdirty in any frame of a window
+struct smog_window_counters {
+    size_t accessed;
+    size_t softdirty;
+};
+
+struct smog_window {
+    // the configured length and the frames accumulated so far, the window
+    // is complete once they are equal and starts over with the next frame
+    size_t length;
+    size_t frames;
+    size_t elapsed_ms;
+
+    // totals over the current VMAs
+    struct smog_window_counters totals;
+};
+
+// the pages that changed state since the previous frame
+struct smog_churn {
+    // became present, or are no longer
+    size_t committed;
+    size_t freed;
+
+    // became accessed or softdirty, or are no longer
+    size_t heated;
+    size_t cooled;
+};
+
+// the resources used by the process since the previous frame, which
+// include the faults and CPU time induced by clearing softdirty and idle bits
+struct smog_process_stats {
+    size_t minflt;
+    size_t majflt;
+    size_t utime_ms;
+    size_t stime_ms;
+
+    // from schedstat, if tracked
+    uint64_t run_ns;
+    uint64_t wait_ns;
+    uint64_t timeslices;
+};
+
+// streaming statistics of a VMA or the process over the rolling horizon or
+// the whole run, in constant memory. percentiles are exact to within 1/16.
+struct smog_rolling_stats {
+    size_t frames;
+
+    // the softdirty pages per second: smoothed over about the horizon, its
+    // median, 99th percentile and maximum
+    double ewma_rate;
+    double p50_rate;
+    double p99_rate;
+    double max_rate;
+
+    // the most pages accessed in a frame if tracked, else committed
+    size_t peak_working_set;
+};
+
+// when the pages of a VMA were read, from before its pagemap is read until
+// they are classified, and the time they were counted over: from the last
+// reset of the softdirty and idle bits to the middle of the read. VMAs that
+// were skipped take the time of the previous read.
+struct smog_vma_times {
+    struct timeval scan_start;
+    struct timeval scan_end;
+    size_t window_us;
+};
+
+// the meter's own cost of taking a frame
+struct smog_scan_stats {
+    size_t vmas_read;
+    size_t vmas_skipped;
+
+    // bytes of pagemap read, and avoided by skipping VMAs
+    size_t pagemap_read;
+    size_t pagemap_skipped;
+
+    struct timeval scan_time;
+
+    // from the start of the first read of a VMA to the end of the last, by
+    // which the VMAs of a frame are not a consistent snapshot
+    struct timeval skew;
+};
+
+struct smog_frame {
+    pid_t pid;
+    struct timeval timestamp;
+    size_t elapsed_ms;
+
+    // totals over all VMAs in pages, complete once the frame is finished
+    size_t reserved;
+    size_t committed;
+    size_t accessed;
+    size_t softdirty;
+
+    // per-node totals when NUMA tracking is enabled, indexed by node id
+    size_t num_nodes;
+    struct smog_node_counters *nodes;
+
+    // totals over all VMAs, starting with the second frame
+    struct smog_churn churn;
+
+    // totals per configured granularity, in the order of the configuration.
+    // a block spanning two VMAs is counted once for each of them.
+    size_t num_granularities;
+    const size_t *granularities;
+    struct smog_block_counters *blocks;
+
+    // totals of the runs of all VMAs, and the longest of them
+    struct smog_run_stats runs;
+
+    // the windows in the order of the configuration
+    size_t num_windows;
+    struct smog_window *windows;
+
+    // when tracking the process
+    struct smog_process_stats process;
+
+    // of the totals, over the rolling horizon and the run if configured
+    struct smog_rolling_stats rolling;
+    struct smog_rolling_stats rolling_total;
+
+    struct smog_scan_stats stats;
+
+    // per-VMA columns, with addresses in pages
+    size_t num_vmas;
+    const size_t *vma_start;
+    const size_t *vma_end;
+    const size_t *vma_committed;
+    const size_t *vma_accessed;
+    const size_t *vma_softdirty;
+};
+
+struct smog_ctx;
+
+// called once the VMAs of a frame are known, and once it is complete
+typedef int (*smog_frame_callback)(struct smog_ctx *ctx, const struct smog_frame *frame,
+                                   void *arg);
+
+// called for every VMA once its pages are classified. pagemap holds one
+// entry per page, or is NULL if the VMA was skipped for having no pages.
+typedef int (*smog_vma_callback)(struct smog_ctx *ctx, const struct smog_frame *frame,
+                                 size_t index, const uint64_t *pagemap, void *arg);
+
+struct smog_callbacks {
+    smog_frame_callback begin_frame;
+    smog_vma_callback vma;
+    smog_frame_callback end_frame;
+    void *arg;
+};
+
+struct smog_ctx *smog_create(const struct smog_config *config);
+
+// change the configuration, effective with the next frame
+int smog_configure(struct smog_ctx *ctx, const struct smog_config *config);
+
+void smog_set_callbacks(struct smog_ctx *ctx, const struct smog_callbacks *callbacks);
+
+// start monitoring a process. the first frame measures from here.
+int smog_attach(struct smog_ctx *ctx, pid_t pid);
+
+// record the procfs and sysfs traffic of the processes attached from now on
+// to a file, or stop recording if path is NULL
+int smog_record(struct smog_ctx *ctx, const char *path);
+
+// attach to a recording instead of a live process. its frames are replayed
+// as fast as smog_scan() is called, which requires the tracking options the
+// recording was taken with. NUMA tracking is not available.
+int smog_replay(struct smog_ctx *ctx, const char *path);
+
+// the monitored process, as taken from the recording when replaying
+pid_t smog_pid(const struct smog_ctx *ctx);
+
+// write the state of the monitored process to a file: its VMAs with the
+// page states of the last frame, the windows and the rolling statistics.
+// the file replaces the previous checkpoint atomically.
+int smog_checkpoint(const struct smog_ctx *ctx, const char *path);
+
+// resume from a checkpoint right after smog_attach(), so that the first
+// frame continues where the checkpoint left off. it has to be of the same
+// process, as told by its pid and start time, or SMOG_STALE_CHECKPOINT is
+// returned and the context is unchanged. windows and rolling statistics
+// whose configuration changed since are not resumed. not available when
+// replaying.
+int smog_resume(struct smog_ctx *ctx, const char *path);
+
+// take a frame and start the measurement period of the next one. a non-zero
+// return value of a callback aborts the frame and is returned.
+int smog_scan(struct smog_ctx *ctx);
+
+// the most recent frame, or NULL if none was taken yet. it is kept once a
+// replay ended, unless the recording stopped in the middle of a frame.
+const struct smog_frame *smog_last_frame(const struct smog_ctx *ctx);
+
+const char *smog_vma_pathname(const struct smog_ctx *ctx, size_t index);
+
+// the per-node counters of a VMA, or NULL if NUMA tracking is disabled
+const struct smog_node_counters *smog_vma_nodes(const struct smog_ctx *ctx, size_t index);
+
+// the per-granularity counters of a VMA, or NULL if no granularities are
+// configured or the VMA was not read yet
+const struct smog_block_counters *smog_vma_blocks(const struct smog_ctx *ctx, size_t index);
+
+const struct smog_run_stats *smog_vma_runs(const struct smog_ctx *ctx, size_t index);
+
+const struct smog_churn *smog_vma_churn(const struct smog_ctx *ctx, size_t index);
+
+const struct smog_vma_times *smog_vma_times(const struct smog_ctx *ctx, size_t index);
+
+// the per-window counters of a VMA, or NULL if no windows are configured
+const struct smog_window_counters *smog_vma_windows(const struct smog_ctx *ctx, size_t index);
+
+// the rolling statistics of a VMA over the horizon and over the time it
+// was monitored, or NULL if no horizon is configured
+const struct smog_rolling_stats *smog_vma_rolling(const struct smog_ctx *ctx, size_t index);
+const struct smog_rolling_stats *smog_vma_rolling_total(const struct smog_ctx *ctx, size_t index);
+
+void smog_destroy(struct smog_ctx *ctx);
+
+#endif  // SMOGMETER_H_
@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#include "./stacks.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "./util.h"
+
+static int grow(void **buf, size_t *capacity, size_t n, size_t size) {
+    if (n <= *capacity)
+        return 0;
+
+    size_t new_capacity = *capacity ? *capacity * 2 : 64;
+    while (new_capacity < n)
+        new_capacity *= 2;
+
+    void *new_buf = realloc(*buf, new_capacity * size);
+    if (!new_buf) {
+        perror("realloc");
+        return 2;
+    }
+    *buf = new_buf;
+    *capacity = new_capacity;
+    return 0;
+}
+
+// read a file of the task of a thread into buf as a string, returning its
+// length, or -1 with errno set
+static ssize_t read_task_file(struct thread_stacks *ts, pid_t tid, const char *file,
+                              char *buf, size_t size) {
+    char path[128];
+    snprintf(path, sizeof(path), "%s/%d/%s", ts->task_path, tid, file);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    ssize_t len = read(fd, buf, size - 1);
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    if (len < 0)
+        return -1;
+
+    ts->reads++;
+    buf[len] = '\0';
+    return len;
+}
+
+// the stack pointer of a thread blocked in the kernel, which syscall shows as
+// the second to last field. running threads have none.
+static size_t read_syscall_sp(struct thread_stacks *ts, pid_t tid) {
+    char buf[256];
+    if (read_task_file(ts, tid, "syscall", buf, sizeof(buf)) < 0 || !strncmp(buf, "running", 7))
+        return 0;
+
+    size_t fields[9];
+    size_t n = 0;
+    char *end = buf;
+    while (n < 9) {
+        char *field = end;
+        errno = 0;
+        fields[n] = strtoull(field, &end, 0);
+        if (errno != 0 || end == field)
+            break;
+        n++;
+    }
+    return n >= 3 ? fields[n - 2] : 0;
+}
+
+// read the name of a thread and the page of its stack, if it is known. the
+// stack pointer in stat is only shown for threads being dumped, and the
+// start of the stack is that of the main thread, so for the others the
+// stack pointer is taken from syscall. returns 1 if the thread is gone.
+static int read_thread(struct thread_stacks *ts, struct thread_stack *thread) {
+    char line[1024];
+    if (read_task_file(ts, thread->tid, "stat", line, sizeof(line)) < 0)
+        return 1;
+
+    // the name may contain spaces and parentheses, so the fields are
+    // counted from the last closing one
+    char *open = strchr(line, '(');
+    char *close = strrchr(line, ')');
+    unsigned long long startstack, kstkesp;
+    if (!open || !close || close < open
+            || sscanf(close + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u"
+                      " %*d %*d %*d %*d %*d %*d %*u %*u %*d %*u %*u %*u %llu %llu",
+                      &startstack, &kstkesp) != 2)
+        return 1;
+
+    size_t name_len = close - open - 1;
+    if (name_len >= THREAD_NAME_LEN)
+        name_len = THREAD_NAME_LEN - 1;
+    memcpy(thread->name, open + 1, name_len);
+    thread->name[name_len] = '\0';
+
+    size_t sp = kstkesp;
+    if (!sp && thread->tid == ts->pid)
+        sp = startstack;
+    if (!sp)
+        sp = read_syscall_sp(ts, thread->tid);
+    thread->page = sp / g_system_pagesize;
+    return 0;
+}
+
+static int compare_tids(const void *a, const void *b) {
+    pid_t x = *(const pid_t*)a;
+    pid_t y = *(const pid_t*)b;
+    return (x > y) - (x < y);
+}
+
+// the tids of the task directory, in order
+static int list_tids(struct thread_stacks *ts, size_t *num_tids) {
+    DIR *dir = opendir(ts->task_path);
+    if (!dir) {
+        fprintf(stderr, "%s: ", ts->task_path);
+        perror("opendir");
+        return 1;
+    }
+
+    size_t n = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        char *end;
+        long tid = strtol(entry->d_name, &end, 10);
+        if (end == entry->d_name || *end)
+            continue;
+
+        int res = grow((void**)&ts->tids, &ts->tids_capacity, n + 1, sizeof(*ts->tids));
+        if (res != 0) {
+            closedir(dir);
+            return res;
+        }
+        ts->tids[n++] = tid;
+    }
+    closedir(dir);
+
+    qsort(ts->tids, n, sizeof(*ts->tids), compare_tids);
+    *num_tids = n;
+    return 0;
+}
+
+// the VMA of the frame holding a page, or SIZE_MAX
+static size_t find_vma(const struct smog_frame *frame, size_t page) {
+    size_t lo = 0;
+    size_t hi = frame->num_vmas;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (frame->vma_end[mid] <= page)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < frame->num_vmas && frame->vma_start[lo] <= page ? lo : SIZE_MAX;
+}
+
+int thread_stacks_init(struct thread_stacks *ts, pid_t pid) {
+    memset(ts, 0, sizeof(*ts));
+    ts->pid = pid;
+    ts->task_path = makestr("/proc/%d/task", pid);
+    if (!ts->task_path) {
+        perror("makestr");
+        return 2;
+    }
+    return 0;
+}
+
+int thread_stacks_begin_frame(struct thread_stacks *ts, const struct smog_frame *frame) {
+    size_t num_tids;
+    int res = list_tids(ts, &num_tids);
+    if (res != 0)
+        return res;
+
+    struct thread_stack *prev = ts->threads;
+    size_t prev_len = ts->len;
+    size_t prev_capacity = ts->capacity;
+    ts->threads = ts->prev;
+    ts->capacity = ts->prev_capacity;
+    ts->prev = prev;
+    ts->prev_capacity = prev_capacity;
+    ts->len = 0;
+
+    res = grow((void**)&ts->threads, &ts->capacity, num_tids, sizeof(*ts->threads));
+    if (res != 0)
+        return res;
+
+    // both lists are ordered, threads that stay are taken over and only the
+    // new ones are read
+    size_t p = 0;
+    for (size_t k = 0; k < num_tids; ++k) {
+        pid_t tid = ts->tids[k];
+        while (p < prev_len && prev[p].tid < tid)
+            p++;
+
+        struct thread_stack *thread = &ts->threads[ts->len];
+        if (p < prev_len && prev[p].tid == tid) {
+            *thread = prev[p];
+            if (!thread->page)
+                thread->page = read_syscall_sp(ts, tid) / g_system_pagesize;
+        } else {
+            memset(thread, 0, sizeof(*thread));
+            thread->tid = tid;
+            if (read_thread(ts, thread) != 0)
+                continue;
+        }
+        ts->len++;
+    }
+
+    res = grow((void**)&ts->by_vma, &ts->by_vma_capacity, frame->num_vmas, sizeof(*ts->by_vma));
+    if (res != 0)
+        return res;
+    for (size_t i = 0; i < frame->num_vmas; ++i)
+        ts->by_vma[i] = SIZE_MAX;
+
+    for (size_t k = 0; k < ts->len; ++k) {
+        struct thread_stack *thread = &ts->threads[k];
+        thread->vma = thread->page ? find_vma(frame, thread->page) : SIZE_MAX;
+        if (thread->vma != SIZE_MAX && ts->by_vma[thread->vma] == SIZE_MAX)
+            ts->by_vma[thread->vma] = k;
+    }
+
+    return 0;
+}
+
+const struct thread_stack *thread_stacks_find(const struct thread_stacks *ts, size_t index) {
+    size_t k = ts->by_vma[index];
+    return k != SIZE_MAX ? &ts->threads[k] : NULL;
+}
+
+void thread_stacks_end_frame(const struct thread_stacks *ts, const struct smog_frame *frame,
+                             int track_accessed, int track_softdirty) {
+    size_t found = 0;
+    size_t committed = 0;
+    size_t accessed = 0;
+    size_t softdirty = 0;
+    for (size_t k = 0; k < ts->len; ++k) {
+        size_t i = ts->threads[k].vma;
+        if (i == SIZE_MAX)
+            continue;
+        found++;
+        committed += frame->vma_committed[i];
+        accessed += frame->vma_accessed[i];
+        softdirty += frame->vma_softdirty[i];
+    }
+
+    printf("Stacks:    %zu of %zu threads, %zu Pages committed (%s)",
+           found, ts->len, committed, format_size_string(committed * g_system_pagesize));
+    if (track_accessed) {
+        printf(", %zu accessed", accessed);
+    }
+    if (track_softdirty) {
+        printf(", %zu softdirty (%.0f/s)", softdirty, softdirty * 1000.0 / frame->elapsed_ms);
+    }
+    printf("; %zu thread files read in total\n", ts->reads);
+
+    for (size_t k = 0; k < ts->len; ++k) {
+        const struct thread_stack *thread = &ts->threads[k];
+        size_t i = thread->vma;
+        if (i == SIZE_MAX)
+            continue;
+
+        printf("  - Thread %d (%s): VMA #%zu, %zu Pages committed (%s)", thread->tid,
+               thread->name, i, frame->vma_committed[i],
+               format_size_string(frame->vma_committed[i] * g_system_pagesize));
+        if (track_accessed) {
+            printf(", %zu accessed", frame->vma_accessed[i]);
+        }
+        if (track_softdirty) {
+            printf(", %zu softdirty (%.0f/s)", frame->vma_softdirty[i],
+                   frame->vma_softdirty[i] * 1000.0 / frame->elapsed_ms);
+        }
+        printf("\n");
+    }
+}
+
+void thread_stacks_destroy(struct thread_stacks *ts) {
+    free(ts->task_path);
+    free(ts->threads);
+    free(ts->prev);
+    free(ts->tids);
+    free(ts->by_vma);
+}
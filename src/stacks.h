@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#ifndef STACKS_H_
+#define STACKS_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "./smogmeter.h"
+
+// the length of a thread name, including the terminating null byte
+#define THREAD_NAME_LEN 16
+
+struct thread_stack {
+    pid_t tid;
+    char name[THREAD_NAME_LEN];
+
+    // a page within the stack of the thread, or 0 while it is not known
+    size_t page;
+
+    // the VMA of the frame holding that page, or SIZE_MAX
+    size_t vma;
+};
+
+// the stacks of the threads of a process. only the stack of the main thread
+// is named in the maps, the others are anonymous VMAs, which are told apart
+// by the stack pointers of the threads. threads are read once when they
+// appear, and again only while their stack pointer is not known, as it is
+// not while a thread is running.
+struct thread_stacks {
+    pid_t pid;
+    char *task_path;
+
+    // the threads of the frame, and of the previous one, ordered by tid
+    struct thread_stack *threads;
+    size_t len;
+    size_t capacity;
+    struct thread_stack *prev;
+    size_t prev_capacity;
+
+    // scratch space for the tids listed by the task directory
+    pid_t *tids;
+    size_t tids_capacity;
+
+    // the thread whose stack is every VMA of the frame, or SIZE_MAX
+    size_t *by_vma;
+    size_t by_vma_capacity;
+
+    // the files read for threads since the start, as the cost of the scan
+    size_t reads;
+};
+
+int thread_stacks_init(struct thread_stacks *ts, pid_t pid);
+
+// list the threads, read the new ones and find their stacks among the VMAs
+// of the frame
+int thread_stacks_begin_frame(struct thread_stacks *ts, const struct smog_frame *frame);
+
+// the thread whose stack is VMA index of the frame, or NULL
+const struct thread_stack *thread_stacks_find(const struct thread_stacks *ts, size_t index);
+
+// report the committed, accessed and softdirty pages of every stack found
+void thread_stacks_end_frame(const struct thread_stacks *ts, const struct smog_frame *frame,
+                             int track_accessed, int track_softdirty);
+
+void thread_stacks_destroy(struct thread_stacks *ts);
+
+#endif  // STACKS_H_
@@ -0,0 +1,1186 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#include "./target.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "./util.h"
+
+static const size_t CHONK = 8;
+
+static int update_process(struct target *t);
+
+int target_init(struct target *t, pid_t pid, const struct smog_config *config,
+                enum procfs_mode mode, const char *recording) {
+    memset(t, 0, sizeof(*t));
+    t->config = *config;
+
+    int res = procfs_init(&t->io, pid, mode, recording);
+    if (res != 0)
+        return res;
+    t->pid = t->io.pid;
+    t->frame.pid = t->io.pid;
+
+    if (procfs_open(&t->io, PROCFS_PAGEMAP, O_RDONLY) != 0) {
+        fprintf(stderr, "%s: ", procfs_path(&t->io, PROCFS_PAGEMAP));
+        perror("open");
+        return 1;
+    }
+
+    if (procfs_now(&t->io, &t->prev) != 0) {
+        perror("procfs_now");
+        return 1;
+    }
+
+    // the first frame measures from here
+    if (t->config.track_process)
+        return update_process(t);
+
+    return 0;
+}
+
+// the idle bitmap is only opened once accessed tracking is requested, since
+// it can be switched on at runtime in daemon mode.
+static int open_page_idle(struct target *t) {
+    if (t->page_idle_open)
+        return 0;
+
+    if (procfs_open(&t->io, PROCFS_PAGE_IDLE, O_RDWR) != 0) {
+        fprintf(stderr, "%s: ", procfs_path(&t->io, PROCFS_PAGE_IDLE));
+        perror("open");
+        return 1;
+    }
+
+    t->page_idle_open = 1;
+    return 0;
+}
+
+int target_reset(struct target *t) {
+    // clear all softdirty flags to initiate the measurement period
+    if (t->config.track_softdirty) {
+        const char buf[] = "4";
+        if (procfs_write_file(&t->io, PROCFS_CLEAR_REFS, buf, sizeof(buf)) != 0) {
+            fprintf(stderr, "%s: ", procfs_path(&t->io, PROCFS_CLEAR_REFS));
+            perror("clear_softdirty");
+            return 1;
+        }
+    }
+
+    // clear all tracked accessed bits
+    if (t->config.track_accessed && t->idle_cache) {
+        ssize_t wsize = procfs_pwrite(&t->io, PROCFS_PAGE_IDLE, t->pfn_cache,
+                                      t->idle_cache_capacity * 8, 0);
+        if (wsize < 0) {
+            fprintf(stderr, "%s: ", procfs_path(&t->io, PROCFS_PAGE_IDLE));
+            perror("pwrite");
+            return 1;
+        }
+        while (wsize < (ssize_t)t->idle_cache_capacity * 8) {
+            wsize -= wsize % 8;
+            ssize_t _wsize = procfs_pwrite(&t->io, PROCFS_PAGE_IDLE, t->pfn_cache + wsize / 8,
+                                           t->idle_cache_capacity * 8 - wsize, wsize);
+            if (_wsize < 0) {
+                if (errno == ENXIO) {
+                    errno = 0;
+                    break;
+                }
+                fprintf(stderr, "%s: ", procfs_path(&t->io, PROCFS_PAGE_IDLE));
+                perror("pwrite");
+                return 1;
+            }
+            wsize += _wsize;
+        }
+        memset(t->pfn_cache, 0, t->idle_cache_capacity * 8);
+        memset(t->idle_cache, 0, t->idle_cache_capacity * 8);
+        memset(t->idle_map, 0, t->idle_map_capacity * 8);
+    }
+
+    // the pages of every VMA are counted from here
+    if (procfs_now_fine(&t->io, &t->reset) != 0) {
+        perror("procfs_now");
+        return 1;
+    }
+
+    return 0;
+}
+
+// parse a file of the process with one of the VMA table parsers
+static int parse_file(struct target *t, enum procfs_file file,
+                      int (*parse)(FILE *f, struct target *t)) {
+    char *buf;
+    size_t len;
+    if (procfs_read_file(&t->io, file, &buf, &len) != 0) {
+        fprintf(stderr, "%s: ", procfs_path(&t->io, file));
+        perror("read");
+        return 1;
+    }
+
+    FILE *f = fmemopen(buf, len, "r");
+    if (!f) {
+        perror("fmemopen");
+        free(buf);
+        return 2;
+    }
+
+    int res = parse(f, t);
+
+    fclose(f);
+    free(buf);
+    return res;
+}
+
+// read a short file of the process into a string
+static int read_line(struct target *t, enum procfs_file file, char *line, size_t size) {
+    char *buf;
+    size_t len;
+    if (procfs_read_file(&t->io, file, &buf, &len) != 0) {
+        fprintf(stderr, "%s: ", procfs_path(&t->io, file));
+        perror("read");
+        return 1;
+    }
+
+    if (len >= size)
+        len = size - 1;
+    memcpy(line, buf, len);
+    line[len] = 0;
+
+    free(buf);
+    return 0;
+}
+
+static int read_process(struct target *t, struct smog_process_stats *stats) {
+    static long ticks_per_sec = 0;
+    if (!ticks_per_sec)
+        ticks_per_sec = sysconf(_SC_CLK_TCK);
+
+    char line[1024];
+    int res = read_line(t, PROCFS_STAT, line, sizeof(line));
+    if (res != 0)
+        return res;
+
+    // the command name may contain spaces and parentheses, so the fields
+    // are counted from the last closing one
+    unsigned long long minflt, majflt, utime, stime;
+    char *fields = strrchr(line, ')');
+    if (!fields || sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %llu %*u %llu %*u %llu %llu",
+                          &minflt, &majflt, &utime, &stime) != 4) {
+        fprintf(stderr, "%s: malformed stat\n", procfs_path(&t->io, PROCFS_STAT));
+        return 1;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    stats->minflt = minflt;
+    stats->majflt = majflt;
+    stats->utime_ms = utime * 1000 / ticks_per_sec;
+    stats->stime_ms = stime * 1000 / ticks_per_sec;
+
+    if (t->config.track_schedstat) {
+        res = read_line(t, PROCFS_SCHEDSTAT, line, sizeof(line));
+        if (res != 0)
+            return res;
+
+        if (sscanf(line, "%" SCNu64 " %" SCNu64 " %" SCNu64,
+                   &stats->run_ns, &stats->wait_ns, &stats->timeslices) != 3) {
+            fprintf(stderr, "%s: malformed schedstat\n", procfs_path(&t->io, PROCFS_SCHEDSTAT));
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// report the resources used by the process since the previous read. the
+// first read only takes the baseline.
+static int update_process(struct target *t) {
+    struct smog_process_stats now;
+    int res = read_process(t, &now);
+    if (res != 0)
+        return res;
+
+    struct smog_process_stats *delta = &t->frame.process;
+    memset(delta, 0, sizeof(*delta));
+    if (t->has_process && t->has_schedstat == t->config.track_schedstat) {
+        delta->minflt = now.minflt - t->process.minflt;
+        delta->majflt = now.majflt - t->process.majflt;
+        delta->utime_ms = now.utime_ms - t->process.utime_ms;
+        delta->stime_ms = now.stime_ms - t->process.stime_ms;
+        delta->run_ns = now.run_ns - t->process.run_ns;
+        delta->wait_ns = now.wait_ns - t->process.wait_ns;
+        delta->timeslices = now.timeslices - t->process.timeslices;
+    }
+
+    t->process = now;
+    t->has_process = 1;
+    t->has_schedstat = t->config.track_schedstat;
+    return 0;
+}
+
+static int parse_maps(FILE *f, struct target *t) {
+    int res = update_vmas(f, &t->vmas, t->filter, t->config.verbose);
+    if (res != 0) {
+        fprintf(stderr, "%s: ", procfs_path(&t->io, PROCFS_MAPS));
+        perror("parse_vmas");
+        return 1;
+    }
+    return 0;
+}
+
+static int parse_rss(FILE *f, struct target *t) {
+    return update_rss(f, &t->vmas);
+}
+
+int target_update(struct target *t) {
+    struct smog_frame *frame = &t->frame;
+
+    struct timeval now;
+    struct timeval elapsed;
+    if (procfs_now(&t->io, &now) != 0)
+        return 1;
+    timersub(&now, &t->prev, &elapsed);
+
+    frame->timestamp = now;
+    frame->elapsed_ms = elapsed.tv_sec * 1000 + elapsed.tv_usec / 1000;
+    t->prev = now;
+
+    int res;
+    if (t->config.track_process) {
+        res = update_process(t);
+        if (res != 0)
+            return res;
+    } else {
+        // start over once tracking is switched on again
+        t->has_process = 0;
+    }
+
+    // update VMAs from /proc/<pid>/maps
+    res = parse_file(t, PROCFS_MAPS, parse_maps);
+    if (res != 0)
+        return res;
+
+    if (t->config.skip_unpopulated) {
+        res = parse_file(t, PROCFS_SMAPS, parse_rss);
+        if (res != 0)
+            return res;
+    }
+
+    // the table may have been reallocated
+    frame->num_vmas = t->vmas.len;
+    frame->vma_start = t->vmas.start;
+    frame->vma_end = t->vmas.end;
+    frame->vma_committed = t->vmas.committed;
+    frame->vma_accessed = t->vmas.accessed;
+    frame->vma_softdirty = t->vmas.softdirty;
+
+    return 0;
+}
+
+// whether a VMA cannot have any present pages, so reading its pagemap can
+// be avoided. this is the case if smaps reports no resident pages, or if it
+// permits no access at all and was found empty before. pages populated
+// between reading smaps and skipping the VMA are picked up next frame.
+static int is_unpopulated(struct target *t, size_t i) {
+    struct vma_info *info = &t->vmas.info[i];
+
+    if (!strncmp(info->perms, "---", 3) && info->scanned && !t->vmas.committed[i])
+        return 1;
+
+    if (t->config.skip_unpopulated && info->rss == 0)
+        return 1;
+
+    return 0;
+}
+
+// attribute the pages of a VMA to the NUMA nodes they reside on
+static int count_nodes(struct target *t, size_t i, const uint64_t *pagemap) {
+    size_t start = t->vmas.start[i];
+    size_t len = t->vmas.end[i] - start;
+    struct vma_info *info = &t->vmas.info[i];
+
+    if (!info->nodes) {
+        info->nodes = calloc(g_numa_nodes, sizeof(*info->nodes));
+        if (!info->nodes) {
+            perror("calloc");
+            return 2;
+        }
+    }
+    memset(info->nodes, 0, g_numa_nodes * sizeof(*info->nodes));
+
+    if (len > t->page_nodes_capacity) {
+        free(t->page_nodes);
+        t->page_nodes = malloc(len * sizeof(*t->page_nodes));
+        if (!t->page_nodes) {
+            perror("malloc");
+            return 2;
+        }
+        t->page_nodes_capacity = len;
+    }
+
+    int res = numa_resolve(t->pid, pagemap, start, len, t->page_nodes);
+    if (res != 0)
+        return res;
+
+    for (size_t j = 0; j < len; ++j) {
+        int node = t->page_nodes[j];
+        if (node < 0)
+            continue;
+
+        info->nodes[node].committed++;
+        info->nodes[node].accessed += !!(pagemap[j] & PM_ACCESSED);
+        info->nodes[node].softdirty += !!(pagemap[j] & PM_SOFT_DIRTY);
+    }
+
+    for (size_t n = 0; n < g_numa_nodes; ++n) {
+        t->frame.nodes[n].committed += info->nodes[n].committed;
+        t->frame.nodes[n].accessed += info->nodes[n].accessed;
+        t->frame.nodes[n].softdirty += info->nodes[n].softdirty;
+    }
+
+    return 0;
+}
+
+// (re)allocate the per-granularity counters if the configured granularities
+// changed, dropping those of all VMAs
+static int prepare_blocks(struct target *t) {
+    size_t n = t->config.num_granularities;
+    if (n == t->num_granularities)
+        return 0;
+
+    for (size_t i = 0; i < t->vmas.len; ++i) {
+        free(t->vmas.info[i].blocks);
+        t->vmas.info[i].blocks = NULL;
+    }
+    free(t->frame.blocks);
+    free(t->last_accessed_block);
+    free(t->last_softdirty_block);
+    t->frame.blocks = NULL;
+    t->last_accessed_block = NULL;
+    t->last_softdirty_block = NULL;
+    t->num_granularities = 0;
+
+    if (!n)
+        return 0;
+
+    t->frame.blocks = calloc(n, sizeof(*t->frame.blocks));
+    t->last_accessed_block = calloc(n, sizeof(*t->last_accessed_block));
+    t->last_softdirty_block = calloc(n, sizeof(*t->last_softdirty_block));
+    if (!t->frame.blocks || !t->last_accessed_block || !t->last_softdirty_block) {
+        perror("calloc");
+        return 2;
+    }
+
+    t->num_granularities = n;
+    return 0;
+}
+
+// count an accessed or softdirty page towards the blocks containing it, once
+// per block. pages are visited in ascending order, so it suffices to remember
+// the last block counted of every granularity.
+static inline void count_blocks(struct target *t, struct smog_block_counters *blocks,
+                                size_t page, uint64_t flags) {
+    for (size_t g = 0; g < t->num_granularities; ++g) {
+        size_t block = page / t->config.granularities[g];
+        if ((flags & PM_ACCESSED) && block != t->last_accessed_block[g]) {
+            t->last_accessed_block[g] = block;
+            blocks[g].accessed++;
+        }
+        if ((flags & PM_SOFT_DIRTY) && block != t->last_softdirty_block[g]) {
+            t->last_softdirty_block[g] = block;
+            blocks[g].softdirty++;
+        }
+    }
+}
+
+static void drop_vma_windows(struct vma_info *info) {
+    free(info->windows);
+    free(info->window_epochs);
+    free(info->window_bits);
+    info->windows = NULL;
+    info->window_epochs = NULL;
+    info->window_bits = NULL;
+}
+
+// (re)allocate the windows if the configured ones changed, dropping what was
+// accumulated so far, start over the windows completed by the last frame and
+// add the current one to all of them
+static int prepare_windows(struct target *t) {
+    size_t n = t->config.num_windows;
+    int changed = n != t->num_windows;
+    for (size_t w = 0; !changed && w < n; ++w)
+        changed = t->frame.windows[w].length != t->config.windows[w];
+
+    if (changed) {
+        for (size_t i = 0; i < t->vmas.len; ++i)
+            drop_vma_windows(&t->vmas.info[i]);
+        free(t->frame.windows);
+        free(t->window_epochs);
+        t->frame.windows = NULL;
+        t->window_epochs = NULL;
+        t->num_windows = 0;
+
+        if (!n)
+            return 0;
+
+        t->frame.windows = calloc(n, sizeof(*t->frame.windows));
+        t->window_epochs = calloc(n, sizeof(*t->window_epochs));
+        if (!t->frame.windows || !t->window_epochs) {
+            perror("calloc");
+            return 2;
+        }
+        for (size_t w = 0; w < n; ++w)
+            t->frame.windows[w].length = t->config.windows[w];
+        t->num_windows = n;
+    }
+
+    for (size_t w = 0; w < n; ++w) {
+        struct smog_window *window = &t->frame.windows[w];
+        if (window->frames == window->length) {
+            window->frames = 0;
+            window->elapsed_ms = 0;
+            t->window_epochs[w]++;
+        }
+        window->frames++;
+        window->elapsed_ms += t->frame.elapsed_ms;
+        memset(&window->totals, 0, sizeof(window->totals));
+    }
+
+    return 0;
+}
+
+static size_t window_words(const struct vma_info *info) {
+    return (info->window_end - info->window_start + 63) / 64;
+}
+
+static size_t count_bits(const uint64_t *bits, size_t words) {
+    size_t n = 0;
+    for (size_t k = 0; k < words; ++k)
+        n += __builtin_popcountll(bits[k]);
+    return n;
+}
+
+// reallocate n bitmaps over the pages of an extent for a new one, carrying
+// over the pages both have in common
+static int resize_bitmaps(uint64_t **bits, size_t *bits_start, size_t *bits_end, size_t n,
+                          size_t start, size_t end) {
+    size_t words = (end - start + 63) / 64;
+    uint64_t *new_bits = calloc(n * words, sizeof(*new_bits));
+    if (!new_bits) {
+        perror("calloc");
+        return 2;
+    }
+
+    if (*bits) {
+        size_t old_words = (*bits_end - *bits_start + 63) / 64;
+        size_t from = start > *bits_start ? start : *bits_start;
+        size_t to = end < *bits_end ? end : *bits_end;
+
+        for (size_t k = 0; k < n; ++k) {
+            const uint64_t *src = *bits + k * old_words;
+            uint64_t *dst = new_bits + k * words;
+            for (size_t page = from; page < to; ++page) {
+                size_t s = page - *bits_start;
+                size_t d = page - start;
+                if (src[s / 64] & (1ULL << (s % 64)))
+                    dst[d / 64] |= 1ULL << (d % 64);
+            }
+        }
+    }
+
+    free(*bits);
+    *bits = new_bits;
+    *bits_start = start;
+    *bits_end = end;
+    return 0;
+}
+
+// allocate the window bitmaps of a VMA for its current extent
+static int resize_window_bits(struct target *t, size_t i) {
+    struct vma_info *info = &t->vmas.info[i];
+    int had_bits = info->window_bits != NULL;
+
+    int res = resize_bitmaps(&info->window_bits, &info->window_start, &info->window_end,
+                             2 * t->num_windows, t->vmas.start[i], t->vmas.end[i]);
+    if (res != 0)
+        return res;
+
+    // pages that left the VMA no longer count
+    if (had_bits) {
+        size_t words = window_words(info);
+        for (size_t w = 0; w < t->num_windows; ++w) {
+            info->windows[w].accessed = count_bits(info->window_bits + 2 * w * words, words);
+            info->windows[w].softdirty = count_bits(info->window_bits + (2 * w + 1) * words, words);
+        }
+    }
+
+    return 0;
+}
+
+// prepare the windows of a VMA for a frame, clearing those that started
+// over. the bitmaps are only needed once the VMA is read.
+static int prepare_vma_windows(struct target *t, size_t i, int read) {
+    struct vma_info *info = &t->vmas.info[i];
+    size_t n = t->num_windows;
+
+    if (!info->windows) {
+        info->windows = calloc(n, sizeof(*info->windows));
+        info->window_epochs = malloc(n * sizeof(*info->window_epochs));
+        if (!info->windows || !info->window_epochs) {
+            perror("calloc");
+            return 2;
+        }
+        memcpy(info->window_epochs, t->window_epochs, n * sizeof(*info->window_epochs));
+    }
+
+    if (read && (!info->window_bits
+                 || info->window_start != t->vmas.start[i]
+                 || info->window_end != t->vmas.end[i])) {
+        int res = resize_window_bits(t, i);
+        if (res != 0)
+            return res;
+    }
+
+    size_t words = info->window_bits ? window_words(info) : 0;
+    for (size_t w = 0; w < n; ++w) {
+        if (info->window_epochs[w] == t->window_epochs[w])
+            continue;
+
+        info->window_epochs[w] = t->window_epochs[w];
+        memset(&info->windows[w], 0, sizeof(info->windows[w]));
+        if (info->window_bits)
+            memset(info->window_bits + 2 * w * words, 0, 2 * words * sizeof(*info->window_bits));
+    }
+
+    return 0;
+}
+
+// mark an accessed or softdirty page in the windows of its VMA, counting it
+// the first time in each window
+static inline void mark_windows(struct target *t, struct vma_info *info, size_t words,
+                                size_t page, uint64_t flags) {
+    size_t word = page / 64;
+    uint64_t mask = 1ULL << (page % 64);
+
+    for (size_t w = 0; w < t->num_windows; ++w) {
+        uint64_t *accessed = info->window_bits + 2 * w * words;
+        uint64_t *softdirty = accessed + words;
+        if ((flags & PM_ACCESSED) && !(accessed[word] & mask)) {
+            accessed[word] |= mask;
+            info->windows[w].accessed++;
+        }
+        if ((flags & PM_SOFT_DIRTY) && !(softdirty[word] & mask)) {
+            softdirty[word] |= mask;
+            info->windows[w].softdirty++;
+        }
+    }
+}
+
+// add the windows of a VMA to the frame totals
+static void sum_windows(struct target *t, const struct vma_info *info) {
+    for (size_t w = 0; w < t->num_windows; ++w) {
+        t->frame.windows[w].totals.accessed += info->windows[w].accessed;
+        t->frame.windows[w].totals.softdirty += info->windows[w].softdirty;
+    }
+}
+
+// the bit planes of a VMA: present, accessed and softdirty pages
+#define NUM_PLANES 3
+
+// count the transitions between the bit planes of a VMA of the previous
+// frame and the current ones, which are kept in their place. current is
+// NULL if the VMA has no present pages.
+static int update_planes(struct target *t, size_t i, const uint64_t *current) {
+    struct vma_info *info = &t->vmas.info[i];
+    size_t start = t->vmas.start[i];
+    size_t end = t->vmas.end[i];
+    size_t words = (end - start + 63) / 64;
+
+    memset(&info->churn, 0, sizeof(info->churn));
+
+    if (!current) {
+        if (!info->planes)
+            return 0;
+        // planes of a different extent are just as empty
+        words = (info->planes_end - info->planes_start + 63) / 64;
+    } else if (!info->planes || info->planes_start != start || info->planes_end != end) {
+        // pages outside of the new extent of the VMA are gone
+        size_t old_words = (info->planes_end - info->planes_start + 63) / 64;
+        size_t before = info->planes ? count_bits(info->planes, old_words) : 0;
+
+        int res = resize_bitmaps(&info->planes, &info->planes_start, &info->planes_end,
+                                 NUM_PLANES, start, end);
+        if (res != 0)
+            return res;
+
+        if (t->has_planes)
+            info->churn.freed = before - count_bits(info->planes, words);
+    }
+
+    const uint64_t *prev = info->planes;
+    if (t->has_planes) {
+        struct smog_churn *churn = &info->churn;
+        for (size_t k = 0; k < words; ++k) {
+            uint64_t prev_present = prev[k];
+            uint64_t prev_hot = prev[words + k] | prev[2 * words + k];
+            uint64_t present = current ? current[k] : 0;
+            uint64_t hot = current ? current[words + k] | current[2 * words + k] : 0;
+
+            churn->committed += __builtin_popcountll(present & ~prev_present);
+            churn->freed += __builtin_popcountll(prev_present & ~present);
+            churn->heated += __builtin_popcountll(hot & ~prev_hot);
+            churn->cooled += __builtin_popcountll(prev_hot & ~hot);
+        }
+    }
+
+    if (current) {
+        memcpy(info->planes, current, NUM_PLANES * words * sizeof(*current));
+    } else {
+        free(info->planes);
+        info->planes = NULL;
+    }
+    return 0;
+}
+
+static void sum_churn(struct smog_churn *total, const struct smog_churn *churn) {
+    total->committed += churn->committed;
+    total->freed += churn->freed;
+    total->heated += churn->heated;
+    total->cooled += churn->cooled;
+}
+
+// translate the idle page bitmap into the accessed bit of a present page,
+// reading the bitmap in chonks as required
+static int translate_accessed(struct target *t, uint64_t *entry) {
+    // extract pageframe number from the pte
+    size_t pfn_bit = *entry & PM_PFN_MASK;
+    size_t pfn_word = pfn_bit / 64;
+    uint64_t pfn_mask = 1ULL << (pfn_bit % 64);
+
+    size_t map_bit = pfn_word / CHONK;
+    size_t map_word = map_bit / 64;
+    uint64_t map_mask = 1ULL << (map_bit % 64);
+
+    // make sure the idle map has sufficient capacity
+    if (map_word >= t->idle_map_capacity) {
+        size_t new_capacity = map_word + 1;
+
+        t->idle_map = realloc(t->idle_map, new_capacity * 8);
+
+        if (!t->idle_map) {
+            perror("realloc");
+            return 2;
+        }
+
+        memset(t->idle_map + t->idle_map_capacity, 0,
+               (new_capacity - t->idle_map_capacity) * 8);
+
+        t->idle_map_capacity = new_capacity;
+    }
+
+    // make sure the pfn and idle caches have sufficient capacity
+    if (pfn_word >= t->idle_cache_capacity) {
+        size_t new_capacity = t->idle_map_capacity * 64 * CHONK;
+
+        t->pfn_cache = realloc(t->pfn_cache, new_capacity * 8);
+        t->idle_cache = realloc(t->idle_cache, new_capacity * 8);
+
+        if (!t->pfn_cache || !t->idle_cache) {
+            perror("realloc");
+            return 2;
+        }
+
+        memset(t->pfn_cache + t->idle_cache_capacity, 0,
+               (new_capacity - t->idle_cache_capacity) * 8);
+        memset(t->idle_cache + t->idle_cache_capacity, 0,
+               (new_capacity - t->idle_cache_capacity) * 8);
+
+        t->idle_cache_capacity = new_capacity;
+    }
+
+    // mark the page in the pfn cache, used to clear idle bits later
+    t->pfn_cache[pfn_word] |= pfn_mask;
+
+    // read a chonk from the idle bitmap, if necessary
+    if (!(t->idle_map[map_word] & map_mask)) {
+        ssize_t rbytes = procfs_pread(&t->io, PROCFS_PAGE_IDLE,
+                                      t->idle_cache + map_bit * CHONK,
+                                      CHONK * 8,
+                                      map_bit * CHONK * 8);
+        if (rbytes < 0) {
+            fprintf(stderr, "%s: ", procfs_path(&t->io, PROCFS_PAGE_IDLE));
+            perror("pread");
+            return 1;
+        }
+        if (rbytes < (ssize_t)CHONK * 8) {
+            fprintf(stderr, "%s: partial read", procfs_path(&t->io, PROCFS_PAGE_IDLE));
+        }
+
+        t->idle_map[map_word] |= map_mask;
+    }
+
+    // translate the idle map into an accessed bit
+    *entry &= ~(PM_ACCESSED);
+    if (!(t->idle_cache[pfn_word] & pfn_mask)) {
+        *entry |= PM_ACCESSED;
+    }
+    return 0;
+}
+
+// classify the pages of a VMA into the bit planes in t->planes, and count
+// its dirty runs, blocks and windows. the modes are passed as constants by
+// the instances below, so the compiler drops what is not tracked from the
+// loop instead of testing the configuration for every page.
+static inline __attribute__((always_inline))
+int scan_pages(struct target *t, size_t i, uint64_t *pagemap,
+               int track_accessed, int track_softdirty, int track_extras) {
+    struct vma_info *info = &t->vmas.info[i];
+    size_t start = t->vmas.start[i];
+    size_t len = t->vmas.end[i] - start;
+    size_t num_granularities = track_extras ? t->num_granularities : 0;
+    size_t num_windows = track_extras ? t->num_windows : 0;
+    size_t words = num_windows ? window_words(info) : 0;
+
+    size_t plane_words = (len + 63) / 64;
+    uint64_t *present_plane = t->planes;
+    uint64_t *accessed_plane = present_plane + plane_words;
+    uint64_t *softdirty_plane = accessed_plane + plane_words;
+
+    // bits of states that are not tracked are cleared from the pagemap
+    uint64_t untracked = (track_accessed ? 0 : PM_ACCESSED)
+                       | (track_softdirty ? 0 : PM_SOFT_DIRTY);
+
+    // the current run of softdirty pages, ending before page run_end
+    size_t run = 0;
+    size_t run_end = 0;
+    memset(&info->runs, 0, sizeof(info->runs));
+
+    for (size_t j = 0; j < len; ++j) {
+        uint64_t entry = pagemap[j] & ~untracked;
+        uint64_t shift = j % 64;
+
+        if (!track_accessed && !track_softdirty && !track_extras) {
+            // nothing but the present bit, which needs no branch
+            pagemap[j] = entry;
+            present_plane[j / 64] |= (uint64_t)!!(entry & PM_PRESENT) << shift;
+            continue;
+        }
+
+        if (!(entry & PM_PRESENT)) {
+            pagemap[j] = entry;
+            continue;
+        }
+        present_plane[j / 64] |= 1ULL << shift;
+
+        if (track_accessed) {
+            int res = translate_accessed(t, &entry);
+            if (res != 0)
+                return res;
+            accessed_plane[j / 64] |= (uint64_t)!!(entry & PM_ACCESSED) << shift;
+        }
+        pagemap[j] = entry;
+
+        if (track_extras && (entry & (PM_ACCESSED | PM_SOFT_DIRTY))) {
+            if (num_granularities)
+                count_blocks(t, info->blocks, start + j, entry);
+            if (num_windows)
+                mark_windows(t, info, words, j, entry);
+        }
+
+        if (track_softdirty && (entry & PM_SOFT_DIRTY)) {
+            softdirty_plane[j / 64] |= 1ULL << shift;
+
+            if (run && run_end == j) {
+                run++;
+            } else {
+                info->runs.runs++;
+                run = 1;
+            }
+            run_end = j + 1;
+            if (run > info->runs.longest)
+                info->runs.longest = run;
+        }
+    }
+
+    return 0;
+}
+
+#define SCAN_KERNEL(ACCESSED, SOFTDIRTY, EXTRAS) \
+    static int scan_pages_##ACCESSED##SOFTDIRTY##EXTRAS(struct target *t, size_t i, \
+                                                        uint64_t *pagemap) { \
+        return scan_pages(t, i, pagemap, ACCESSED, SOFTDIRTY, EXTRAS); \
+    }
+
+SCAN_KERNEL(0, 0, 0)
+SCAN_KERNEL(0, 0, 1)
+SCAN_KERNEL(0, 1, 0)
+SCAN_KERNEL(0, 1, 1)
+SCAN_KERNEL(1, 0, 0)
+SCAN_KERNEL(1, 0, 1)
+SCAN_KERNEL(1, 1, 0)
+SCAN_KERNEL(1, 1, 1)
+
+// indexed by accessed << 2 | softdirty << 1 | extras
+static const scan_kernel scan_kernels[8] = {
+    scan_pages_000, scan_pages_001, scan_pages_010, scan_pages_011,
+    scan_pages_100, scan_pages_101, scan_pages_110, scan_pages_111,
+};
+
+scan_kernel target_scan_kernel(const struct target *t) {
+    int extras = t->num_granularities || t->num_windows;
+    return scan_kernels[!!t->config.track_accessed << 2
+                        | !!t->config.track_softdirty << 1
+                        | !!extras];
+}
+
+int target_scan_generic(struct target *t, size_t i, uint64_t *pagemap) {
+    return scan_pages(t, i, pagemap, t->config.track_accessed, t->config.track_softdirty,
+                      t->num_granularities || t->num_windows);
+}
+
+// record when a VMA was read, and the time its pages were counted over: from
+// the last reset to the middle of the read
+static void set_times(struct target *t, size_t i, const struct timeval *start,
+                      const struct timeval *end) {
+    struct smog_vma_times *times = &t->vmas.info[i].times;
+    times->scan_start = *start;
+    times->scan_end = *end;
+
+    struct timeval half;
+    struct timeval middle;
+    struct timeval window;
+    timersub(end, start, &half);
+    uint64_t half_us = (half.tv_sec * 1000000 + half.tv_usec) / 2;
+    half.tv_sec = half_us / 1000000;
+    half.tv_usec = half_us % 1000000;
+    timeradd(start, &half, &middle);
+    timersub(&middle, &t->reset, &window);
+    times->window_us = window.tv_sec < 0 ? 0 : window.tv_sec * 1000000 + window.tv_usec;
+}
+
+// keep rolling statistics over a horizon, allocated again if it changed
+static int update_rolling_stats(struct rolling **r, size_t horizon, double elapsed_ms,
+                                size_t softdirty, size_t working_set) {
+    if (*r && (*r)->horizon != horizon) {
+        rolling_destroy(*r);
+        *r = NULL;
+    }
+    if (!horizon)
+        return 0;
+
+    if (!*r) {
+        *r = rolling_create(horizon);
+        if (!*r)
+            return 2;
+    }
+
+    double rate = elapsed_ms ? softdirty * 1000.0 / elapsed_ms : 0;
+    rolling_add(*r, rate, working_set);
+    return 0;
+}
+
+// add the dirty rate and working set of a VMA in this frame to its
+// rolling statistics, over the time its pages were counted
+static int update_vma_rolling(struct target *t, size_t i) {
+    struct vma_table *vmas = &t->vmas;
+    size_t working_set = t->config.track_accessed ? vmas->accessed[i] : vmas->committed[i];
+    return update_rolling_stats(&vmas->info[i].rolling, t->config.rolling_horizon,
+                                vmas->info[i].times.window_us / 1000.0, vmas->softdirty[i],
+                                working_set);
+}
+
+// the same for the totals of the frame
+static int update_rolling(struct target *t) {
+    struct smog_frame *frame = &t->frame;
+    size_t horizon = t->config.rolling_horizon;
+
+    size_t working_set = t->config.track_accessed ? frame->accessed : frame->committed;
+    int res = update_rolling_stats(&t->rolling, horizon, frame->elapsed_ms,
+                                   frame->softdirty, working_set);
+    if (res != 0)
+        return res;
+
+    if (t->rolling) {
+        frame->rolling = t->rolling->stats[0];
+        frame->rolling_total = t->rolling->stats[1];
+    } else {
+        memset(&frame->rolling, 0, sizeof(frame->rolling));
+        memset(&frame->rolling_total, 0, sizeof(frame->rolling_total));
+    }
+    return 0;
+}
+
+int target_scan(struct target *t, vma_callback cb, void *arg) {
+    struct smog_frame *frame = &t->frame;
+
+    if (t->config.track_accessed) {
+        int res = open_page_idle(t);
+        if (res != 0)
+            return res;
+    }
+
+    // walk pagemap for the aggregated regions
+    frame->reserved = 0;
+    frame->committed = 0;
+    frame->accessed = 0;
+    frame->softdirty = 0;
+    memset(&frame->stats, 0, sizeof(frame->stats));
+
+    struct timeval scan_start;
+    gettimeofday(&scan_start, NULL);
+
+    // the start of the first read of a VMA and the end of the last
+    struct timeval first_read = { 0, 0 };
+    struct timeval last_read = { 0, 0 };
+
+    if (t->config.track_numa) {
+        if (!frame->nodes) {
+            frame->nodes = calloc(g_numa_nodes, sizeof(*frame->nodes));
+            if (!frame->nodes) {
+                perror("calloc");
+                return 2;
+            }
+        }
+        memset(frame->nodes, 0, g_numa_nodes * sizeof(*frame->nodes));
+        frame->num_nodes = g_numa_nodes;
+    }
+
+    if (prepare_blocks(t) != 0)
+        return 2;
+
+    size_t num_granularities = t->num_granularities;
+    frame->num_granularities = num_granularities;
+    frame->granularities = t->config.granularities;
+    if (num_granularities)
+        memset(frame->blocks, 0, num_granularities * sizeof(*frame->blocks));
+    memset(&frame->runs, 0, sizeof(frame->runs));
+    memset(&frame->churn, 0, sizeof(frame->churn));
+    if (t->has_planes)
+        frame->churn.freed = t->vmas.lost_committed;
+
+    if (prepare_windows(t) != 0)
+        return 2;
+    size_t num_windows = t->num_windows;
+    frame->num_windows = num_windows;
+
+    // the page loop specialized for the tracking modes of this frame
+    scan_kernel scan = target_scan_kernel(t);
+
+    struct vma_table *vmas = &t->vmas;
+    for (size_t i = 0; i < vmas->len; ++i) {
+        size_t start = vmas->start[i];
+        size_t end = vmas->end[i];
+
+        ssize_t len = end - start;
+        off_t off = start;
+
+        if (is_unpopulated(t, i)) {
+            vmas->committed[i] = 0;
+            vmas->accessed[i] = 0;
+            vmas->softdirty[i] = 0;
+            if (t->config.track_numa && vmas->info[i].nodes)
+                memset(vmas->info[i].nodes, 0, g_numa_nodes * sizeof(*vmas->info[i].nodes));
+            if (vmas->info[i].blocks)
+                memset(vmas->info[i].blocks, 0, num_granularities * sizeof(*vmas->info[i].blocks));
+            memset(&vmas->info[i].runs, 0, sizeof(vmas->info[i].runs));
+            if (num_windows) {
+                if (prepare_vma_windows(t, i, 0) != 0)
+                    return 2;
+                sum_windows(t, &vmas->info[i]);
+            }
+            if (update_planes(t, i, NULL) != 0)
+                return 2;
+            sum_churn(&frame->churn, &vmas->info[i].churn);
+            set_times(t, i, &t->io.last, &t->io.last);
+            if (update_vma_rolling(t, i) != 0)
+                return 2;
+
+            frame->reserved += len;
+            frame->stats.vmas_skipped++;
+            frame->stats.pagemap_skipped += len * sizeof(uint64_t);
+
+            if (cb) {
+                int res = cb(t, i, NULL, arg);
+                if (res != 0)
+                    return res;
+            }
+            continue;
+        }
+
+        uint64_t *pagemap = calloc(len, sizeof(*pagemap));
+        if (!pagemap) {
+            perror("calloc");
+            return 2;
+        }
+
+        struct timeval read_start;
+        if (procfs_now_fine(&t->io, &read_start) != 0) {
+            perror("procfs_now");
+            free(pagemap);
+            return 1;
+        }
+
+        ssize_t bytes = procfs_pread(&t->io, PROCFS_PAGEMAP, pagemap,
+                                     sizeof(*pagemap) * len,
+                                     sizeof(*pagemap) * off);
+        if (bytes < 0) {
+            fprintf(stderr, "%s: ", procfs_path(&t->io, PROCFS_PAGEMAP));
+            perror("pread");
+            free(pagemap);
+            return 1;
+        }
+
+        if (bytes > 0 && (size_t)bytes < len * sizeof(*pagemap)) {
+            fprintf(stderr, "%s: partial read\n", procfs_path(&t->io, PROCFS_PAGEMAP));
+            free(pagemap);
+            return 1;
+        }
+
+        struct vma_info *info = &vmas->info[i];
+        if (num_granularities) {
+            if (!info->blocks) {
+                info->blocks = malloc(num_granularities * sizeof(*info->blocks));
+                if (!info->blocks) {
+                    perror("malloc");
+                    free(pagemap);
+                    return 2;
+                }
+            }
+            memset(info->blocks, 0, num_granularities * sizeof(*info->blocks));
+            for (size_t g = 0; g < num_granularities; ++g) {
+                t->last_accessed_block[g] = SIZE_MAX;
+                t->last_softdirty_block[g] = SIZE_MAX;
+            }
+        }
+
+        if (num_windows && prepare_vma_windows(t, i, 1) != 0) {
+            free(pagemap);
+            return 2;
+        }
+
+        // the bit planes of this frame
+        size_t plane_words = (len + 63) / 64;
+        if (NUM_PLANES * plane_words > t->planes_capacity) {
+            free(t->planes);
+            t->planes = malloc(NUM_PLANES * plane_words * sizeof(*t->planes));
+            if (!t->planes) {
+                perror("malloc");
+                t->planes_capacity = 0;
+                free(pagemap);
+                return 2;
+            }
+            t->planes_capacity = NUM_PLANES * plane_words;
+        }
+        memset(t->planes, 0, NUM_PLANES * plane_words * sizeof(*t->planes));
+        uint64_t *present_plane = t->planes;
+        uint64_t *accessed_plane = present_plane + plane_words;
+        uint64_t *softdirty_plane = accessed_plane + plane_words;
+
+        int res = scan(t, i, pagemap);
+        if (res != 0) {
+            free(pagemap);
+            return res;
+        }
+
+        struct timeval read_end;
+        if (procfs_now_fine(&t->io, &read_end) != 0) {
+            perror("procfs_now");
+            free(pagemap);
+            return 1;
+        }
+        set_times(t, i, &read_start, &read_end);
+        if (!timerisset(&first_read) || timercmp(&read_start, &first_read, <))
+            first_read = read_start;
+        last_read = read_end;
+
+        vmas->committed[i] = count_bits(present_plane, plane_words);
+        vmas->accessed[i] = count_bits(accessed_plane, plane_words);
+        vmas->softdirty[i] = count_bits(softdirty_plane, plane_words);
+
+        if (update_planes(t, i, t->planes) != 0) {
+            free(pagemap);
+            return 2;
+        }
+
+        if (t->config.track_numa) {
+            int res = count_nodes(t, i, pagemap);
+            if (res != 0) {
+                free(pagemap);
+                return res;
+            }
+        }
+
+        vmas->info[i].scanned = 1;
+        frame->stats.vmas_read++;
+        frame->stats.pagemap_read += len * sizeof(*pagemap);
+
+        frame->reserved += len;
+        frame->committed += vmas->committed[i];
+        frame->accessed += vmas->accessed[i];
+        frame->softdirty += vmas->softdirty[i];
+
+        for (size_t g = 0; g < num_granularities; ++g) {
+            frame->blocks[g].accessed += info->blocks[g].accessed;
+            frame->blocks[g].softdirty += info->blocks[g].softdirty;
+        }
+        frame->runs.runs += info->runs.runs;
+        if (info->runs.longest > frame->runs.longest)
+            frame->runs.longest = info->runs.longest;
+        if (num_windows)
+            sum_windows(t, info);
+        sum_churn(&frame->churn, &info->churn);
+        if (update_vma_rolling(t, i) != 0) {
+            free(pagemap);
+            return 2;
+        }
+
+        if (cb) {
+            int res = cb(t, i, pagemap, arg);
+            if (res != 0) {
+                free(pagemap);
+                return res;
+            }
+        }
+
+        free(pagemap);
+    }
+
+    t->has_planes = 1;
+
+    if (update_rolling(t) != 0)
+        return 2;
+
+    struct timeval scan_end;
+    gettimeofday(&scan_end, NULL);
+    timersub(&scan_end, &scan_start, &frame->stats.scan_time);
+    if (timerisset(&first_read))
+        timersub(&last_read, &first_read, &frame->stats.skew);
+
+    return 0;
+}
+
+void target_destroy(struct target *t) {
+    procfs_destroy(&t->io);
+
+    destroy_vmas(&t->vmas);
+    free(t->frame.nodes);
+    free(t->frame.blocks);
+    free(t->frame.windows);
+    free(t->window_epochs);
+    free(t->page_nodes);
+    free(t->planes);
+    rolling_destroy(t->rolling);
+    free(t->last_accessed_block);
+    free(t->last_softdirty_block);
+
+    free(t->pfn_cache);
+    free(t->idle_cache);
+    free(t->idle_map);
+
+    memset(t, 0, sizeof(*t));
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#ifndef TARGET_H_
+#define TARGET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include "./procfs.h"
+#include "./smogmeter.h"
+#include "./vmas.h"
+
+#define PM_PFRAME_BITS 55
+#define PM_PFN_MASK ((1LL << PM_PFRAME_BITS) - 1)
+#define PM_PRESENT SMOG_PAGE_PRESENT
+
+#define PM_SOFT_DIRTY SMOG_PAGE_SOFTDIRTY
+#define PM_ACCESSED SMOG_PAGE_ACCESSED  // using a free bit in the pte structure here
+
+#define KPF_REFERENCED (1ULL << 6)
+
+struct target {
+    pid_t pid;
+    struct smog_config config;
+
+    // compiled from config.vma_filter by the owner of the target, if set
+    const struct vma_filter *filter;
+
+    // procfs and sysfs access, possibly recorded or replayed
+    struct procfs io;
+    int page_idle_open;
+
+    struct vma_table vmas;
+
+    // pfn-indexed caches of the idle page bitmap
+    uint64_t *pfn_cache;
+    uint64_t *idle_cache;
+    uint64_t *idle_map;
+    size_t idle_cache_capacity;
+    size_t idle_map_capacity;
+
+    // scratch space for the bit planes of the VMA being read
+    uint64_t *planes;
+    size_t planes_capacity;
+
+    // whether the VMAs have bit planes of a previous frame to compare with
+    int has_planes;
+
+    // scratch space for the node of every page of a VMA
+    int *page_nodes;
+    size_t page_nodes_capacity;
+
+    // the granularities the block counters are allocated for, and the last
+    // block of each granularity counted during the walk of a VMA
+    size_t num_granularities;
+    size_t *last_accessed_block;
+    size_t *last_softdirty_block;
+
+    // the windows the VMA counters are allocated for, and a counter of the
+    // times each of them started over
+    size_t num_windows;
+    size_t *window_epochs;
+
+    // the counters of the process at the previous frame, if read, and
+    // whether they include schedstat
+    struct smog_process_stats process;
+    int has_process;
+    int has_schedstat;
+
+    // the rolling statistics of the totals, when a horizon is configured
+    struct rolling *rolling;
+
+    // the time of the previous scan and of the last reset, and the most
+    // recent frame
+    struct timeval prev;
+    struct timeval reset;
+    struct smog_frame frame;
+};
+
+// called for every VMA of a frame once its pages have been classified. the
+// pagemap is NULL for VMAs that were skipped because no page can be present.
+// a non-zero return value aborts the scan and is passed on to the caller.
+typedef int (*vma_callback)(struct target *t, size_t index,
+                            const uint64_t *pagemap, void *arg);
+
+// in replay mode, the pid is taken from the recording
+int target_init(struct target *t, pid_t pid, const struct smog_config *config,
+                enum procfs_mode mode, const char *recording);
+
+int target_reset(struct target *t);
+
+int target_update(struct target *t);
+
+int target_scan(struct target *t, vma_callback cb, void *arg);
+
+// classifies the pagemap of VMA index into the bit planes in t->planes and
+// counts its dirty runs, blocks and windows, for the current tracking modes.
+typedef int (*scan_kernel)(struct target *t, size_t index, uint64_t *pagemap);
+
+// the kernel specialized for the tracking modes of the target, which
+// target_scan picks for every frame
+scan_kernel target_scan_kernel(const struct target *t);
+
+// the same loop testing the tracking modes for every page, as a baseline
+int target_scan_generic(struct target *t, size_t index, uint64_t *pagemap);
+
+void target_destroy(struct target *t);
+
+#endif  // TARGET_H_
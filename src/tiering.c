@@ -0,0 +1,575 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+// memory tiering simulator for smog-meter tracefiles.
+//
+// pages start out in the slow tier. every frame, the accessed pages of the
+// frame are looked up in the fast tier, and a placement policy decides which
+// pages reside in the fast tier for the next frame:
+//
+//   lru        the most recently accessed pages
+//   frequency  the most frequently accessed pages, with access counts halved
+//              periodically so the tier follows phase changes
+//   oracle     the pages accessed in the upcoming frame, which bounds the
+//              hit rate any policy can reach at that capacity
+//
+// pages are promoted by copying them into the fast tier. demoted pages are
+// written back to the slow tier if they were dirtied in the fast tier.
+// every fast tier capacity is simulated in the same pass over the trace.
+
+#include <argp.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./trace.h"
+#include "./util.h"
+
+enum policy {
+    POLICY_LRU,
+    POLICY_FREQUENCY,
+    POLICY_ORACLE,
+    NUM_POLICIES,
+};
+
+static const char *policy_names[] = { "lru", "frequency", "oracle" };
+
+struct arguments {
+    char *tracefile;
+
+    size_t *capacities;  // bytes
+    size_t num_capacities;
+
+    int policies[NUM_POLICIES];
+    uint64_t decay;
+};
+
+static struct arguments arguments = { NULL, NULL, 0, { 0 }, 16 };
+
+static const char doc[] = "Simulate memory tiering policies on a traced process";
+static const char args_doc[] = "TRACEFILE";
+
+static struct argp_option options[] = {
+    { "capacity", 'c', "SIZE[,SIZE...]", 0,
+      "fast tier capacity in bytes, with an optional K, M or G suffix. "
+      "may be given multiple times to sweep capacities.", 0 },
+    { "policy", 'p', "POLICY[,POLICY...]", 0,
+      "the placement policies to simulate, any of lru, frequency and oracle. "
+      "defaults to all.", 0 },
+    { "decay", 'd', "FRAMES", 0,
+      "halve the access counts of the frequency policy every FRAMES frames", 0 },
+    { 0 }
+};
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+    struct arguments *arguments = (struct arguments*)state->input;
+    char *saveptr = NULL;
+
+    switch (key) {
+        case 'c':
+            for (char *size = strtok_r(arg, ",", &saveptr); size;
+                 size = strtok_r(NULL, ",", &saveptr)) {
+                size_t *capacities = realloc(arguments->capacities,
+                                             (arguments->num_capacities + 1) * sizeof(size_t));
+                if (!capacities)
+                    argp_failure(state, 1, errno, "unable to allocate memory");
+                arguments->capacities = capacities;
+
+                size_t capacity;
+                if (parse_size(size, &capacity) || capacity < g_system_pagesize)
+                    argp_failure(state, 1, 0, "invalid capacity: %s", size);
+                arguments->capacities[arguments->num_capacities++] = capacity;
+            }
+            break;
+        case 'p':
+            for (char *name = strtok_r(arg, ",", &saveptr); name;
+                 name = strtok_r(NULL, ",", &saveptr)) {
+                int p = 0;
+                while (p < NUM_POLICIES && strcmp(name, policy_names[p]))
+                    p++;
+                if (p == NUM_POLICIES)
+                    argp_failure(state, 1, 0, "unknown policy: %s", name);
+                arguments->policies[p] = 1;
+            }
+            break;
+        case 'd':
+            errno = 0;
+            arguments->decay = strtoll(arg, NULL, 0);
+            if (errno != 0 || !arguments->decay)
+                argp_failure(state, 1, errno, "invalid number of frames: %s", arg);
+            break;
+
+        case ARGP_KEY_ARG:
+            if (state->arg_num >= 1)
+                argp_usage(state);
+            arguments->tracefile = arg;
+            break;
+
+        case ARGP_KEY_END:
+            if (state->arg_num < 1)
+                argp_usage(state);
+            if (!arguments->num_capacities)
+                argp_failure(state, 1, 0, "at least one capacity is required.");
+            break;
+
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+static struct argp argp = { options, parse_opt, args_doc, doc, NULL, NULL, NULL };
+
+#define NIL UINT32_MAX
+
+#define BIT_WORDS(N) (((N) + 63) / 64)
+#define TEST_BIT(B, I) (((B)[(I) / 64] >> ((I) % 64)) & 1)
+#define SET_BIT(B, I) ((B)[(I) / 64] |= 1ULL << ((I) % 64))
+#define CLEAR_BIT(B, I) ((B)[(I) / 64] &= ~(1ULL << ((I) % 64)))
+
+// the fast tier of one capacity under one policy. page state is kept in
+// bitmaps, two bits per page.
+struct tier {
+    enum policy policy;
+    size_t capacity;  // pages
+    size_t used;
+
+    uint64_t *fast;
+    uint64_t *dirty;  // dirtied while in the fast tier
+
+    // lru: the least recently used page in the fast tier
+    uint32_t boundary;
+
+    // oracle: where to continue looking for pages to demote
+    size_t cursor;
+
+    size_t hits;
+    size_t promoted;
+    size_t demoted;
+    size_t written_back;
+};
+
+// state shared by all tiers, indexed by page id
+struct pages {
+    struct page_index idx;
+    size_t capacity;
+
+    // frequency: saturating access counts
+    uint8_t *counts;
+
+    // lru: all accessed pages, most recently accessed first
+    uint32_t *prev;
+    uint32_t *next;
+    uint32_t head;
+    uint32_t tail;
+
+    // the pages accessed, and dirtied, in the current frame
+    uint32_t *accessed;
+    size_t num_accessed;
+    size_t accessed_capacity;
+    uint64_t *frame_accessed;
+    uint64_t *frame_dirty;
+
+    size_t accesses;
+};
+
+static int grow(void **buf, size_t old_size, size_t new_size) {
+    void *new_buf = realloc(*buf, new_size);
+    if (!new_buf) {
+        perror("realloc");
+        return 2;
+    }
+    memset((char*)new_buf + old_size, 0, new_size - old_size);
+    *buf = new_buf;
+    return 0;
+}
+
+// make room for per-page state of the given page id
+static int reserve_pages(struct pages *pages, struct tier *tiers, size_t num_tiers, size_t id) {
+    if (id < pages->capacity)
+        return 0;
+
+    size_t old = pages->capacity;
+    size_t capacity = old ? old : 1 << 16;
+    while (capacity <= id)
+        capacity *= 2;
+
+    int res = grow((void**)&pages->counts, old, capacity);
+    if (!res)
+        res = grow((void**)&pages->prev, old * 4, capacity * 4);
+    if (!res)
+        res = grow((void**)&pages->next, old * 4, capacity * 4);
+    if (!res)
+        res = grow((void**)&pages->frame_accessed, BIT_WORDS(old) * 8, BIT_WORDS(capacity) * 8);
+    if (!res)
+        res = grow((void**)&pages->frame_dirty, BIT_WORDS(old) * 8, BIT_WORDS(capacity) * 8);
+    for (size_t t = 0; t < num_tiers && !res; ++t) {
+        res = grow((void**)&tiers[t].fast, BIT_WORDS(old) * 8, BIT_WORDS(capacity) * 8);
+        if (!res)
+            res = grow((void**)&tiers[t].dirty, BIT_WORDS(old) * 8, BIT_WORDS(capacity) * 8);
+    }
+    if (res != 0)
+        return res;
+
+    for (size_t i = old; i < capacity; ++i) {
+        pages->prev[i] = NIL;
+        pages->next[i] = NIL;
+    }
+
+    pages->capacity = capacity;
+    return 0;
+}
+
+// collect the accessed pages of a frame
+static int read_frame(struct trace_reader *r, struct pages *pages,
+                      struct tier *tiers, size_t num_tiers) {
+    struct trace_vma vma;
+    int res;
+    while ((res = trace_next_vma(r, &vma)) == 0) {
+        if (!trace_is_process_vma(&vma))
+            continue;
+
+        size_t words = (vma.end - vma.start + TRACE_PAGES_PER_WORD - 1) / TRACE_PAGES_PER_WORD;
+        for (size_t w = 0; w < words; ++w) {
+            // accessed and softdirty pages have the high bit set
+            uint32_t word = vma.pages[w];
+            uint32_t accessed = word >> 1 & TRACE_LOW_BITS;
+            while (accessed) {
+                size_t bit = __builtin_ctz(accessed);
+                accessed &= accessed - 1;
+
+                int64_t id = page_index_get(&pages->idx, vma.start + w * TRACE_PAGES_PER_WORD + bit / 2);
+                if (id < 0)
+                    return 2;
+                res = reserve_pages(pages, tiers, num_tiers, id);
+                if (res != 0)
+                    return res;
+
+                if (pages->num_accessed == pages->accessed_capacity) {
+                    size_t capacity = pages->accessed_capacity ? pages->accessed_capacity * 2 : 1 << 16;
+                    res = grow((void**)&pages->accessed, pages->accessed_capacity * 4, capacity * 4);
+                    if (res != 0)
+                        return res;
+                    pages->accessed_capacity = capacity;
+                }
+                pages->accessed[pages->num_accessed++] = id;
+
+                SET_BIT(pages->frame_accessed, id);
+                if (word & 1U << bit)
+                    SET_BIT(pages->frame_dirty, id);
+            }
+        }
+    }
+
+    pages->accesses += pages->num_accessed;
+    return res == TRACE_END ? 0 : res;
+}
+
+static void promote(struct tier *tier, uint32_t id) {
+    SET_BIT(tier->fast, id);
+    tier->used++;
+    tier->promoted++;
+}
+
+static void demote(struct tier *tier, uint32_t id) {
+    CLEAR_BIT(tier->fast, id);
+    if (TEST_BIT(tier->dirty, id)) {
+        CLEAR_BIT(tier->dirty, id);
+        tier->written_back++;
+    }
+    tier->used--;
+    tier->demoted++;
+}
+
+// count the hits of a frame, and mark the pages written in the fast tier
+static void account(struct tier *tier, const struct pages *pages) {
+    for (size_t i = 0; i < pages->num_accessed; ++i) {
+        uint32_t id = pages->accessed[i];
+        if (!TEST_BIT(tier->fast, id))
+            continue;
+        tier->hits++;
+        if (TEST_BIT(pages->frame_dirty, id))
+            SET_BIT(tier->dirty, id);
+    }
+}
+
+// update an lru tier for an access, before the page is moved to the front of
+// the recency list. the fast tier holds the head of the list, up to the
+// boundary.
+static void lru_touch(struct tier *tier, const struct pages *pages, uint32_t id) {
+    if (TEST_BIT(tier->fast, id)) {
+        // the page before it becomes the least recently used one
+        if (id == tier->boundary && id != pages->head)
+            tier->boundary = pages->prev[id];
+        return;
+    }
+
+    // until the tier is full, it holds every page of the list and the
+    // boundary stays at the tail
+    if (tier->used == tier->capacity) {
+        uint32_t victim = tier->boundary;
+        tier->boundary = pages->prev[victim];
+        demote(tier, victim);
+    }
+    promote(tier, id);
+
+    if (tier->boundary == NIL)
+        tier->boundary = id;
+}
+
+static void lru_move_to_front(struct pages *pages, uint32_t id) {
+    if (pages->head == id)
+        return;
+
+    // unlink the page, if it is in the list
+    if (pages->prev[id] != NIL)
+        pages->next[pages->prev[id]] = pages->next[id];
+    if (pages->next[id] != NIL)
+        pages->prev[pages->next[id]] = pages->prev[id];
+    if (pages->tail == id)
+        pages->tail = pages->prev[id];
+
+    pages->prev[id] = NIL;
+    pages->next[id] = pages->head;
+    if (pages->head != NIL)
+        pages->prev[pages->head] = id;
+    pages->head = id;
+    if (pages->tail == NIL)
+        pages->tail = id;
+}
+
+static void update_lru(struct tier *tiers, size_t num_tiers, struct pages *pages) {
+    for (size_t t = 0; t < num_tiers; ++t) {
+        if (tiers[t].policy == POLICY_LRU)
+            account(&tiers[t], pages);
+    }
+
+    for (size_t i = 0; i < pages->num_accessed; ++i) {
+        uint32_t id = pages->accessed[i];
+        for (size_t t = 0; t < num_tiers; ++t) {
+            if (tiers[t].policy == POLICY_LRU)
+                lru_touch(&tiers[t], pages, id);
+        }
+        lru_move_to_front(pages, id);
+    }
+}
+
+// place the pages with the highest access counts in the fast tier. ties at
+// the threshold are broken in favor of pages already there.
+static void place_frequent(struct tier *tier, const struct pages *pages,
+                           const size_t *histogram, size_t num_pages) {
+    // the count at which the tier fills up, and the slots for pages with it
+    size_t above = 0;
+    size_t threshold = 0;
+    size_t slots = 0;
+    for (size_t c = 255; c >= 1; --c) {
+        if (above + histogram[c] > tier->capacity) {
+            threshold = c;
+            slots = tier->capacity - above;
+            break;
+        }
+        above += histogram[c];
+    }
+    if (!threshold) {
+        // every page with a count fits
+        threshold = 1;
+        slots = histogram[1];
+    }
+
+    size_t fast_at_threshold = 0;
+    for (size_t w = 0; w < BIT_WORDS(num_pages); ++w) {
+        uint64_t bits = tier->fast[w];
+        while (bits) {
+            size_t id = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            fast_at_threshold += pages->counts[id] == threshold;
+        }
+    }
+
+    size_t keep = fast_at_threshold < slots ? fast_at_threshold : slots;
+    size_t add = slots - keep;
+
+    for (size_t id = 0; id < num_pages; ++id) {
+        uint8_t c = pages->counts[id];
+        int fast = TEST_BIT(tier->fast, id);
+
+        int wanted = c > threshold;
+        if (c == threshold && fast && keep > 0) {
+            wanted = 1;
+            keep--;
+        } else if (c == threshold && !fast && add > 0) {
+            wanted = 1;
+            add--;
+        }
+
+        if (fast && !wanted)
+            demote(tier, id);
+        else if (!fast && wanted)
+            promote(tier, id);
+    }
+}
+
+static void update_frequency(struct tier *tiers, size_t num_tiers, struct pages *pages,
+                             size_t frame) {
+    for (size_t t = 0; t < num_tiers; ++t) {
+        if (tiers[t].policy == POLICY_FREQUENCY)
+            account(&tiers[t], pages);
+    }
+
+    size_t num_pages = pages->idx.len;
+    for (size_t i = 0; i < pages->num_accessed; ++i) {
+        uint32_t id = pages->accessed[i];
+        if (pages->counts[id] < 255)
+            pages->counts[id]++;
+    }
+    if ((frame + 1) % arguments.decay == 0) {
+        for (size_t id = 0; id < num_pages; ++id)
+            pages->counts[id] >>= 1;
+    }
+
+    size_t histogram[256] = { 0 };
+    for (size_t id = 0; id < num_pages; ++id)
+        histogram[pages->counts[id]]++;
+
+    for (size_t t = 0; t < num_tiers; ++t) {
+        if (tiers[t].policy == POLICY_FREQUENCY)
+            place_frequent(&tiers[t], pages, histogram, num_pages);
+    }
+}
+
+// place the pages accessed in the frame in the fast tier before it, keeping
+// pages already there where possible. pages to make room for them are taken
+// round-robin, so no part of the address space is favored.
+static void update_oracle(struct tier *tier, const struct pages *pages) {
+    size_t keep = 0;
+    for (size_t i = 0; i < pages->num_accessed; ++i)
+        keep += TEST_BIT(tier->fast, pages->accessed[i]);
+
+    size_t newcomers = pages->num_accessed - keep;
+    size_t room = tier->capacity - keep;
+    size_t promotions = newcomers < room ? newcomers : room;
+    size_t free_slots = tier->capacity - tier->used;
+    size_t demotions = promotions > free_slots ? promotions - free_slots : 0;
+
+    size_t words = BIT_WORDS(pages->idx.len);
+    size_t w = tier->cursor;
+    while (demotions > 0) {
+        if (w >= words)
+            w = 0;
+        uint64_t candidates = tier->fast[w] & ~pages->frame_accessed[w];
+        while (candidates && demotions > 0) {
+            demote(tier, w * 64 + __builtin_ctzll(candidates));
+            candidates &= candidates - 1;
+            demotions--;
+        }
+        if (demotions > 0)
+            w++;
+    }
+    tier->cursor = w;
+
+    for (size_t i = 0; i < pages->num_accessed && promotions > 0; ++i) {
+        uint32_t id = pages->accessed[i];
+        if (!TEST_BIT(tier->fast, id)) {
+            promote(tier, id);
+            promotions--;
+        }
+    }
+
+    account(tier, pages);
+}
+
+int main(int argc, char *argv[]) {
+    detect_system();
+
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    int any_policy = 0;
+    for (int p = 0; p < NUM_POLICIES; ++p)
+        any_policy |= arguments.policies[p];
+
+    size_t num_tiers = 0;
+    struct tier *tiers = calloc(NUM_POLICIES * arguments.num_capacities, sizeof(*tiers));
+    if (!tiers) {
+        perror("calloc");
+        return 2;
+    }
+    for (int p = 0; p < NUM_POLICIES; ++p) {
+        if (any_policy && !arguments.policies[p])
+            continue;
+        for (size_t c = 0; c < arguments.num_capacities; ++c) {
+            struct tier *tier = &tiers[num_tiers++];
+            tier->policy = p;
+            tier->capacity = arguments.capacities[c] / g_system_pagesize;
+            tier->boundary = NIL;
+        }
+    }
+
+    struct trace_reader r;
+    int res = trace_open(&r, arguments.tracefile);
+    if (res != 0)
+        return res;
+
+    struct pages pages = { 0 };
+    pages.head = NIL;
+    pages.tail = NIL;
+
+    size_t num_frames = 0;
+    struct timeval timestamp;
+    uint32_t num_vmas;
+    while ((res = trace_next_frame(&r, &timestamp, &num_vmas)) == 0) {
+        res = read_frame(&r, &pages, tiers, num_tiers);
+        if (res != 0)
+            return res;
+
+        if (!any_policy || arguments.policies[POLICY_LRU])
+            update_lru(tiers, num_tiers, &pages);
+        if (!any_policy || arguments.policies[POLICY_FREQUENCY])
+            update_frequency(tiers, num_tiers, &pages, num_frames);
+        for (size_t t = 0; t < num_tiers; ++t) {
+            if (tiers[t].policy == POLICY_ORACLE)
+                update_oracle(&tiers[t], &pages);
+        }
+
+        for (size_t i = 0; i < pages.num_accessed; ++i) {
+            CLEAR_BIT(pages.frame_accessed, pages.accessed[i]);
+            CLEAR_BIT(pages.frame_dirty, pages.accessed[i]);
+        }
+        pages.num_accessed = 0;
+        num_frames++;
+    }
+    if (res != TRACE_END)
+        return res;
+
+    printf("# %zu frames, %zu pages accessed, %zu page accesses\n",
+           num_frames, pages.idx.len, pages.accesses);
+    printf("# %-10s %14s %9s %16s %16s %16s\n",
+           "policy", "capacity B", "hit rate", "promoted B", "demoted B", "written back B");
+    for (size_t t = 0; t < num_tiers; ++t) {
+        struct tier *tier = &tiers[t];
+        printf("%-12s %14zu %9.4f %16zu %16zu %16zu\n",
+               policy_names[tier->policy], tier->capacity * g_system_pagesize,
+               pages.accesses ? (double)tier->hits / pages.accesses : 0,
+               tier->promoted * g_system_pagesize, tier->demoted * g_system_pagesize,
+               tier->written_back * g_system_pagesize);
+    }
+
+    for (size_t t = 0; t < num_tiers; ++t) {
+        free(tiers[t].fast);
+        free(tiers[t].dirty);
+    }
+    free(tiers);
+    free(pages.counts);
+    free(pages.prev);
+    free(pages.next);
+    free(pages.accessed);
+    free(pages.frame_accessed);
+    free(pages.frame_dirty);
+    page_index_destroy(&pages.idx);
+    trace_close(&r);
+    free(arguments.capacities);
+
+    return 0;
+}
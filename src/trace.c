@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#include "./trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const size_t READ_BUFFER = 1 << 20;
+
+int trace_open(struct trace_reader *r, const char *path) {
+    memset(r, 0, sizeof(*r));
+
+    r->path = strdup(path);
+    if (!r->path) {
+        perror("strdup");
+        return 2;
+    }
+
+    r->f = fopen(path, "r");
+    if (!r->f) {
+        fprintf(stderr, "%s: ", path);
+        perror("fopen");
+        return 1;
+    }
+    setvbuf(r->f, NULL, _IOFBF, READ_BUFFER);
+
+    return 0;
+}
+
+// read a field, distinguishing the clean end of a trace from a truncated one
+static int read_field(struct trace_reader *r, void *buf, size_t len, int at_boundary) {
+    if (fread(buf, len, 1, r->f) == 1)
+        return 0;
+
+    if (ferror(r->f)) {
+        fprintf(stderr, "%s: ", r->path);
+        perror("fread");
+        return 1;
+    }
+    if (at_boundary && feof(r->f))
+        return TRACE_END;
+
+    fprintf(stderr, "%s: truncated trace\n", r->path);
+    return 1;
+}
+
+int trace_next_frame(struct trace_reader *r, struct timeval *timestamp, uint32_t *num_vmas) {
+    struct trace_vma vma;
+    while (r->vmas_left > 0) {
+        int res = trace_next_vma(r, &vma);
+        if (res != 0)
+            return res;
+    }
+
+    uint32_t header[3];
+    int res = read_field(r, header, sizeof(header[0]), 1);
+    if (res != 0)
+        return res;
+    res = read_field(r, header + 1, sizeof(header) - sizeof(header[0]), 0);
+    if (res != 0)
+        return res;
+
+    timestamp->tv_sec = header[0];
+    timestamp->tv_usec = header[1];
+    *num_vmas = header[2];
+    r->vmas_left = header[2];
+
+    return 0;
+}
+
+// make sure a buffer holds at least the given number of elements
+static int reserve(void **buf, size_t *capacity, size_t n, size_t size) {
+    if (n <= *capacity)
+        return 0;
+
+    size_t new_capacity = *capacity ? *capacity : 64;
+    while (new_capacity < n)
+        new_capacity *= 2;
+
+    void *new_buf = realloc(*buf, new_capacity * size);
+    if (!new_buf) {
+        perror("realloc");
+        return 2;
+    }
+    *buf = new_buf;
+    *capacity = new_capacity;
+    return 0;
+}
+
+int trace_next_vma(struct trace_reader *r, struct trace_vma *vma) {
+    if (r->vmas_left == 0)
+        return TRACE_END;
+
+    uint64_t range[2];
+    uint32_t name_length;
+    int res = read_field(r, range, sizeof(range), 0);
+    if (res == 0)
+        res = read_field(r, &name_length, sizeof(name_length), 0);
+    if (res != 0)
+        return res;
+
+    int extended = !!(range[1] & TRACE_VMA_EXTENDED);
+    range[1] &= ~TRACE_VMA_EXTENDED;
+
+    if (range[1] <= range[0] || name_length == 0) {
+        fprintf(stderr, "%s: corrupt VMA record\n", r->path);
+        return 1;
+    }
+
+    res = reserve((void**)&r->name, &r->name_capacity, name_length, 1);
+    if (res == 0)
+        res = read_field(r, r->name, name_length, 0);
+    if (res != 0)
+        return res;
+    r->name[name_length - 1] = 0;
+
+    // later versions of the extension only append fields, which are skipped
+    vma->has_times = 0;
+    if (extended) {
+        uint32_t extension[2];
+        res = read_field(r, extension, sizeof(extension), 0);
+        if (res != 0)
+            return res;
+        if (extension[0] < 1 || extension[1] < TRACE_VMA_EXTENSION_LENGTH
+                || extension[1] > 1 << 16) {
+            fprintf(stderr, "%s: corrupt VMA record\n", r->path);
+            return 1;
+        }
+
+        uint32_t times[3];
+        res = read_field(r, times, sizeof(times), 0);
+        if (res != 0)
+            return res;
+        if (fseek(r->f, extension[1] - sizeof(times), SEEK_CUR) != 0) {
+            fprintf(stderr, "%s: ", r->path);
+            perror("fseek");
+            return 1;
+        }
+
+        vma->has_times = 1;
+        vma->scan_start_us = times[0];
+        vma->scan_end_us = times[1];
+        vma->window_us = times[2];
+    }
+
+    size_t words = (range[1] - range[0] + TRACE_PAGES_PER_WORD - 1) / TRACE_PAGES_PER_WORD;
+    res = reserve((void**)&r->pages, &r->pages_capacity, words, sizeof(*r->pages));
+    if (res == 0)
+        res = read_field(r, r->pages, words * sizeof(*r->pages), 0);
+    if (res != 0)
+        return res;
+
+    vma->start = range[0];
+    vma->end = range[1];
+    vma->name = r->name;
+    vma->pages = r->pages;
+
+    r->vmas_left--;
+    return 0;
+}
+
+void trace_close(struct trace_reader *r) {
+    if (r->f)
+        fclose(r->f);
+    free(r->path);
+    free(r->name);
+    free(r->pages);
+    memset(r, 0, sizeof(*r));
+}
+
+int trace_is_process_vma(const struct trace_vma *vma) {
+    return strncmp(vma->name, "[pagecache:", 11) != 0;
+}
+
+static size_t page_hash(uint64_t page, size_t capacity) {
+    return (page * 0x9e3779b97f4a7c15ULL) >> 32 & (capacity - 1);
+}
+
+static int page_index_grow(struct page_index *idx) {
+    size_t capacity = idx->capacity ? idx->capacity * 2 : 1024;
+    uint64_t *keys = calloc(capacity, sizeof(*keys));
+    uint32_t *ids = malloc(capacity * sizeof(*ids));
+    if (!keys || !ids) {
+        perror("calloc");
+        free(keys);
+        free(ids);
+        return 2;
+    }
+
+    for (size_t i = 0; i < idx->capacity; ++i) {
+        if (!idx->keys[i])
+            continue;
+        size_t h = page_hash(idx->keys[i], capacity);
+        while (keys[h])
+            h = (h + 1) & (capacity - 1);
+        keys[h] = idx->keys[i];
+        ids[h] = idx->ids[i];
+    }
+
+    free(idx->keys);
+    free(idx->ids);
+    idx->keys = keys;
+    idx->ids = ids;
+    idx->capacity = capacity;
+    return 0;
+}
+
+int64_t page_index_get(struct page_index *idx, uint64_t page) {
+    // keys are stored off by one, so zero marks free slots
+    uint64_t key = page + 1;
+
+    if (2 * (idx->len + 1) > idx->capacity && page_index_grow(idx) != 0)
+        return -1;
+
+    size_t h = page_hash(key, idx->capacity);
+    while (idx->keys[h]) {
+        if (idx->keys[h] == key)
+            return idx->ids[h];
+        h = (h + 1) & (idx->capacity - 1);
+    }
+
+    if (idx->len >= UINT32_MAX) {
+        fprintf(stderr, "page_index: too many pages\n");
+        return -1;
+    }
+
+    idx->keys[h] = key;
+    idx->ids[h] = idx->len;
+    return idx->len++;
+}
+
+void page_index_destroy(struct page_index *idx) {
+    free(idx->keys);
+    free(idx->ids);
+    memset(idx, 0, sizeof(*idx));
+}
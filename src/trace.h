@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+// the states of a page in a tracefile, two bits each, see output_format.txt
+#define TRACE_PAGE_NOT_PRESENT 0x0
+#define TRACE_PAGE_IDLE 0x1
+#define TRACE_PAGE_ACCESSED 0x2
+#define TRACE_PAGE_SOFTDIRTY 0x3
+
+#define TRACE_PAGES_PER_WORD 16
+
+// masks of the low bit of every page in a word of page states
+#define TRACE_LOW_BITS 0x55555555U
+
+// returned by the reader at the end of a tracefile
+#define TRACE_END (-1)
+
+// set in the end address of a VMA record whose header is extended
+#define TRACE_VMA_EXTENDED (1ULL << 63)
+
+// the version of the VMA header extension written, and its length in bytes
+#define TRACE_VMA_EXTENSION_VERSION 1
+#define TRACE_VMA_EXTENSION_LENGTH 12
+
+struct trace_vma {
+    // addresses in pages
+    uint64_t start;
+    uint64_t end;
+    const char *name;
+
+    // from the extended header, when the VMA was read relative to the
+    // timestamp of the frame, and the time its pages were counted over
+    int has_times;
+    uint32_t scan_start_us;
+    uint32_t scan_end_us;
+    uint32_t window_us;
+
+    // TRACE_PAGES_PER_WORD page states per word, least significant first
+    const uint32_t *pages;
+};
+
+struct trace_reader {
+    char *path;
+    FILE *f;
+
+    // the VMAs left in the current frame
+    uint32_t vmas_left;
+
+    char *name;
+    size_t name_capacity;
+    uint32_t *pages;
+    size_t pages_capacity;
+};
+
+int trace_open(struct trace_reader *r, const char *path);
+
+// advance to the next frame, skipping what is left of the current one
+int trace_next_frame(struct trace_reader *r, struct timeval *timestamp, uint32_t *num_vmas);
+
+// read the next VMA of the current frame, valid until the next call
+int trace_next_vma(struct trace_reader *r, struct trace_vma *vma);
+
+void trace_close(struct trace_reader *r);
+
+// the state of a page of a VMA
+static inline unsigned trace_page(const struct trace_vma *vma, size_t page) {
+    return (vma->pages[page / TRACE_PAGES_PER_WORD] >> (page % TRACE_PAGES_PER_WORD * 2)) & 0x3;
+}
+
+// whether a VMA holds memory of the process, rather than the page cache
+// tracked alongside it
+int trace_is_process_vma(const struct trace_vma *vma);
+
+// a hash map from page addresses to dense ids, which are assigned in the
+// order pages are first looked up
+struct page_index {
+    uint64_t *keys;
+    uint32_t *ids;
+    size_t capacity;
+    size_t len;
+};
+
+// look up the id of a page, adding it if unknown. returns -1 on failure.
+int64_t page_index_get(struct page_index *idx, uint64_t page);
+
+void page_index_destroy(struct page_index *idx);
+
+#endif  // TRACE_H_
@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#include "./trigger.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "./util.h"
+
+// defaults of a burst
+#define TRIGGER_FRAMES 50
+#define TRIGGER_RING 10
+
+static int parse_count(const char *arg, size_t *n) {
+    char *end;
+    errno = 0;
+    *n = strtoull(arg, &end, 0);
+    return errno != 0 || end == arg || *end;
+}
+
+static int parse_rate(const char *arg, double *rate) {
+    char *end;
+    errno = 0;
+    *rate = strtod(arg, &end);
+    return errno != 0 || end == arg || *end || *rate <= 0;
+}
+
+static int parse_term(struct trigger_config *config, const char *term) {
+    if (!strncmp(term, "rate=", 5))
+        return parse_rate(term + 5, &config->rate);
+    if (!strncmp(term, "vma-rate=", 9))
+        return parse_rate(term + 9, &config->vma_rate);
+    if (!strncmp(term, "growth=", 7)) {
+        size_t bytes;
+        if (parse_size(term + 7, &bytes) != 0 || !bytes)
+            return 1;
+        config->growth = (bytes + g_system_pagesize - 1) / g_system_pagesize;
+        return 0;
+    }
+    if (!strncmp(term, "interval=", 9))
+        return parse_count(term + 9, &config->interval) || !config->interval;
+    if (!strncmp(term, "frames=", 7))
+        return parse_count(term + 7, &config->frames) || !config->frames;
+    if (!strncmp(term, "ring=", 5))
+        return parse_count(term + 5, &config->ring);
+    return 1;
+}
+
+int trigger_parse(struct trigger_config *config, const char *spec) {
+    memset(config, 0, sizeof(*config));
+    config->frames = TRIGGER_FRAMES;
+    config->ring = TRIGGER_RING;
+
+    char *terms = strdup(spec);
+    if (!terms) {
+        perror("strdup");
+        return 2;
+    }
+
+    int res = 0;
+    char *saveptr;
+    for (char *term = strtok_r(terms, ",", &saveptr); term && res == 0;
+            term = strtok_r(NULL, ",", &saveptr)) {
+        res = parse_term(config, term);
+        if (res == 1)
+            fprintf(stderr, "invalid trigger term: %s\n", term);
+    }
+
+    free(terms);
+    return res;
+}
+
+int trigger_enabled(const struct trigger_config *config) {
+    return config->rate > 0 || config->vma_rate > 0 || config->growth;
+}
+
+int trigger_init(struct trigger *t, const struct trigger_config *config) {
+    memset(t, 0, sizeof(*t));
+    t->config = *config;
+
+    if (config->ring) {
+        t->ring = calloc(config->ring, sizeof(*t->ring));
+        if (!t->ring) {
+            perror("calloc");
+            return 2;
+        }
+    }
+
+    return 0;
+}
+
+struct trace_buffer *trigger_begin_frame(struct trigger *t) {
+    t->buffering = !t->burst_left;
+    t->current.len = 0;
+    return &t->current;
+}
+
+int trace_buffer_append(struct trace_buffer *b, const void *data, size_t len) {
+    if (b->len + len > b->capacity) {
+        size_t capacity = b->capacity ? b->capacity : 1 << 16;
+        while (capacity < b->len + len)
+            capacity *= 2;
+        char *new_data = realloc(b->data, capacity);
+        if (!new_data) {
+            perror("realloc");
+            return 2;
+        }
+        b->data = new_data;
+        b->capacity = capacity;
+    }
+
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    return 0;
+}
+
+static int write_buffer(int trace_fd, const struct trace_buffer *b) {
+    size_t written = 0;
+    while (written < b->len) {
+        ssize_t bytes = write(trace_fd, b->data + written, b->len - written);
+        if (bytes < 0) {
+            perror("write");
+            return 1;
+        }
+        written += bytes;
+    }
+    return 0;
+}
+
+// the kept frames, oldest first, and then the current one
+static int flush(struct trigger *t, int trace_fd) {
+    size_t oldest = t->len < t->config.ring ? 0 : t->next;
+    for (size_t k = 0; k < t->len; ++k) {
+        int res = write_buffer(trace_fd, &t->ring[(oldest + k) % t->config.ring]);
+        if (res != 0)
+            return res;
+    }
+    t->len = 0;
+    t->next = 0;
+
+    int res = write_buffer(trace_fd, &t->current);
+    if (res != 0)
+        return res;
+
+    res = fsync(trace_fd);
+    if (res != 0)
+        perror("fsync");
+    return 0;
+}
+
+// keep the current frame in place of the oldest, reusing its memory
+static void keep(struct trigger *t) {
+    if (!t->config.ring)
+        return;
+
+    struct trace_buffer oldest = t->ring[t->next];
+    t->ring[t->next] = t->current;
+    t->current = oldest;
+    t->current.len = 0;
+
+    t->next = (t->next + 1) % t->config.ring;
+    if (t->len < t->config.ring)
+        t->len++;
+}
+
+// describe the first condition met by a frame, if any
+static int check(struct trigger *t, const struct smog_ctx *ctx,
+                 const struct smog_frame *frame, char *reason, size_t size) {
+    const struct trigger_config *c = &t->config;
+
+    if (c->rate > 0 && frame->elapsed_ms) {
+        double rate = frame->softdirty * 1000.0 / frame->elapsed_ms;
+        if (rate >= c->rate) {
+            snprintf(reason, size, "dirty rate of %.0f/s", rate);
+            return 1;
+        }
+    }
+
+    // per VMA, over the time its pages were counted
+    if (c->vma_rate > 0) {
+        for (size_t i = 0; i < frame->num_vmas; ++i) {
+            const struct smog_vma_times *times = smog_vma_times(ctx, i);
+            double elapsed_ms = times ? times->window_us / 1000.0 : frame->elapsed_ms;
+            if (elapsed_ms <= 0)
+                continue;
+            double rate = frame->vma_softdirty[i] * 1000.0 / elapsed_ms;
+            if (rate >= c->vma_rate) {
+                snprintf(reason, size, "dirty rate of %.0f/s in VMA #%zu %s",
+                         rate, i, smog_vma_pathname(ctx, i));
+                return 1;
+            }
+        }
+    }
+
+    if (c->growth && t->prev_committed && frame->committed >= t->prev_committed + c->growth) {
+        size_t growth = frame->committed - t->prev_committed;
+        snprintf(reason, size, "growth of %zu committed pages (%s)",
+                 growth, format_size_string(growth * g_system_pagesize));
+        return 1;
+    }
+
+    return 0;
+}
+
+int trigger_end_frame(struct trigger *t, const struct smog_ctx *ctx,
+                      const struct smog_frame *frame, int trace_fd) {
+    char reason[256];
+    int fired = check(t, ctx, frame, reason, sizeof(reason));
+    t->prev_committed = frame->committed;
+
+    if (!fired) {
+        if (t->buffering) {
+            keep(t);
+            return 0;
+        }
+        t->burst_left--;
+    } else if (t->buffering) {
+        printf("Trigger:   %s, writing %zu earlier frames and a burst of %zu at %zu ms\n",
+               reason, t->len, t->config.frames, t->config.interval);
+        t->burst_left = t->config.frames;
+    } else {
+        printf("Trigger:   %s, extending the burst to %zu more frames\n",
+               reason, t->config.frames);
+        t->burst_left = t->config.frames;
+    }
+
+    // frames of a burst are written as a whole, the ring is empty then
+    return flush(t, trace_fd);
+}
+
+uint64_t trigger_interval(const struct trigger *t, uint64_t delay) {
+    return t->burst_left ? t->config.interval : delay;
+}
+
+void trigger_destroy(struct trigger *t) {
+    for (size_t k = 0; k < t->config.ring; ++k)
+        free(t->ring[k].data);
+    free(t->ring);
+    free(t->current.data);
+    memset(t, 0, sizeof(*t));
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2022 - 2023 OSM Group @ HPI, University of Potsdam
+ */
+
+#ifndef TRIGGER_H_
+#define TRIGGER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "./smogmeter.h"
+
+// the conditions that start a burst, any of which suffices, and its shape.
+// conditions of zero are disabled.
+struct trigger_config {
+    // softdirty pages per second of the process, and of any VMA
+    double rate;
+    double vma_rate;
+    // committed pages gained since the previous frame
+    size_t growth;
+
+    // the interval of the frames of a burst in milliseconds, and their number
+    size_t interval;
+    size_t frames;
+    // the number of frames before a trigger kept in memory
+    size_t ring;
+};
+
+// the trace records of a frame, held back until it is known whether they
+// precede a trigger
+struct trace_buffer {
+    char *data;
+    size_t len;
+    size_t capacity;
+};
+
+struct trigger {
+    struct trigger_config config;
+
+    // the last frames without a trigger, the oldest at next once full
+    struct trace_buffer *ring;
+    size_t len;
+    size_t next;
+
+    // the frame being written, and whether it is from before a trigger
+    struct trace_buffer current;
+    int buffering;
+
+    // the frames of the burst still to be taken
+    size_t burst_left;
+
+    size_t prev_committed;
+};
+
+// parse comma-separated terms: rate=PAGES, vma-rate=PAGES, growth=SIZE,
+// interval=MILLIS, frames=N and ring=N
+int trigger_parse(struct trigger_config *config, const char *spec);
+
+int trigger_enabled(const struct trigger_config *config);
+
+int trigger_init(struct trigger *t, const struct trigger_config *config);
+
+// the buffer the trace of the next frame goes to
+struct trace_buffer *trigger_begin_frame(struct trigger *t);
+
+int trace_buffer_append(struct trace_buffer *b, const void *data, size_t len);
+
+// check the conditions against a frame. on a trigger, the kept frames and
+// this one are written to trace_fd and a burst begins, whose frames are
+// written as they end. other frames are kept in place of the oldest.
+int trigger_end_frame(struct trigger *t, const struct smog_ctx *ctx,
+                      const struct smog_frame *frame, int trace_fd);
+
+// the interval until the next frame, in milliseconds
+uint64_t trigger_interval(const struct trigger *t, uint64_t delay);
+
+void trigger_destroy(struct trigger *t);
+
+#endif  // TRIGGER_H_
@@ -9,6 +9,16 @@
 #include <stdarg.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+
+size_t g_system_pagesize = 0;
+size_t g_system_physical_pages = 0;
+
+void detect_system(void) {
+    g_system_pagesize = sysconf(_SC_PAGE_SIZE);
+    g_system_physical_pages = sysconf(_SC_PHYS_PAGES);
+}
 
 char *format_size_string(size_t s) {
     static char *buffer = NULL;
@@ -59,6 +69,32 @@ char *makestr(const char *format, ...) {
     return buf;
 }
 
+int parse_size(const char *arg, size_t *size) {
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(arg, &end, 0);
+    if (errno != 0 || end == arg)
+        return 1;
+
+    switch (*end) {
+        case 'G': case 'g':
+            value *= 1024;
+            // fall through
+        case 'M': case 'm':
+            value *= 1024;
+            // fall through
+        case 'K': case 'k':
+            value *= 1024;
+            end++;
+            break;
+    }
+    if (*end)
+        return 1;
+
+    *size = value;
+    return 0;
+}
+
 int parse_smaps(const char *path) {
     FILE *f = fopen(path, "r");
     if (!f) {
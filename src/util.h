@@ -7,10 +7,19 @@
 
 #include <stddef.h>
 
+// system characteristics
+extern size_t g_system_pagesize;
+extern size_t g_system_physical_pages;
+
+void detect_system(void);
+
 char *format_size_string(size_t s);
 
 char *makestr(const char *format, ...);
 
+// parse a size with an optional K, M or G suffix, in powers of 1024
+int parse_size(const char *arg, size_t *size);
+
 int parse_smaps(const char *path);
 
 #define TIMEVAL_FROM_MILLIS(M) { (M) / 1000, ((M) % 1000) * 1000 }
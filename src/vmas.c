@@ -8,61 +8,148 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <ctype.h>
 
 #include "./util.h"
-#include "./smog-meter.h"
 
-static int filter_cmp(char *pattern, char *str) {
-    int n = strlen(str);
-    int m = strlen(pattern);
+static int reserve_vmas(struct vma_table *table, size_t capacity) {
+    if (capacity <= table->capacity)
+        return 0;
+
+    size_t new_capacity = table->capacity ? table->capacity : 64;
+    while (new_capacity < capacity)
+        new_capacity *= 2;
+
+#define GROW(FIELD) do { \
+    void *p = realloc(table->FIELD, sizeof(*table->FIELD) * new_capacity); \
+    if (!p) { \
+        perror("realloc"); \
+        return 2; \
+    } \
+    table->FIELD = p; \
+} while (0)
+
+    GROW(start);
+    GROW(end);
+    GROW(committed);
+    GROW(accessed);
+    GROW(softdirty);
+    GROW(info);
+
+#undef GROW
+
+    table->capacity = new_capacity;
+    return 0;
+}
 
-    int i = 0, j = 0, startIndex = -1, match = 0;
+static void print_vma(const char *what, size_t i, size_t start, size_t end, const char *pathname) {
+    printf("  %s VMA: #%zu: %#zx ... %#zx (%zu Pages, %s) %s\n",
+           what, i, start, end, end - start,
+           format_size_string((end - start) * g_system_pagesize),
+           pathname);
+}
 
-    while (i < n) {
-        if (j < m && (pattern[j] == '?' || pattern[j] == str[i])) {
-            // Characters match or '?' in pattern matches any character.
-            i++;
-            j++;
-        }
-        else if (j < m && pattern[j] == '*') {
-            // Wildcard character '*', mark the current position in the pattern and the text as a proper match.
-            startIndex = j;
-            match = i;
-            j++;
-        }
-        else if (startIndex != -1) {
-            // No match, but a previous wildcard was found. Backtrack to the last '*' character position and try for a different match.
-            j = startIndex + 1;
-            match++;
-            i = match;
-        }
-        else {
-            // If none of the above cases comply, the pattern does not match.
-            return -1;
-        }
+// the pages present in the last frame a VMA was read in
+static size_t committed_pages(const struct vma_info *info) {
+    size_t n = 0;
+    if (info->planes) {
+        size_t words = (info->planes_end - info->planes_start + 63) / 64;
+        for (size_t k = 0; k < words; ++k)
+            n += __builtin_popcountll(info->planes[k]);
     }
+    return n;
+}
+
+static void free_vma_info(struct vma_info *info) {
+    free(info->nodes);
+    free(info->blocks);
+    free(info->windows);
+    free(info->window_epochs);
+    free(info->window_bits);
+    free(info->planes);
+    rolling_destroy(info->rolling);
+    free(info->pathname);
+}
+
+static void clear_exclusions(struct vma_exclusions *excluded, size_t from) {
+    for (size_t k = from; k < excluded->len; ++k)
+        free(excluded->entries[k].pathname);
+    excluded->len = 0;
+}
 
-    // Consume any remaining '*' characters in the given pattern.
-    while (j < m && pattern[j] == '*') {
-        j++;
+static int exclude_vma(struct vma_exclusions *excluded, size_t start, size_t end,
+                       const char *perms, unsigned filter_id, char *pathname) {
+    if (excluded->len == excluded->capacity) {
+        size_t capacity = excluded->capacity ? excluded->capacity * 2 : 64;
+        struct vma_exclusion *entries = realloc(excluded->entries, capacity * sizeof(*entries));
+        if (!entries) {
+            perror("realloc");
+            return 2;
+        }
+        excluded->entries = entries;
+        excluded->capacity = capacity;
     }
 
-    // If we have reached the end of both the pattern and the text, the pattern matches the text.
-    return j - m;
+    struct vma_exclusion *e = &excluded->entries[excluded->len++];
+    e->start = start;
+    e->end = end;
+    strcpy(e->perms, perms);
+    e->filter_id = filter_id;
+    e->pathname = pathname;
+    return 0;
 }
 
-int update_vmas(const char *path, struct vma **buf, size_t *len, char *vma_filter) {
-    // parse all VMAs from /proc/<pid>/maps
-    struct vma *vmas = *buf;
-    size_t num_vmas = *len;
-    size_t i = 0;
+// on errors, drop all state rather than leaving VMAs owned by both tables
+static int abort_merge(struct vma_table *old, struct vma_table *new, size_t o, size_t xo,
+                       int res) {
+    for (; o < old->len; ++o)
+        free_vma_info(&old->info[o]);
+    for (size_t i = 0; i < new->len; ++i)
+        free_vma_info(&new->info[i]);
+    old->len = 0;
+    new->len = 0;
+    clear_exclusions(&old->excluded, xo);
+    clear_exclusions(&new->excluded, 0);
+
+    return res;
+}
 
-    FILE *f = fopen(path, "r");
-    if (!f) {
-        fprintf(stderr, "%s: ", path);
-        perror("fopen");
+// decide whether the filter selects a VMA. the decision is taken from the
+// previous update if the VMA did not change since, which is the common case.
+static int select_vma(const struct vma_filter *filter, const struct vma_table *old,
+                      size_t o, const struct vma_exclusion *excluded,
+                      size_t start, size_t end, const char *perms, const char *name) {
+    if (excluded && excluded->filter_id == filter->id
+            && excluded->start == start && excluded->end == end
+            && !strcmp(excluded->perms, perms) && !strcmp(excluded->pathname, name))
+        return 0;
+
+    if (o < old->len && old->info[o].filter_id == filter->id
+            && old->start[o] == start && old->end[o] == end
+            && !strcmp(old->info[o].perms, perms) && !strcmp(old->info[o].pathname, name))
         return 1;
+
+    return filter_match(filter, start, end, perms, name);
+}
+
+int update_vmas(FILE *f, struct vma_table *table, const struct vma_filter *filter, int verbose) {
+    // the previous VMAs are merged with the ones parsed from
+    // /proc/<pid>/maps into the spare table. both are sorted by address, so
+    // this takes a single pass over each.
+    if (!table->spare) {
+        table->spare = calloc(1, sizeof(*table->spare));
+        if (!table->spare) {
+            perror("calloc");
+            return 2;
+        }
     }
+    struct vma_table *old = table;
+    struct vma_table *new = table->spare;
+    size_t o = 0;
+    size_t xo = 0;
+    new->len = 0;
+    new->excluded.len = 0;
+    new->lost_committed = 0;
 
     char buffer[4096];
     int lines_read = 0;
@@ -86,8 +173,8 @@ int update_vmas(const char *path, struct vma **buf, size_t *len, char *vma_filte
                        &length);
 
         if (n < 10) {
-            fprintf(stderr, "%s:%d: unexpected line: \"%s\"\n", path, lines_read, buffer);
-            return 1;
+            fprintf(stderr, "maps:%d: unexpected line: \"%s\"\n", lines_read, buffer);
+            return abort_merge(old, new, o, xo, 1);
         }
 
         char *name = buffer + length;
@@ -95,101 +182,134 @@ int update_vmas(const char *path, struct vma **buf, size_t *len, char *vma_filte
             name++;
         name[strlen(name) - 1] = 0;
 
-        struct vma vma = {
-            vm_start / g_system_pagesize,
-            vm_end / g_system_pagesize,
-            0, 0, 0,
-            strdup(name),
-        };
-
-        if (vma_filter && filter_cmp(vma_filter, vma.pathname)) {
-            if (arguments.verbose) {
-                printf("  filtered VMA: #%zu: %#zx ... %#zx (%zu Pages, %s) %s\n",
-                       i, vma.start, vma.end, vma.end - vma.start,
-                       format_size_string((vma.end - vma.start) * g_system_pagesize),
-                       vma.pathname);
-            }
-        } else if (i >= num_vmas) {
-            // add to the end, probably only used in first pass
-            vmas = realloc(vmas, sizeof(*vmas) * (num_vmas + 1));
-            if (!vmas) {
-                perror("realloc");
-                return 2;
-            }
-            vmas[i] = vma;
-            if (arguments.verbose) {
-                printf("  appended new VMA: #%zu: %#zx ... %#zx (%zu Pages, %s) %s\n",
-                       i, vmas[i].start, vmas[i].end, vmas[i].end - vmas[i].start,
-                       format_size_string((vmas[i].end - vmas[i].start) * g_system_pagesize),
-                       vmas[i].pathname);
+        size_t start = vm_start / g_system_pagesize;
+        size_t end = vm_end / g_system_pagesize;
+        char perms[5] = { r, w, x, s, 0 };
+
+        // every previous VMA that ends before this one is gone
+        while (o < old->len && old->end[o] <= start) {
+            if (verbose) {
+                print_vma("lost", o, old->start[o], old->end[o], old->info[o].pathname);
             }
-            num_vmas++;
-            i++;
-        } else if (vmas[i].start == vma.start) {
-            // we have seen this one before, update end if necessary
-            if (vmas[i].end != vma.end) {
-                vmas[i].end = vma.end;
-                free(vmas[i].pathname);
-                vmas[i].pathname = vma.pathname;
-                if (arguments.verbose) {
-                    printf("  updated VMA: #%zu: %#zx ... %#zx (%zu Pages, %s), %s\n",
-                           i, vmas[i].start, vmas[i].end, vmas[i].end - vmas[i].start,
-                           format_size_string((vmas[i].end - vmas[i].start) * g_system_pagesize),
-                           vmas[i].pathname);
+            new->lost_committed += committed_pages(&old->info[o]);
+            free_vma_info(&old->info[o]);
+            o++;
+        }
+        struct vma_exclusions *old_excluded = &old->excluded;
+        while (xo < old_excluded->len && old_excluded->entries[xo].end <= start) {
+            free(old_excluded->entries[xo].pathname);
+            xo++;
+        }
+
+        if (filter) {
+            struct vma_exclusion *e = xo < old_excluded->len ? &old_excluded->entries[xo] : NULL;
+            if (!select_vma(filter, old, o, e, start, end, perms, name)) {
+                char *pathname;
+                if (e && e->start == start && !strcmp(e->pathname, name)) {
+                    // carry over the exclusion
+                    pathname = e->pathname;
+                    e->pathname = NULL;
+                    xo++;
+                } else {
+                    if (verbose) {
+                        print_vma("filtered", new->len, start, end, name);
+                    }
+                    pathname = strdup(name);
+                    if (!pathname) {
+                        perror("strdup");
+                        return abort_merge(old, new, o, xo, 2);
+                    }
                 }
-            }
-            i++;
-        } else if (vmas[i].end == vma.end) {
-            // we also have seen this one before, update start if necessary
-            if (vmas[i].start != vma.start) {
-                vmas[i].start = vma.start;
-                free(vmas[i].pathname);
-                vmas[i].pathname = vma.pathname;
-                if (arguments.verbose) {
-                    printf("  updated VMA: #%zu: %#zx ... %#zx (%zu Pages, %s), %s\n",
-                           i, vmas[i].start, vmas[i].end, vmas[i].end - vmas[i].start,
-                           format_size_string((vmas[i].end - vmas[i].start) * g_system_pagesize),
-                           vmas[i].pathname);
+
+                int res = exclude_vma(&new->excluded, start, end, perms, filter->id, pathname);
+                if (res != 0) {
+                    free(pathname);
+                    return abort_merge(old, new, o, xo, res);
                 }
+                continue;
+            }
+        }
+
+        int res = reserve_vmas(new, new->len + 1);
+        if (res != 0) {
+            return abort_merge(old, new, o, xo, res);
+        }
+        size_t i = new->len++;
+
+        new->start[i] = start;
+        new->end[i] = end;
+
+        if (o < old->len && (old->start[o] == start || old->end[o] == end)) {
+            // we have seen this one before, carry over its state
+            new->committed[i] = old->committed[o];
+            new->accessed[i] = old->accessed[o];
+            new->softdirty[i] = old->softdirty[o];
+            new->info[i] = old->info[o];
+
+            if (strcmp(new->info[i].perms, perms)) {
+                strcpy(new->info[i].perms, perms);
+                new->info[i].scanned = 0;
             }
-            i++;
-        } else if (vmas[i].start > vma.start) {
-            // this is a new insert
-            vmas = realloc(vmas, sizeof(*vmas) * (num_vmas + 1));
-            if (!vmas) {
-                perror("realloc");
-                return 2;
+
+            if (strcmp(new->info[i].pathname, name)) {
+                char *pathname = strdup(name);
+                if (!pathname) {
+                    perror("strdup");
+                    return abort_merge(old, new, o + 1, xo, 2);
+                }
+                free(new->info[i].pathname);
+                new->info[i].pathname = pathname;
             }
-            memmove(vmas + i + 1, vmas + i, sizeof(*vmas) * (num_vmas - i));
-            vmas[i] = vma;
-            if (arguments.verbose) {
-                printf("  inserted new VMA: #%zu: %#zx ... %#zx (%zu Pages, %s), %s\n",
-                       i, vmas[i].start, vmas[i].end, vmas[i].end - vmas[i].start,
-                       format_size_string((vmas[i].end - vmas[i].start) * g_system_pagesize),
-                       vmas[i].pathname);
+
+            if (verbose && (old->start[o] != start || old->end[o] != end)) {
+                print_vma("updated", i, start, end, name);
             }
-            num_vmas++;
-            i++;
+            o++;
         } else {
-            // we lost one?
-            if (arguments.verbose) {
-                printf("  lost VMA: #%zu: %#zx ... %#zx (%zu Pages, %s), %s\n",
-                       i, vmas[i].start, vmas[i].end, vmas[i].end - vmas[i].start,
-                       format_size_string((vmas[i].end - vmas[i].start) * g_system_pagesize),
-                       vmas[i].pathname);
+            new->committed[i] = 0;
+            new->accessed[i] = 0;
+            new->softdirty[i] = 0;
+            memset(&new->info[i], 0, sizeof(new->info[i]));
+            new->info[i].perms[0] = r;
+            new->info[i].perms[1] = w;
+            new->info[i].perms[2] = x;
+            new->info[i].perms[3] = s;
+            new->info[i].rss = RSS_UNKNOWN;
+            new->info[i].pathname = strdup(name);
+            if (!new->info[i].pathname) {
+                perror("strdup");
+                return abort_merge(old, new, o, xo, 2);
+            }
+
+            if (verbose) {
+                print_vma(o < old->len ? "inserted new" : "appended new", i, start, end, name);
             }
-            memmove(vmas + i, vmas + i + 1, sizeof(*vmas) * (num_vmas - i - 1));
-            num_vmas--;
         }
+
+        new->info[i].filter_id = filter ? filter->id : 0;
     }
 
-    fclose(f);
+    // whatever is left of the previous VMAs is gone as well
+    for (; o < old->len; ++o) {
+        if (verbose) {
+            print_vma("lost", o, old->start[o], old->end[o], old->info[o].pathname);
+        }
+        new->lost_committed += committed_pages(&old->info[o]);
+        free_vma_info(&old->info[o]);
+    }
+    old->len = 0;
+    clear_exclusions(&old->excluded, xo);
 
-    // assert that no VMAs overlap
-    for (size_t i = 0; i < num_vmas; ++i) {
-        struct vma vma = vmas[i];
+    struct vma_table *spare = table->spare;
+    struct vma_table merged = *new;
+    *new = *table;
+    *table = merged;
+    table->spare = spare;
+    spare->spare = NULL;
 
-        if (vma.start >= vma.end) {
+    // assert that no VMAs overlap
+    for (size_t i = 0; i < table->len; ++i) {
+        if (table->start[i] >= table->end[i]) {
             fprintf(stderr, "error: VMA has zero or negative size\n");
             return -1;
         }
@@ -197,82 +317,112 @@ int update_vmas(const char *path, struct vma **buf, size_t *len, char *vma_filte
         if (i == 0)
             continue;
 
-        struct vma pre = vmas[i - 1];
-
-        if (pre.end > vma.start) {
+        if (table->end[i - 1] > table->start[i]) {
             fprintf(stderr, "error: VMAs overlap\n");
             return -1;
         }
     }
 
-    // // collapse VMAs into consecutive regions of virtual memory
-    // struct vma *big_vmas = NULL;
-    // size_t num_big_vmas = 0;
-
-    // for (size_t i = 0; i < num_vmas; ++i) {
-    //     if (num_big_vmas > 0 && vmas[i].start == big_vmas[num_big_vmas - 1].end) {
-    //         big_vmas[num_big_vmas - 1].end = vmas[i].end;
-    //         continue;
-    //     }
-
-    //     big_vmas = realloc(big_vmas, sizeof(*big_vmas) * (num_big_vmas + 1));
-    //     if (!big_vmas) {
-    //         perror("realloc");
-    //         return 2;
-    //     }
-    //     big_vmas[num_big_vmas] = vmas[i];
-    //     num_big_vmas++;
-    // }
-
-    // free(vmas);
-    // vmas = big_vmas;
-    // num_vmas = num_big_vmas;
-
-    // if (arguments.verbose) {
-    //     printf("\n");
-    //     printf("Aggregated into %zu consecutive regions:\n", num_vmas);
-    //     printf("\n");
-
-    //     size_t total_reserved = 0;
-    //     for (size_t i = 0; i < num_vmas; ++i) {
-    //         total_reserved += vmas[i].end - vmas[i].start;
-    //         printf("  #%zu: %#zx ... %#zx (%zu Pages, %s)\n",
-    //                i, vmas[i].start, vmas[i].end, vmas[i].end - vmas[i].start,
-    //                format_size_string((vmas[i].end - vmas[i].start) * g_system_pagesize));
-    //     }
-
-    //     printf("\n");
-    //     printf("Total Reserved: %zu Pages, %s\n",
-    //            total_reserved,
-    //            format_size_string(total_reserved * g_system_pagesize));
-    // }
-
-    *buf = vmas;
-    *len = num_vmas;
-
     return 0;
 }
 
-int clear_softdirty(const char *path) {
-    int fd = open(path, O_RDWR);
-    if (fd < 0) {
-        fprintf(stderr, "%s: ", path);
-        perror("open");
-        return 1;
+int append_vma(struct vma_table *table, size_t start, size_t end, const char *pathname) {
+    int res = reserve_vmas(table, table->len + 1);
+    if (res != 0)
+        return res;
+
+    size_t i = table->len;
+    table->start[i] = start;
+    table->end[i] = end;
+    table->committed[i] = 0;
+    table->accessed[i] = 0;
+    table->softdirty[i] = 0;
+    memset(&table->info[i], 0, sizeof(table->info[i]));
+    table->info[i].rss = RSS_UNKNOWN;
+    table->info[i].pathname = strdup(pathname);
+    if (!table->info[i].pathname) {
+        perror("strdup");
+        return 2;
     }
-    const char buf[] = "4";
 
-    int res = write(fd, buf, sizeof(buf));
-    if (res < 0) {
-        fprintf(stderr, "%s: ", path);
-        perror("write");
-        return 1;
+    table->len++;
+    return 0;
+}
+
+int update_rss(FILE *f, struct vma_table *table) {
+    for (size_t i = 0; i < table->len; ++i)
+        table->info[i].rss = RSS_UNKNOWN;
+
+    // smaps has a header line per VMA, followed by its key-value pairs. only
+    // the header and the Rss line are parsed, the rest is skipped cheaply.
+    ssize_t current = -1;
+    char buffer[4096];
+    while (fgets(buffer, sizeof(buffer), f) != NULL) {
+        if (!strncmp(buffer, "Rss:", 4)) {
+            if (current < 0)
+                continue;
+            size_t kib = strtoull(buffer + 4, NULL, 10);
+            table->info[current].rss = kib * 1024 / g_system_pagesize;
+            current = -1;
+        } else if (isxdigit(buffer[0])) {
+            char *dash;
+            size_t vm_start = strtoull(buffer, &dash, 16);
+            if (*dash != '-')
+                continue;
+
+            size_t start = vm_start / g_system_pagesize;
+            current = find_vma(table, start);
+            if (current >= 0 && table->start[current] != start)
+                current = -1;
+        }
     }
 
-    close(fd);
     return 0;
 }
 
+ssize_t find_vma(const struct vma_table *table, size_t page) {
+    // the VMAs are sorted and disjoint, so the last one starting at or
+    // before the page is the only candidate
+    size_t lo = 0;
+    size_t hi = table->len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (table->start[mid] <= page) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == 0 || table->end[lo - 1] <= page)
+        return -1;
+    return lo - 1;
+}
+
+static void free_columns(struct vma_table *table) {
+    for (size_t i = 0; i < table->len; ++i)
+        free_vma_info(&table->info[i]);
+
+    free(table->start);
+    free(table->end);
+    free(table->committed);
+    free(table->accessed);
+    free(table->softdirty);
+    free(table->info);
+
+    clear_exclusions(&table->excluded, 0);
+    free(table->excluded.entries);
+}
+
+void destroy_vmas(struct vma_table *table) {
+    if (table->spare) {
+        free_columns(table->spare);
+        free(table->spare);
+    }
+    free_columns(table);
+    memset(table, 0, sizeof(*table));
+}
+
 int clear_accessed(const char *path) {
     int fd = open(path, O_RDWR);
     if (fd < 0) {
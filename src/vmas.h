@@ -6,22 +6,121 @@
 #define VMAS_H_
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <sys/types.h>
 
-struct vma {
+#include "./filter.h"
+#include "./numa.h"
+#include "./rolling.h"
+
+// per-VMA state that is not touched by the page walk
+struct vma_info {
+    // per-node counters, allocated when NUMA tracking is enabled
+    struct smog_node_counters *nodes;
+
+    // per-granularity counters, allocated when granularities are configured
+    struct smog_block_counters *blocks;
+    struct smog_run_stats runs;
+
+    // the present, accessed and softdirty pages of the last frame the VMA
+    // was read in, one bitmap each over the extent it had then, and the
+    // transitions from the frame before
+    uint64_t *planes;
+    size_t planes_start;
+    size_t planes_end;
+    struct smog_churn churn;
+
+    // per-window counters, allocated when windows are configured, and the
+    // window each of them belongs to
+    struct smog_window_counters *windows;
+    size_t *window_epochs;
+
+    // an accessed and a softdirty bitmap per window over the pages of the
+    // VMA, allocated once it is read. the extent they were allocated for is
+    // kept, as VMAs may grow or shrink within a window.
+    uint64_t *window_bits;
+    size_t window_start;
+    size_t window_end;
+
+    // allocated when a rolling horizon is configured
+    struct rolling *rolling;
+
+    // when the VMA was last read
+    struct smog_vma_times times;
+
+    // permissions as in /proc/<pid>/maps, e.g. "rw-p"
+    char perms[5];
+
+    // whether the VMA was read from pagemap since its permissions changed
+    int scanned;
+
+    // the filter that selected the VMA as it is, if any
+    unsigned filter_id;
+
+    // resident pages as reported by smaps, or RSS_UNKNOWN
+    size_t rss;
+
+    char *pathname;
+};
+
+#define RSS_UNKNOWN ((size_t)-1)
+
+// a VMA excluded by the filter, kept so the filter is not evaluated again
+// while the VMA does not change
+struct vma_exclusion {
     size_t start;
     size_t end;
+    char perms[5];
+    unsigned filter_id;
+    char *pathname;
+};
 
-    size_t committed;
-    size_t accessed;
-    size_t softdirty;
+struct vma_exclusions {
+    size_t len;
+    size_t capacity;
+    struct vma_exclusion *entries;
+};
 
-    char *pathname;
+// the VMAs of a process, sorted by address and stored column-wise, so the
+// page walk only touches the address ranges and counters.
+struct vma_table {
+    size_t len;
+    size_t capacity;
+
+    size_t *start;
+    size_t *end;
+
+    size_t *committed;
+    size_t *accessed;
+    size_t *softdirty;
+
+    struct vma_info *info;
+
+    struct vma_exclusions excluded;
+
+    // the present pages of the VMAs lost in the last update, as of the last
+    // frame they were read in
+    size_t lost_committed;
+
+    // the table the next update is merged into, swapped in afterwards
+    struct vma_table *spare;
 };
 
-int update_vmas(const char *path, struct vma **buf, size_t *len, char *vma_filter);
+// merge the VMAs listed in the format of /proc/<pid>/maps into the table,
+// leaving out those not selected by the filter, if any
+int update_vmas(FILE *f, struct vma_table *table, const struct vma_filter *filter, int verbose);
+
+// add a VMA past the end of the table
+int append_vma(struct vma_table *table, size_t start, size_t end, const char *pathname);
+
+// fill in the resident pages of all VMAs from the format of /proc/<pid>/smaps
+int update_rss(FILE *f, struct vma_table *table);
+
+// find the VMA containing the given page, or return -1
+ssize_t find_vma(const struct vma_table *table, size_t page);
 
-int clear_softdirty(const char *path);
+void destroy_vmas(struct vma_table *table);
 
 int clear_accessed(const char *path);
 